@@ -0,0 +1,140 @@
+/*
+ * Dual ADC test.
+ *
+ * Instructions: Connect two signals between 0 and 3.3V to the pins
+ * for ADC channels 0 and 1 (PA0 and PA1); e.g. the same sine wave, once
+ * directly and once through an RC network.  Connect via SerialUSB, and
+ * press any key to start.
+ *
+ * First, ADC1 and ADC2 sample channels 0 and 1 simultaneously at
+ * SIMUL_RATE, clocked by TIMER3.  The mean of each channel and how
+ * many samples the second channel's rising mid-level crossings lag
+ * the first's are printed; with a sine wave in, the lag gives the phase
+ * shift.  Then both ADCs sample channel 0 in fast interleaved mode for
+ * a second, and the achieved sample rate is printed.
+ *
+ * This file is released into the public domain.
+ */
+
+#include "adc.h"
+
+#include "wirish.h"
+
+#define HALF_LEN 1024
+#define SIMUL_RATE 100000
+
+uint16 samples[2 * HALF_LEN] __attribute__((aligned(4)));
+adc_stream stream;
+
+volatile uint32 sum1, sum2;
+volatile int32 lag;
+
+/* Index of the first rising crossing of level at or after start, in
+ * every other sample, or -1. */
+static int32 rising_crossing(uint16 *s, uint16 count, uint16 start,
+                             uint16 level) {
+    for (uint16 i = start + 2; i < count; i += 2) {
+        if (s[i - 2] < level && s[i] >= level) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void simul_block(adc_stream *st, uint16 *block, uint16 count) {
+    uint32 a = 0, b = 0;
+    for (uint16 i = 0; i < count; i += 2) {
+        a += block[i];
+        b += block[i + 1];
+    }
+    sum1 = a;
+    sum2 = b;
+
+    /* block[2n] is channel 0 and block[2n + 1] channel 1, at the same
+     * instant. */
+    int32 x = rising_crossing(block, count, 0, a / (count / 2));
+    int32 y = x < 0 ? -1 : rising_crossing(block, count, x - 1,
+                                            b / (count / 2));
+    lag = (x < 0 || y < 0) ? -1 : (y - 1 - x) / 2;
+}
+
+void setup() {
+    pinMode(0, INPUT_ANALOG);
+    pinMode(1, INPUT_ANALOG);
+    adc_set_sample_rate(ADC1, ADC_SMPR_1_5);
+    adc_set_sample_rate(ADC2, ADC_SMPR_1_5);
+
+    stream.buffer = samples;
+    stream.half_len = HALF_LEN;
+
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+void loop() {
+    static const uint8 ch0 = 0, ch1 = 1;
+    int rc;
+
+    SerialUSB.println("Simultaneous:");
+    stream.callback = simul_block;
+    rc = adc_dual_stream_start_timer(&stream, &ch0, &ch1, 1,
+                                     TIMER3, SIMUL_RATE);
+    if (rc < 0) {
+        SerialUSB.print("\terror ");
+        SerialUSB.println(rc);
+    } else {
+        for (int i = 0; i < 5; i++) {
+            delay(200);
+            SerialUSB.print("\tmeans ");
+            SerialUSB.print(sum1 / (HALF_LEN / 2));
+            SerialUSB.print(", ");
+            SerialUSB.print(sum2 / (HALF_LEN / 2));
+            SerialUSB.print("; lag ");
+            SerialUSB.print(lag);
+            SerialUSB.print(" samples at ");
+            SerialUSB.print(stream.rate);
+            SerialUSB.println(" Hz");
+        }
+        adc_stream_stop(&stream);
+    }
+
+    SerialUSB.println("Fast interleaved:");
+    stream.callback = NULL;
+    rc = adc_dual_stream_start(&stream, ADC_DUAL_FAST_INTERLEAVED,
+                               &ch0, &ch0, 1, ADC_SWSTART);
+    if (rc < 0) {
+        SerialUSB.print("\terror ");
+        SerialUSB.println(rc);
+    } else {
+        uint32 start = micros();
+        delay(1000);
+        uint32 blocks = stream.blocks;
+        uint32 elapsed = micros() - start;
+        adc_stream_stop(&stream);
+        SerialUSB.print("\t");
+        SerialUSB.print((uint32)((uint64)blocks * HALF_LEN * 1000000 /
+                                 elapsed));
+        SerialUSB.println(" samples/s");
+    }
+
+    SerialUSB.println("Done; press any key to run again.");
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * ADC filter test.
+ *
+ * Instructions: Connect a signal between 0 and 3.3V to the pin for ADC
+ * channel 0 (PA0).  Connect via SerialUSB, and press any key to start.
+ *
+ * First, the speed of the filters in adc_filter.h is measured in
+ * cycles per input sample; their results are checked against
+ * reference vectors on the host by support/tests/test-adc-filter.c
+ * ("make host-test").
+ * Then ADC1 samples channel 0 at 100 kHz, and each half buffer is
+ * oversampled to 16 bits on the fly in the stream callback; the
+ * resulting 390 Hz stream of 16-bit values is printed about ten times
+ * a second.
+ *
+ * This file is released into the public domain.
+ */
+
+#include "adc.h"
+#include "adc_filter.h"
+
+#include "wirish.h"
+
+#define HALF_LEN 1024
+#define RATE 100000
+
+uint16 samples[2 * HALF_LEN];
+adc_stream stream;
+adc_cic oversampler;
+
+volatile uint16 latest;
+volatile uint32 outputs;
+
+static void benchmark(const char *name, adc_cic *cic) {
+    uint32 start = micros();
+    for (int i = 0; i < 16; i++) {
+        adc_cic_process(cic, samples, 2 * HALF_LEN, samples);
+    }
+    uint32 elapsed = micros() - start;
+    SerialUSB.print('\t');
+    SerialUSB.print(name);
+    SerialUSB.print(": ");
+    SerialUSB.print(elapsed * CYCLES_PER_MICROSECOND / (16 * 2 * HALF_LEN));
+    SerialUSB.println(" cycles/sample");
+}
+
+void half_done(adc_stream *s, uint16 *block, uint16 count) {
+    uint16 n = adc_cic_process(&oversampler, block, count, block);
+    if (n) {
+        latest = block[n - 1];
+        outputs += n;
+    }
+}
+
+void setup() {
+    pinMode(0, INPUT_ANALOG);
+    adc_set_sample_rate(ADC1, ADC_SMPR_13_5);
+
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+void loop() {
+    static const uint8 channel = 0;
+    adc_cic cic;
+
+    SerialUSB.println("Speed:");
+    adc_cic_init(&cic, 1, 1, 16, 14);
+    benchmark("boxcar", &cic);
+    adc_cic_init(&cic, 1, 3, 16, 16);
+    benchmark("CIC order 3", &cic);
+
+    SerialUSB.println("Oversampling channel 0 to 16 bits:");
+    adc_oversample_init(&oversampler, 1, 16);
+    outputs = 0;
+    stream.buffer = samples;
+    stream.half_len = HALF_LEN;
+    stream.callback = half_done;
+    int rc = adc_stream_start_timer(&stream, ADC1, &channel, 1,
+                                    TIMER3, RATE);
+    if (rc < 0) {
+        SerialUSB.print("\terror ");
+        SerialUSB.println(rc);
+    } else {
+        for (int i = 0; i < 20; i++) {
+            delay(100);
+            SerialUSB.print('\t');
+            SerialUSB.println(latest);
+        }
+        adc_stream_stop(&stream);
+        SerialUSB.print('\t');
+        SerialUSB.print(outputs);
+        SerialUSB.println(" outputs");
+    }
+
+    SerialUSB.println("Done; press any key to run again.");
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
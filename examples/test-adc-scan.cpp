@@ -0,0 +1,100 @@
+/*
+ * Continuous ADC scan test.
+ *
+ * Instructions: Connect voltages between 0 and 3.3V to the pins for
+ * ADC channels 0 through 7 (PA0..PA7).  Connect via SerialUSB.
+ *
+ * ADC1 converts all eight channels over and over, with DMA filling a
+ * ping-pong buffer.  Every second, the mean of each channel over the
+ * last half buffer is printed, along with the achieved sample rate and
+ * how many half buffers the callback has seen.
+ *
+ * This file is released into the public domain.
+ */
+
+#include "adc.h"
+
+#include "wirish.h"
+
+#define NCHANNELS 8
+#define SEQUENCES_PER_HALF 64
+#define HALF_LEN (NCHANNELS * SEQUENCES_PER_HALF)
+
+static const uint8 channels[NCHANNELS] = {0, 1, 2, 3, 4, 5, 6, 7};
+
+uint16 samples[2 * HALF_LEN];
+adc_stream stream;
+
+volatile uint32 sums[NCHANNELS];
+
+void half_done(adc_stream *s, uint16 *block, uint16 count) {
+    uint32 acc[NCHANNELS] = {0};
+    for (uint16 i = 0; i < count; i += NCHANNELS) {
+        for (uint8 c = 0; c < NCHANNELS; c++) {
+            acc[c] += block[i + c];
+        }
+    }
+    for (uint8 c = 0; c < NCHANNELS; c++) {
+        sums[c] = acc[c];
+    }
+}
+
+uint32 last_print = 0;
+uint32 last_blocks = 0;
+
+void setup() {
+    for (uint8 c = 0; c < NCHANNELS; c++) {
+        pinMode(c, INPUT_ANALOG);
+    }
+    adc_set_sample_rate(ADC1, ADC_SMPR_13_5);
+
+    stream.buffer = samples;
+    stream.half_len = HALF_LEN;
+    stream.callback = half_done;
+    int rc = adc_stream_start(&stream, ADC1, channels, NCHANNELS,
+                              ADC_SWSTART);
+    if (rc < 0) {
+        SerialUSB.print("adc_stream_start() failed: ");
+        SerialUSB.println(rc);
+    }
+}
+
+void loop() {
+    if (millis() - last_print < 1000) {
+        return;
+    }
+    last_print = millis();
+
+    uint32 blocks = stream.blocks;
+    uint32 rate = (blocks - last_blocks) * HALF_LEN;
+    last_blocks = blocks;
+
+    SerialUSB.print(rate);
+    SerialUSB.print(" samples/s, ");
+    SerialUSB.print(blocks);
+    SerialUSB.print(" blocks");
+    if (stream.error) {
+        SerialUSB.print(" (DMA error)");
+    }
+    SerialUSB.println();
+    for (uint8 c = 0; c < NCHANNELS; c++) {
+        SerialUSB.print('\t');
+        SerialUSB.print(sums[c] / SEQUENCES_PER_HALF);
+    }
+    SerialUSB.println();
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Timer-clocked ADC acquisition test.
+ *
+ * Instructions: Connect a signal between 0 and 3.3V to the pin for ADC
+ * channel 0 (PA0); a function generator makes this more interesting.
+ * Connect via SerialUSB, and press any key to start.
+ *
+ * For each rate in rates[], ADC1 samples channel 0 with TIMER3 as the
+ * sample clock for about a second.  The callback checks that each
+ * block's sequence number follows on from the last one, and tracks
+ * the minimum and maximum sample.  Afterwards, the number of samples
+ * delivered is compared with what the rate predicts for the elapsed
+ * time.
+ *
+ * This file is released into the public domain.
+ */
+
+#include "adc.h"
+
+#include "wirish.h"
+
+#define HALF_LEN 1024
+
+static const uint32 rates[] = {1000, 44100, 100000, 500000, 850000};
+
+uint16 samples[2 * HALF_LEN];
+adc_stream stream;
+
+volatile uint32 expected_sequence;
+volatile uint32 discontinuities;
+volatile uint16 min_sample, max_sample;
+
+void block_done(adc_stream *s, uint16 *block, uint16 count) {
+    if (s->sequence != expected_sequence) {
+        discontinuities++;
+    }
+    expected_sequence = s->sequence + count;
+
+    for (uint16 i = 0; i < count; i++) {
+        if (block[i] < min_sample) {
+            min_sample = block[i];
+        }
+        if (block[i] > max_sample) {
+            max_sample = block[i];
+        }
+    }
+}
+
+void setup() {
+    pinMode(0, INPUT_ANALOG);
+    adc_set_sample_rate(ADC1, ADC_SMPR_1_5);
+
+    stream.buffer = samples;
+    stream.half_len = HALF_LEN;
+    stream.callback = block_done;
+
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+void loop() {
+    static const uint8 channel = 0;
+
+    for (uint32 i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        expected_sequence = 0;
+        discontinuities = 0;
+        min_sample = 0xFFFF;
+        max_sample = 0;
+
+        SerialUSB.print(rates[i]);
+        SerialUSB.print(" Hz requested: ");
+        uint32 start = micros();
+        int rc = adc_stream_start_timer(&stream, ADC1, &channel, 1,
+                                        TIMER3, rates[i]);
+        if (rc < 0) {
+            SerialUSB.print("error ");
+            SerialUSB.println(rc);
+            continue;
+        }
+        delay(1000);
+        uint32 blocks = stream.blocks;
+        uint32 elapsed = micros() - start;
+        adc_stream_stop(&stream);
+
+        uint64 predicted = (uint64)stream.rate * elapsed / 1000000;
+        SerialUSB.print(stream.rate);
+        SerialUSB.print(" Hz actual, ");
+        SerialUSB.print(blocks * HALF_LEN);
+        SerialUSB.print(" samples (");
+        SerialUSB.print((uint32)predicted);
+        SerialUSB.print(" predicted), ");
+        SerialUSB.print(discontinuities);
+        SerialUSB.print(" discontinuities, range ");
+        SerialUSB.print(min_sample);
+        SerialUSB.print("..");
+        SerialUSB.println(max_sample);
+        if (stream.error) {
+            SerialUSB.println("\tDMA error");
+        }
+    }
+
+    SerialUSB.println("Done; press any key to run again.");
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * DAC waveform test.
+ *
+ * Instructions: On a board with a DAC (e.g. Maple Native), watch the
+ * DAC outputs (PA4 for channel 1, PA5 for channel 2) with a scope.
+ * Connect via SerialUSB; each key pressed moves on to the next test.
+ *
+ * 1. A looped 1 kHz sine on channel 1, from a 64-sample table.
+ * 2. Dual mode: sine on channel 1 and cosine on channel 2, changing
+ *    together, for a circle in X-Y mode.
+ * 3. A streamed sawtooth on channel 2, whose slope the callback
+ *    changes as it refills each half buffer; the number of refills
+ *    is printed.
+ * 4. A one-shot ramp on channel 1; its completion is reported.
+ *
+ * No CPU time is spent per sample in any of them.
+ *
+ * This file is released into the public domain.
+ */
+
+#include "dac.h"
+
+#include "wirish.h"
+
+#define TABLE_LEN 64
+#define STREAM_LEN 256
+
+/* 12-bit sine, one period */
+static const uint16 sine[TABLE_LEN] = {
+    2048, 2248, 2447, 2642, 2831, 3013, 3185, 3346,
+    3495, 3630, 3750, 3853, 3939, 4007, 4056, 4085,
+    4095, 4085, 4056, 4007, 3939, 3853, 3750, 3630,
+    3495, 3346, 3185, 3013, 2831, 2642, 2447, 2248,
+    2048, 1847, 1648, 1453, 1264, 1082, 910, 749,
+    600, 465, 345, 242, 156, 88, 39, 10,
+    0, 10, 39, 88, 156, 242, 345, 465,
+    600, 749, 910, 1082, 1264, 1453, 1648, 1847,
+};
+
+uint16 pairs[2 * TABLE_LEN] __attribute__((aligned(4)));
+uint16 stream_buf[STREAM_LEN];
+uint16 ramp[TABLE_LEN];
+dac_wave wave;
+
+uint16 saw_value = 0;
+uint16 saw_step = 16;
+
+void refill(dac_wave *w, uint16 *block, uint16 count) {
+    for (uint16 i = 0; i < count; i++) {
+        block[i] = saw_value;
+        saw_value = (saw_value + saw_step) & 0xFFF;
+    }
+    saw_step = saw_step % 64 + 16;
+}
+
+static void wait_key(void) {
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+static void report(int rc) {
+    if (rc < 0) {
+        SerialUSB.print("\terror ");
+        SerialUSB.println(rc);
+    } else {
+        SerialUSB.print("\t");
+        SerialUSB.print(wave.rate);
+        SerialUSB.println(" samples/s");
+    }
+}
+
+void setup() {
+    dac_init(DAC, DAC_CH1 | DAC_CH2);
+    for (int i = 0; i < TABLE_LEN; i++) {
+        pairs[2 * i] = sine[i];
+        pairs[2 * i + 1] = sine[(i + TABLE_LEN / 4) % TABLE_LEN];
+        ramp[i] = i * 64;
+    }
+    wait_key();
+}
+
+void loop() {
+    SerialUSB.println("Looped sine on channel 1:");
+    wave.samples = sine;
+    wave.length = TABLE_LEN;
+    wave.mode = DAC_WAVE_LOOP;
+    wave.callback = NULL;
+    report(dac_wave_start(&wave, DAC, DAC_CH1, TIMER6, TABLE_LEN * 1000));
+    wait_key();
+    dac_wave_stop(&wave);
+
+    SerialUSB.println("Dual mode sine and cosine:");
+    wave.samples = pairs;
+    report(dac_wave_start(&wave, DAC, DAC_CH1 | DAC_CH2, TIMER6,
+                          TABLE_LEN * 1000));
+    wait_key();
+    dac_wave_stop(&wave);
+
+    SerialUSB.println("Streamed sawtooth on channel 2:");
+    wave.samples = stream_buf;
+    wave.length = STREAM_LEN;
+    wave.mode = DAC_WAVE_STREAM;
+    wave.callback = refill;
+    refill(&wave, stream_buf, STREAM_LEN);
+    report(dac_wave_start(&wave, DAC, DAC_CH2, TIMER7, 100000));
+    wait_key();
+    dac_wave_stop(&wave);
+    SerialUSB.print("\t");
+    SerialUSB.print(wave.blocks);
+    SerialUSB.println(" refills");
+
+    SerialUSB.println("One-shot ramp on channel 1:");
+    wave.samples = ramp;
+    wave.length = TABLE_LEN;
+    wave.mode = DAC_WAVE_ONESHOT;
+    wave.callback = NULL;
+    report(dac_wave_start(&wave, DAC, DAC_CH1, TIMER6, 1000));
+    while (!wave.done)
+        ;
+    SerialUSB.println("\tone-shot done");
+    delay(1);
+    dac_wave_stop(&wave);
+
+    SerialUSB.println("Done; press any key to run again.");
+    wait_key();
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file test-dma-memcpy.cpp
+ *
+ * Benchmarks dma_memcpy_async() and dma_memset_async() against the C
+ * library's memcpy() and memset(), and checks their results.
+ *
+ * For each size, prints the average time (in microseconds) taken by
+ * the CPU routine, by the DMA routine when the caller just waits for
+ * it, and how much of the DMA time the CPU had free for other work
+ * (measured by counting busy-loop iterations while the DMA runs).
+ *
+ * Send any character over SerialUSB to start.
+ *
+ * This file is released into the public domain.
+ */
+
+#include <string.h>
+
+#include "dma.h"
+
+#include "wirish.h"
+
+#define MAX_SIZE 8192
+#define ITERATIONS 64
+
+uint8 src_buf[MAX_SIZE + 4] __attribute__((aligned(4)));
+uint8 dst_buf[MAX_SIZE + 4] __attribute__((aligned(4)));
+
+static const uint32 sizes[] = {16, 64, 256, 1024, 4096, MAX_SIZE};
+
+void benchmark(uint32 size, uint32 src_offset, uint32 dst_offset);
+void check(void);
+
+void setup() {
+    dma_dev *dev;
+    dma_channel channel;
+
+    if (dma_request_channel(DMA_REQ_MEM_2_MEM, DMA_PRIORITY_LOW,
+                            "test-dma-memcpy", &dev, &channel) < 0) {
+        ASSERT(0);
+    }
+    dma_mem_reserve(dev, channel);
+    for (uint32 i = 0; i < sizeof(src_buf); i++) {
+        src_buf[i] = i * 7 + 3;
+    }
+
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+void loop() {
+    SerialUSB.println("Checking results...");
+    check();
+
+    SerialUSB.println();
+    SerialUSB.println("size\tsrc+\tdst+\tmemcpy\tdma\tfree\t"
+                      "memset\tdma\tfree");
+    for (uint32 i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        benchmark(sizes[i], 0, 0);
+        benchmark(sizes[i], 2, 0);
+        benchmark(sizes[i], 1, 0);
+    }
+
+    SerialUSB.println("Done.");
+    while (true)
+        continue;
+}
+
+/* Average microseconds per call, and the fraction (in percent) of the
+ * DMA operation's duration the CPU spent spinning in a loop it could
+ * have used for something else. */
+void benchmark(uint32 size, uint32 src_offset, uint32 dst_offset) {
+    uint8 *src = src_buf + src_offset;
+    uint8 *dst = dst_buf + dst_offset;
+    dma_mem_op op;
+    uint32 start, cpu_copy, dma_copy, cpu_set, dma_set;
+    uint32 spins, copy_free, set_free;
+
+    op.callback = NULL;
+
+    start = micros();
+    for (int i = 0; i < ITERATIONS; i++) {
+        memcpy(dst, src, size);
+    }
+    cpu_copy = micros() - start;
+
+    spins = 0;
+    start = micros();
+    for (int i = 0; i < ITERATIONS; i++) {
+        dma_memcpy_async(dst, src, size, &op);
+        while (!dma_mem_op_done(&op)) {
+            spins++;
+        }
+    }
+    dma_copy = micros() - start;
+    copy_free = spins;
+
+    start = micros();
+    for (int i = 0; i < ITERATIONS; i++) {
+        memset(dst, i, size);
+    }
+    cpu_set = micros() - start;
+
+    spins = 0;
+    start = micros();
+    for (int i = 0; i < ITERATIONS; i++) {
+        dma_memset_async(dst, i, size, &op);
+        while (!dma_mem_op_done(&op)) {
+            spins++;
+        }
+    }
+    dma_set = micros() - start;
+    set_free = spins;
+
+    /* Calibrate: how long do the same number of spins take? */
+    start = micros();
+    for (volatile uint32 n = 0; n < copy_free; n++)
+        ;
+    copy_free = micros() - start;
+    start = micros();
+    for (volatile uint32 n = 0; n < set_free; n++)
+        ;
+    set_free = micros() - start;
+
+    SerialUSB.print(size);
+    SerialUSB.print('\t');
+    SerialUSB.print(src_offset);
+    SerialUSB.print('\t');
+    SerialUSB.print(dst_offset);
+    SerialUSB.print('\t');
+    SerialUSB.print((double)cpu_copy / ITERATIONS);
+    SerialUSB.print('\t');
+    SerialUSB.print((double)dma_copy / ITERATIONS);
+    SerialUSB.print('\t');
+    SerialUSB.print(dma_copy ? min(copy_free * 100 / dma_copy, 100) : 0);
+    SerialUSB.print("%\t");
+    SerialUSB.print((double)cpu_set / ITERATIONS);
+    SerialUSB.print('\t');
+    SerialUSB.print((double)dma_set / ITERATIONS);
+    SerialUSB.print('\t');
+    SerialUSB.print(dma_set ? min(set_free * 100 / dma_set, 100) : 0);
+    SerialUSB.println('%');
+}
+
+void check(void) {
+    dma_mem_op op;
+    uint32 failures = 0;
+
+    op.callback = NULL;
+    for (uint32 src_offset = 0; src_offset < 4; src_offset++) {
+        for (uint32 dst_offset = 0; dst_offset < 4; dst_offset++) {
+            for (uint32 size = 0; size < 80; size++) {
+                uint8 *src = src_buf + src_offset;
+                uint8 *dst = dst_buf + dst_offset;
+
+                memset(dst_buf, 0xAA, sizeof(dst_buf));
+                dma_memcpy_async(dst, src, size, &op);
+                dma_mem_wait(&op);
+                if (op.error || memcmp(dst, src, size) ||
+                    (dst_offset && dst[-1] != 0xAA) || dst[size] != 0xAA) {
+                    failures++;
+                }
+
+                dma_memset_async(dst, 0x55, size, &op);
+                dma_mem_wait(&op);
+                for (uint32 i = 0; i < size; i++) {
+                    if (dst[i] != 0x55) {
+                        failures++;
+                        break;
+                    }
+                }
+                if (op.error || dst[size] != 0xAA) {
+                    failures++;
+                }
+            }
+        }
+    }
+
+    SerialUSB.print("Failures: ");
+    SerialUSB.println(failures);
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
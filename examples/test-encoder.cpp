@@ -0,0 +1,153 @@
+/*
+ * Quadrature encoder test.
+ *
+ * Instructions: Connect pin 0 to pin 5 and pin 1 to pin 9, so that
+ * pins 0 and 1 can play the A and B signals of an encoder into TIMER4
+ * channels 1 and 2.  Connect via SerialUSB, and press any key to
+ * start.
+ *
+ * First, 70000 steps forward are played, checking that the position
+ * gets past the 16-bit counter's range; then 140000 steps back, to
+ * below zero; then 70000 forward, back to zero.  Writing the position
+ * is checked too.  Then the encoder is spun at about 10000 steps per
+ * second for a second, with a timer wheel on TIMER2 sampling the
+ * velocity at 100 Hz, and the velocity is printed alongside the rate
+ * measured with micros().
+ *
+ * This file is released into the public domain.
+ */
+
+#include "timer_encoder.h"
+#include "timer_wheel.h"
+
+#include "wirish.h"
+
+#define A_OUT 0
+#define B_OUT 1
+#define SAMPLE_HZ 100
+
+timer_encoder enc;
+timer_wheel wheel;
+timer_wheel_entry sampler;
+
+static uint8 phase;
+static int32 direction;
+static uint32 failures;
+
+void sample(timer_wheel_entry *entry) {
+    timer_encoder_sample(&enc);
+}
+
+/* One quadrature edge forward (dir = 1) or back (dir = -1). */
+static void step(int32 dir) {
+    phase = (phase + dir) & 3;
+    digitalWrite(A_OUT, phase == 1 || phase == 2);
+    digitalWrite(B_OUT, phase >= 2);
+}
+
+static void steps(int32 n) {
+    int32 dir = n < 0 ? -1 : 1;
+    for (int32 i = 0; i != n; i += dir) {
+        step(dir);
+    }
+}
+
+static void check(const char *name, int32 want) {
+    int32 got = timer_encoder_read(&enc);
+    SerialUSB.print('\t');
+    SerialUSB.print(name);
+    SerialUSB.print(": ");
+    SerialUSB.print(got);
+    if (got == want) {
+        SerialUSB.println(" ok");
+    } else {
+        SerialUSB.print(" FAILED, wanted ");
+        SerialUSB.println(want);
+        failures++;
+    }
+}
+
+void setup() {
+    pinMode(A_OUT, OUTPUT);
+    pinMode(B_OUT, OUTPUT);
+    pinMode(5, INPUT);
+    pinMode(9, INPUT);
+    digitalWrite(A_OUT, LOW);
+    digitalWrite(B_OUT, LOW);
+
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+void loop() {
+    int rc = timer_encoder_start(&enc, TIMER4, TIMER_ENCODER_TI12, 0, 3);
+    if (rc < 0) {
+        SerialUSB.print("timer_encoder_start() failed: ");
+        SerialUSB.println(rc);
+        return;
+    }
+
+    /* Which way is forward depends on the wiring; find out. */
+    steps(4);
+    direction = timer_encoder_read(&enc) < 0 ? -1 : 1;
+    steps(-4);
+
+    SerialUSB.println("Position:");
+    failures = 0;
+    check("start", 0);
+    steps(70000);
+    check("70000 forward", 70000 * direction);
+    steps(-140000);
+    check("140000 back", -70000 * direction);
+    steps(70000);
+    check("70000 forward", 0);
+    timer_encoder_write(&enc, -5);
+    steps(10);
+    check("written -5, 10 forward", -5 + 10 * direction);
+    SerialUSB.print('\t');
+    SerialUSB.print(failures);
+    SerialUSB.println(" failures");
+
+    SerialUSB.println("Velocity:");
+    enc.sample_hz = SAMPLE_HZ;
+    timer_wheel_start(&wheel, TIMER2, 1, 10000);
+    timer_wheel_entry_init(&sampler, sample, NULL);
+    timer_wheel_add(&wheel, &sampler, 10000 / SAMPLE_HZ,
+                    10000 / SAMPLE_HZ);
+    int32 start_position = timer_encoder_read(&enc);
+    uint32 start = micros();
+    while (micros() - start < 1000000) {
+        step(1);
+        delayMicroseconds(100);
+    }
+    int32 moved = timer_encoder_read(&enc) - start_position;
+    uint32 elapsed = micros() - start;
+    SerialUSB.print("\t");
+    SerialUSB.print(enc.velocity);
+    SerialUSB.print(" counts/s sampled, ");
+    SerialUSB.print((int32)((int64)moved * 1000000 / (int32)elapsed));
+    SerialUSB.println(" counts/s measured");
+    timer_wheel_stop(&wheel);
+    timer_encoder_stop(&enc);
+
+    SerialUSB.println("Done; press any key to run again.");
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Queued I2C transaction test.
+ *
+ * Instructions: Connect up to NSENSORS I2C slaves to I2C1 (SCL: PB6,
+ * SDA: PB7), with pull-up resistors.  Set sensor_addrs[] to their
+ * addresses and sensor_regs[] to a register worth reading on each.
+ * Connect via SerialUSB.
+ *
+ * Every 100 ms, a register read from each sensor is queued with
+ * i2c_master_submit(), and loop() keeps running while the bus works
+ * through them.  The completion callback for the last one reports how
+ * many loop() iterations happened meanwhile, followed by each
+ * sensor's result and data.
+ *
+ * If libmaple was built with I2C_TRACE_SIZE (or I2C_DEBUG), bus
+ * events are traced, and sending a 'd' dumps the trace buffer for
+ * support/scripts/i2c-trace.py --serial to decode.
+ *
+ * This file is released into the public domain.
+ */
+
+#include "i2c.h"
+
+#include "wirish.h"
+
+#define NSENSORS 8
+#define READ_LEN 2
+
+uint16 sensor_addrs[NSENSORS] = {0x48, 0x49, 0x4A, 0x4B,
+                                 0x4C, 0x4D, 0x4E, 0x4F};
+uint8 sensor_regs[NSENSORS] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+uint8 sensor_data[NSENSORS][READ_LEN];
+i2c_msg msgs[NSENSORS][2];
+i2c_xfer xfers[NSENSORS];
+
+volatile uint32 spins = 0;
+volatile uint32 spins_at_done = 0;
+volatile bool round_done = false;
+uint32 last_round = 0;
+
+void sensor_read_done(i2c_xfer *xfer) {
+    if (xfer == &xfers[NSENSORS - 1]) {
+        spins_at_done = spins;
+        round_done = true;
+    }
+}
+
+void setup() {
+    i2c_master_enable(I2C1, I2C_FAST_MODE | I2C_BUS_RESET);
+#if I2C_TRACE_SIZE
+    i2c_trace_enable();
+#endif
+
+    for (int i = 0; i < NSENSORS; i++) {
+        msgs[i][0].addr = sensor_addrs[i];
+        msgs[i][0].flags = 0;
+        msgs[i][0].length = 1;
+        msgs[i][0].data = &sensor_regs[i];
+
+        msgs[i][1].addr = sensor_addrs[i];
+        msgs[i][1].flags = I2C_MSG_READ;
+        msgs[i][1].length = READ_LEN;
+        msgs[i][1].data = sensor_data[i];
+
+        xfers[i].msgs = msgs[i];
+        xfers[i].num = 2;
+        xfers[i].timeout = 5;
+        xfers[i].callback = sensor_read_done;
+    }
+}
+
+void loop() {
+    spins++;
+
+#if I2C_TRACE_SIZE
+    if (SerialUSB.available() && SerialUSB.read() == 'd') {
+        i2c_trace_disable();
+        SerialUSB.write(&i2c_trace_buf, sizeof(i2c_trace_buf));
+        i2c_trace_enable();
+        round_done = false;
+        return;
+    }
+#endif
+
+    if (round_done) {
+        round_done = false;
+        SerialUSB.print("Loop iterations during round: ");
+        SerialUSB.println(spins_at_done);
+        for (int i = 0; i < NSENSORS; i++) {
+            SerialUSB.print("\t0x");
+            SerialUSB.print(sensor_addrs[i], HEX);
+            SerialUSB.print(": ");
+            if (xfers[i].result < 0) {
+                SerialUSB.print("error ");
+                SerialUSB.println(xfers[i].result);
+                continue;
+            }
+            for (int j = 0; j < READ_LEN; j++) {
+                SerialUSB.print(sensor_data[i][j], HEX);
+                SerialUSB.print(' ');
+            }
+            SerialUSB.println();
+        }
+    }
+
+    if (millis() - last_round >= 100 && i2c_master_is_idle(I2C1)) {
+        last_round = millis();
+        spins = 0;
+        for (int i = 0; i < NSENSORS; i++) {
+            i2c_master_submit(I2C1, &xfers[i]);
+        }
+    }
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Timer interrupt dispatch latency test.
+ *
+ * Instructions: Connect via SerialUSB, and press any key to start.
+ * For the direct handler comparison, build with TIMER_DIRECT_IRQS=0x8
+ * (e.g. "make TIMER_DIRECT_IRQS=0x8").
+ *
+ * A timer ticking at the CPU clock raises a compare interrupt, and
+ * the first thing its handler does is read the counter, so the count
+ * past the compare value is the number of cycles from the compare
+ * match to the handler: exception entry, dispatch, and the read
+ * itself.  This is measured for a handler on TIMER2 attached with
+ * timer_attach_interrupt(), and, if TIMER_DIRECT_IRQS includes
+ * TIMER3, for an __irq_tim3() defined below.  Minimum, mean and
+ * maximum are printed; the maximum includes any delay from other
+ * interrupts (SysTick, USB).
+ *
+ * This file is released into the public domain.
+ */
+
+#include "timer.h"
+
+#include "wirish.h"
+
+#define COMPARE 0x8000
+#define SAMPLES 1000
+
+volatile uint32 samples;
+volatile uint32 sum, min_cycles, max_cycles;
+
+static inline void record(uint16 count) {
+    uint32 cycles = (uint16)(count - COMPARE);
+    if (samples < SAMPLES) {
+        sum += cycles;
+        if (cycles < min_cycles) {
+            min_cycles = cycles;
+        }
+        if (cycles > max_cycles) {
+            max_cycles = cycles;
+        }
+        samples++;
+    }
+}
+
+void table_handler(void) {
+    record(TIMER2_BASE->CNT);
+}
+
+#if TIMER_DIRECT_IRQS & (1 << 3)
+extern "C" void __irq_tim3(void) {
+    uint16 count = TIMER3_BASE->CNT;
+    TIMER3_BASE->SR = ~TIMER_SR_CC1IF;
+    record(count);
+}
+#endif
+
+static void measure(const char *name, timer_dev *dev, voidFuncPtr handler) {
+    samples = 0;
+    sum = 0;
+    min_cycles = 0xFFFFFFFF;
+    max_cycles = 0;
+
+    timer_pause(dev);
+    timer_set_prescaler(dev, 0);
+    timer_set_reload(dev, 0xFFFF);
+    timer_oc_set_mode(dev, TIMER_CH1, TIMER_OC_MODE_FROZEN, 0);
+    timer_set_compare(dev, TIMER_CH1, COMPARE);
+    timer_generate_update(dev);
+    timer_attach_interrupt(dev, TIMER_CC1_INTERRUPT, handler);
+    timer_resume(dev);
+    while (samples < SAMPLES)
+        ;
+    timer_pause(dev);
+    timer_detach_interrupt(dev, TIMER_CC1_INTERRUPT);
+
+    SerialUSB.print(name);
+    SerialUSB.print(": min ");
+    SerialUSB.print(min_cycles);
+    SerialUSB.print(", mean ");
+    SerialUSB.print((sum + SAMPLES / 2) / SAMPLES);
+    SerialUSB.print(", max ");
+    SerialUSB.print(max_cycles);
+    SerialUSB.println(" cycles");
+}
+
+void setup() {
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+void loop() {
+    measure("Dispatch table (TIMER2)", TIMER2, table_handler);
+#if TIMER_DIRECT_IRQS & (1 << 3)
+    measure("Direct handler (TIMER3)", TIMER3, NULL);
+#else
+    SerialUSB.println("Direct handler: rebuild with TIMER_DIRECT_IRQS=0x8");
+#endif
+
+    SerialUSB.println("Done; press any key to run again.");
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
@@ -25,6 +25,7 @@ char buf[BUF_SIZE];
 void test_numbers(void);
 void test_base_arithmetic(void);
 void test_floating_point(void);
+void test_printf(void);
 
 void print_separator(void);
 
@@ -47,6 +48,9 @@ void loop() {
     test_floating_point();
     print_separator();
 
+    test_printf();
+    print_separator();
+
     SerialUSB.println("Test finished.");
     while (true) {
         continue;
@@ -160,6 +164,44 @@ void test_floating_point(void) {
     SerialUSB.println(-5.67f);
     SerialUSB.print("Float max: ");
     SerialUSB.println(fmax);
+
+    SerialUSB.println();
+
+    SerialUSB.print("printlnFixed(-3 << 15, 16, 4) (Q16.16 -1.5): ");
+    SerialUSB.printlnFixed(-3 << 15, 16, 4);
+    SerialUSB.print("printlnFixed(0x7fffffff, 31, 9) (Q31 max): ");
+    SerialUSB.printlnFixed(0x7fffffff, 31, 9);
+    SerialUSB.print("printlnFixed(12345, 0, 2): ");
+    SerialUSB.printlnFixed(12345, 0, 2);
+}
+
+#define PRINTF_TEST(...)                        \
+    do {                                        \
+        SerialUSB.printf(__VA_ARGS__);          \
+        SerialUSB.print(" -- snprintf(): ");    \
+        snprintf(buf, BUF_SIZE, __VA_ARGS__);   \
+        SerialUSB.println(buf);                 \
+    } while (0)
+
+void test_printf(void) {
+    SerialUSB.println("printf():");
+
+    PRINTF_TEST("[%d] [%5d] [%-5d] [%05d]", -42, -42, -42, -42);
+    PRINTF_TEST("[%+d] [% d] [%.3d] [%.0d]", 7, 7, 7, 0);
+    PRINTF_TEST("[%u] [%i]", numeric_limits<unsigned int>::max(),
+                numeric_limits<int>::min());
+    PRINTF_TEST("[%lld] [%llu]", numeric_limits<long long>::min(),
+                numeric_limits<unsigned long long>::max());
+    PRINTF_TEST("[%x] [%X] [%#x] [%#o] [%08llx]", 0xbeefu, 0xbeefu, 255u,
+                8u, 0xcafeULL);
+    PRINTF_TEST("[%hhd] [%hu]", 300, 70000u);
+    PRINTF_TEST("[%c] [%3c] [%-3c]", 'a', 'b', 'c');
+    PRINTF_TEST("[%s] [%8s] [%-8s] [%.2s] [%*s]", "abc", "abc", "abc",
+                "abc", 6, "xy");
+    PRINTF_TEST("[%f] [%.2f] [%8.3f] [%-8.1f] [%08.2f]", 3.14159, -2.006,
+                1.0 / 3, 9.99, -3.25);
+    PRINTF_TEST("[%.9f] [%f]", 123.456789123, 1e15);
+    PRINTF_TEST("[%p] [100%%]", (void*)buf);
 }
 
 void print_separator(void) {
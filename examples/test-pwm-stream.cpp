@@ -0,0 +1,160 @@
+/*
+ * Timer PWM streaming test.
+ *
+ * Instructions: On a Maple, connect the data input of a strip of
+ * NLEDS WS2812 LEDs to D11, and watch D5 with a scope or a stepper
+ * driver's step input.  Connect via SerialUSB, and press any key to
+ * start.
+ *
+ * 1. TIMER3 runs 800 kHz PWM on D11, and a one-shot stream writes one
+ *    duty cycle per bit of WS2812 data into CCR2, followed by a low
+ *    reset period.  A colour wheel scrolls along the strip.
+ * 2. TIMER4 outputs 10 us step pulses on D5, and a refilled stream
+ *    writes each step's period into ARR, accelerating from 1 kHz to
+ *    20 kHz and back down, over and over.  The number of steps output
+ *    is printed every second.
+ *
+ * No CPU time is spent per bit or per step.
+ *
+ * This file is released into the public domain.
+ */
+
+#include "timer_pwm_stream.h"
+
+#include "wirish.h"
+
+#define NLEDS 8
+#define RESET_PERIODS 50
+/* 1.25 us per bit at 72 MHz */
+#define WS2812_PERIOD 90
+#define WS2812_0 25
+#define WS2812_1 50
+
+#define RAMP_LEN 256
+#define SLOW_PERIOD 1000
+#define FAST_PERIOD 50
+
+uint16 led_bits[NLEDS * 24 + RESET_PERIODS];
+timer_pwm_stream leds;
+
+uint16 ramp[RAMP_LEN];
+timer_pwm_stream steps;
+uint16 step_period = SLOW_PERIOD;
+int16 step_delta = -2;
+
+/* WS2812 wants green, red, blue, most significant bit first. */
+static void set_led(uint16 n, uint8 r, uint8 g, uint8 b) {
+    uint32 grb = ((uint32)g << 16) | ((uint32)r << 8) | b;
+    uint16 *bits = &led_bits[n * 24];
+    for (int i = 23; i >= 0; i--) {
+        *bits++ = grb & (1UL << i) ? WS2812_1 : WS2812_0;
+    }
+}
+
+static void wheel(uint8 pos, uint8 *r, uint8 *g, uint8 *b) {
+    if (pos < 85) {
+        *r = 255 - pos * 3; *g = pos * 3; *b = 0;
+    } else if (pos < 170) {
+        pos -= 85;
+        *r = 0; *g = 255 - pos * 3; *b = pos * 3;
+    } else {
+        pos -= 170;
+        *r = pos * 3; *g = 0; *b = 255 - pos * 3;
+    }
+}
+
+/* Each step's ARR value is one less than its period in microseconds;
+ * the period shrinks or grows by step_delta per step. */
+void refill_ramp(timer_pwm_stream *s, uint16 *block, uint16 count) {
+    for (uint16 i = 0; i < count; i++) {
+        block[i] = step_period - 1;
+        step_period += step_delta;
+        if (step_period <= FAST_PERIOD || step_period >= SLOW_PERIOD) {
+            step_delta = -step_delta;
+        }
+    }
+}
+
+void setup() {
+    /* WS2812 data */
+    pinMode(11, PWM);
+    timer_pause(TIMER3);
+    timer_set_prescaler(TIMER3, 0);
+    timer_set_reload(TIMER3, WS2812_PERIOD - 1);
+    timer_set_compare(TIMER3, TIMER_CH2, 0);
+    timer_generate_update(TIMER3);
+    timer_resume(TIMER3);
+    leds.values = led_bits;
+    leds.length = sizeof(led_bits) / sizeof(led_bits[0]);
+    leds.mode = TIMER_PWM_STREAM_ONESHOT;
+    leds.callback = NULL;
+    /* The trailing reset periods are already zero. */
+
+    /* Step pulses */
+    pinMode(5, PWM);
+    timer_pause(TIMER4);
+    timer_set_prescaler(TIMER4, CYCLES_PER_MICROSECOND - 1);
+    timer_set_reload(TIMER4, SLOW_PERIOD - 1);
+    timer_set_compare(TIMER4, TIMER_CH1, 10);
+    timer_generate_update(TIMER4);
+    steps.values = ramp;
+    steps.length = RAMP_LEN;
+    steps.mode = TIMER_PWM_STREAM_REFILL;
+    steps.callback = refill_ramp;
+    refill_ramp(&steps, ramp, RAMP_LEN);
+
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+
+    int rc = timer_pwm_stream_start(&steps, TIMER4, TIMER_DMA_BASE_ARR, 1);
+    if (rc < 0) {
+        SerialUSB.print("Step stream failed: ");
+        SerialUSB.println(rc);
+    }
+}
+
+uint8 offset = 0;
+uint32 last_print = 0;
+
+void loop() {
+    for (uint16 n = 0; n < NLEDS; n++) {
+        uint8 r, g, b;
+        wheel(offset + n * 256 / NLEDS, &r, &g, &b);
+        set_led(n, r / 8, g / 8, b / 8);
+    }
+    offset++;
+
+    int rc = timer_pwm_stream_start(&leds, TIMER3, TIMER_DMA_BASE_CCR2, 1);
+    if (rc < 0) {
+        SerialUSB.print("LED stream failed: ");
+        SerialUSB.println(rc);
+        delay(1000);
+        return;
+    }
+    while (!leds.done)
+        ;
+    timer_pwm_stream_stop(&leds);
+    delay(20);
+
+    if (millis() - last_print >= 1000) {
+        last_print = millis();
+        SerialUSB.print(steps.blocks * (RAMP_LEN / 2));
+        SerialUSB.println(" steps");
+    }
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * SoftI2C speed test.
+ *
+ * Instructions: Connect an I2C slave which answers at SLAVE_ADDR (an
+ * EEPROM works well) to SDA_PIN and SCL_PIN, with pull-up resistors
+ * strong enough for 1 MHz (2.2k or less).  Connect via SerialUSB, and
+ * press any key to start.
+ *
+ * At each supported bus speed, reads BURST_LEN bytes from register 0
+ * of the slave NBURSTS times, and prints the effective SCL frequency
+ * (9 clocks per byte).  Watch SCL with a scope to check the delay
+ * calibration in Wire.cpp.
+ *
+ * This file is released into the public domain.
+ */
+
+#include "Wire.h"
+
+#include "wirish.h"
+
+#define SDA_PIN 20
+#define SCL_PIN 21
+#define SLAVE_ADDR 0x50
+
+#define BURST_LEN 64
+#define NBURSTS 16
+
+static const uint32 speeds[] = {WIRE_100KHZ, WIRE_400KHZ, WIRE_1MHZ};
+
+SoftI2C bus;
+uint8 buf[BURST_LEN];
+
+void setup() {
+    bus.begin(SDA_PIN, SCL_PIN, WIRE_100KHZ);
+
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+void loop() {
+    static const uint8 reg[2] = {0, 0};
+
+    for (uint32 i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+        uint8 ret = SUCCESS;
+
+        bus.setFrequency(speeds[i]);
+        uint32 start = micros();
+        for (int n = 0; n < NBURSTS && ret == SUCCESS; n++) {
+            ret = bus.writeRead(SLAVE_ADDR, reg, sizeof(reg), buf, BURST_LEN);
+        }
+        uint32 elapsed = micros() - start;
+
+        SerialUSB.print(speeds[i]);
+        SerialUSB.print(" Hz: ");
+        if (ret != SUCCESS) {
+            SerialUSB.print("error ");
+            SerialUSB.println(ret);
+            continue;
+        }
+        /* address + 2 register bytes + address + data, 9 clocks each */
+        uint32 clocks = NBURSTS * (4 + BURST_LEN) * 9;
+        SerialUSB.print(elapsed ? clocks * 1000 / elapsed : 0);
+        SerialUSB.println(" kHz effective");
+    }
+
+    SerialUSB.println("Done; press any key to run again.");
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * DMA SPI loopback test.
+ *
+ * Instructions: Connect SPI1's MISO to its MOSI.  Connect via
+ * SerialUSB, and press any key to start.
+ *
+ * Checks HardwareSPI::transfer(tx, rx, len), the 16-bit frame
+ * methods, and queued transactions at 18 MHz, then reports the
+ * throughput of a large queued transfer and how much of its duration
+ * the CPU had free.  The chip select
+ * pin toggles around each queued transaction; watch it with a scope.
+ *
+ * This file is released into the public domain.
+ */
+
+#include <string.h>
+
+#include "wirish.h"
+
+HardwareSPI spi(1);
+
+#define CS_PIN 10               // any free GPIO will do
+#define BUF_SIZE 4096
+uint8 tx_buf[BUF_SIZE] __attribute__((aligned(4)));
+uint8 rx_buf[BUF_SIZE] __attribute__((aligned(4)));
+
+#define NTRANSACTIONS 4
+SPITransaction transactions[NTRANSACTIONS];
+volatile uint32 callbacks = 0;
+
+void transaction_done(SPITransaction *t) {
+    callbacks++;
+}
+
+void setup() {
+    pinMode(CS_PIN, OUTPUT);
+    digitalWrite(CS_PIN, HIGH);
+    spi.begin(SPI_18MHZ, MSBFIRST, 0);
+    for (uint32 i = 0; i < BUF_SIZE; i++) {
+        tx_buf[i] = i ^ (i >> 8);
+    }
+
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+void loop() {
+    uint32 failures = 0;
+
+    SerialUSB.println("Blocking transfer():");
+    for (uint32 len = 1; len <= 64; len++) {
+        memset(rx_buf, 0, sizeof(rx_buf));
+        spi.transfer(tx_buf, rx_buf, len);
+        if (memcmp(tx_buf, rx_buf, len)) {
+            failures++;
+        }
+    }
+    SerialUSB.print("\tfailures: ");
+    SerialUSB.println(failures);
+
+    SerialUSB.println("16-bit frames:");
+    failures = 0;
+    uint16 *tx16 = (uint16*)tx_buf;
+    uint16 *rx16 = (uint16*)rx_buf;
+    memset(rx_buf, 0, sizeof(rx_buf));
+    spi.transfer16(tx16, rx16, BUF_SIZE / 2);
+    if (memcmp(tx_buf, rx_buf, BUF_SIZE)) {
+        failures++;
+    }
+    SPITransaction fill;
+    uint16 color = 0xF81F;      // RGB565 magenta
+    fill.csPin = SPI_NO_CS;
+    fill.txBuffer = &color;
+    fill.rxBuffer = rx16;
+    fill.length = BUF_SIZE / 2;
+    fill.callback = NULL;
+    spi.queue(&fill, SPI_TRANSACTION_16BIT | SPI_TRANSACTION_TX_FILL);
+    while (!fill.done)
+        ;
+    for (uint32 i = 0; i < BUF_SIZE / 2; i++) {
+        if (rx16[i] != color) {
+            failures++;
+            break;
+        }
+    }
+    SerialUSB.print("\tfailures: ");
+    SerialUSB.println(failures);
+
+    SerialUSB.println("Queued transactions:");
+    failures = 0;
+    callbacks = 0;
+    memset(rx_buf, 0, sizeof(rx_buf));
+    uint32 chunk = BUF_SIZE / NTRANSACTIONS;
+    for (uint32 i = 0; i < NTRANSACTIONS; i++) {
+        SPITransaction *t = &transactions[i];
+        t->csPin = CS_PIN;
+        t->txBuffer = tx_buf + i * chunk;
+        t->rxBuffer = rx_buf + i * chunk;
+        t->length = chunk;
+        t->callback = transaction_done;
+        if (!spi.queue(t)) {
+            SerialUSB.println("\tcouldn't get SPI1 DMA channels");
+        }
+    }
+    uint32 start = micros();
+    uint32 spins = 0;
+    while (!spi.isIdle()) {
+        spins++;
+    }
+    uint32 elapsed = micros() - start;
+    if (memcmp(tx_buf, rx_buf, BUF_SIZE)) {
+        failures++;
+    }
+    SerialUSB.print("\tfailures: ");
+    SerialUSB.print(failures);
+    SerialUSB.print(", callbacks: ");
+    SerialUSB.println(callbacks);
+    SerialUSB.print("\t");
+    SerialUSB.print(BUF_SIZE);
+    SerialUSB.print(" bytes in ");
+    SerialUSB.print(elapsed);
+    SerialUSB.print(" us (");
+    SerialUSB.print(elapsed ? BUF_SIZE * 8 / elapsed : 0);
+    SerialUSB.print(" Mbit/s); CPU spun ");
+    SerialUSB.print(spins);
+    SerialUSB.println(" times meanwhile");
+
+    SerialUSB.println("Done; press any key to run again.");
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
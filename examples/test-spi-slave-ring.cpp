@@ -0,0 +1,73 @@
+/*
+ * SPI slave DMA ring test.
+ *
+ * Instructions: Connect SPI2 to a SPI master which drives our NSS
+ * pin low for the duration of each frame (e.g. another board queueing
+ * HardwareSPI transactions with csPin wired to our NSS).  Connect via
+ * SerialUSB.
+ *
+ * Every frame the master sends (delimited by NSS) is printed in hex,
+ * along with the number of frames dropped so far.  During each frame,
+ * the master receives a response holding the number of frames
+ * received before it.
+ *
+ * This file is released into the public domain.
+ */
+
+#include "wirish.h"
+
+HardwareSPI spi(2);
+
+#define RING_SIZE 1024
+uint8 ring[RING_SIZE];
+
+uint8 frame[256];
+uint8 response[4];
+uint32 frames_received = 0;
+
+void setup() {
+    if (!spi.beginSlaveRing(ring, RING_SIZE, MSBFIRST, 0)) {
+        SerialUSB.println("Couldn't get SPI2 DMA channels");
+    }
+    spi.setSlaveResponse(response, sizeof(response));
+}
+
+void loop() {
+    uint32 len = spi.readFrame(frame, sizeof(frame));
+    if (len == 0) {
+        return;
+    }
+
+    frames_received++;
+    response[0] = frames_received >> 24;
+    response[1] = frames_received >> 16;
+    response[2] = frames_received >> 8;
+    response[3] = frames_received;
+    spi.setSlaveResponse(response, sizeof(response));
+
+    SerialUSB.print("Frame (");
+    SerialUSB.print(len);
+    SerialUSB.print(" bytes, ");
+    SerialUSB.print(spi.droppedFrames());
+    SerialUSB.print(" dropped):");
+    for (uint32 i = 0; i < len && i < sizeof(frame); i++) {
+        SerialUSB.print(' ');
+        SerialUSB.print(frame[i], HEX);
+    }
+    SerialUSB.println();
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
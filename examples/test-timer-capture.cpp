@@ -0,0 +1,134 @@
+/*
+ * Timer input capture test.
+ *
+ * Instructions: On a Maple, connect D11 to D6, D2, and D5.  Connect
+ * via SerialUSB, and press any key to start.
+ *
+ * TIMER3 generates a 1 kHz, 25% duty cycle PWM signal on D11.  It is
+ * measured three ways at once:
+ *
+ * 1. TIMER1 timestamps its rising edges on D6 by DMA, at 1 MHz.
+ * 2. TIMER2 timestamps its rising edges on D2 from the capture
+ *    interrupt, at 72 MHz, with 32-bit timestamps.
+ * 3. TIMER4 measures its period and duty cycle on D5 in PWM input
+ *    mode, at 1 MHz.
+ *
+ * The frequency and edge-to-edge jitter from each capture, and the
+ * period and duty cycle from PWM input mode, are printed every half
+ * second.  Each key pressed halves the PWM frequency, until it wraps
+ * round below 16 Hz, the slowest the 1 MHz captures can follow.
+ *
+ * This file is released into the public domain.
+ */
+
+#include "timer_capture.h"
+
+#include "wirish.h"
+
+#define RING_SIZE 64
+
+uint32 dma_ring[RING_SIZE];
+uint32 irq_ring[RING_SIZE];
+timer_capture dma_cap;
+timer_capture irq_cap;
+
+uint16 pwm_period = 1000;
+
+static void set_pwm(void) {
+    timer_pause(TIMER3);
+    timer_set_reload(TIMER3, pwm_period - 1);
+    timer_set_compare(TIMER3, 2, pwm_period / 4);
+    timer_generate_update(TIMER3);
+    timer_resume(TIMER3);
+}
+
+static void report(const char *name, timer_capture *cap) {
+    timer_capture_stats stats;
+
+    timer_capture_stats_read(cap, &stats);
+    SerialUSB.print('\t');
+    SerialUSB.print(name);
+    SerialUSB.print(": ");
+    SerialUSB.print(stats.millihertz / 1000);
+    SerialUSB.print('.');
+    SerialUSB.print(stats.millihertz % 1000);
+    SerialUSB.print(" Hz, jitter ");
+    SerialUSB.print(stats.max_period - stats.min_period);
+    SerialUSB.print(" ticks, ");
+    SerialUSB.print(stats.edges);
+    SerialUSB.print(" edges, ");
+    SerialUSB.print(cap->dropped);
+    SerialUSB.println(" dropped");
+}
+
+static void check(const char *name, int rc) {
+    if (rc < 0) {
+        SerialUSB.print(name);
+        SerialUSB.print(" failed: ");
+        SerialUSB.println(rc);
+    }
+}
+
+void setup() {
+    pinMode(11, PWM);
+    pinMode(6, INPUT_FLOATING);
+    pinMode(2, INPUT_FLOATING);
+    pinMode(5, INPUT_FLOATING);
+
+    /* 1 MHz PWM clock */
+    timer_set_prescaler(TIMER3, CYCLES_PER_MICROSECOND - 1);
+    set_pwm();
+
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+
+    timer_set_prescaler(TIMER1, CYCLES_PER_MICROSECOND - 1);
+    dma_cap.ring = dma_ring;
+    dma_cap.size = RING_SIZE;
+    check("DMA capture",
+          timer_capture_start(&dma_cap, TIMER1, 1, 0, 0));
+
+    timer_set_prescaler(TIMER2, 0);
+    irq_cap.ring = irq_ring;
+    irq_cap.size = RING_SIZE;
+    check("Interrupt capture",
+          timer_capture_start(&irq_cap, TIMER2, 1, TIMER_CAPTURE_IRQ, 0));
+
+    timer_set_prescaler(TIMER4, CYCLES_PER_MICROSECOND - 1);
+    timer_pwm_input_start(TIMER4, 0);
+}
+
+void loop() {
+    if (SerialUSB.available()) {
+        SerialUSB.read();
+        pwm_period = pwm_period >= 32768 ? 1000 : pwm_period * 2;
+        set_pwm();
+    }
+
+    delay(500);
+    SerialUSB.print(1000000 / pwm_period);
+    SerialUSB.println(" Hz generated:");
+    report("DMA", &dma_cap);
+    report("interrupt", &irq_cap);
+    SerialUSB.print("\tPWM input: period ");
+    SerialUSB.print(timer_pwm_input_period(TIMER4));
+    SerialUSB.print(" ticks, duty ");
+    SerialUSB.print(timer_pwm_input_duty(TIMER4) / 100);
+    SerialUSB.println("%");
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Chained timer test.
+ *
+ * Instructions: On a Maple, connect D11 to D12.  Connect via
+ * SerialUSB, and press any key to start.
+ *
+ * TIMER3 (ticking at 1 MHz) and TIMER4 are chained into a 32-bit
+ * microsecond counter.  Once a second, its count is printed next to
+ * micros(), and the difference between the two should stay put.
+ *
+ * TIMER3 channel 2 also outputs PWM on D11, with a period of one
+ * TIMER3 overflow, 65536 us.  Its rising edges are captured on D12
+ * (TIMER3 channel 1) with 32-bit timestamps, and the interval between
+ * the last two should be exactly 65536.
+ *
+ * Finally, a compare is set 2.5 seconds ahead each time it fires,
+ * toggling the LED; how late each callback runs is printed.
+ *
+ * This file is released into the public domain.
+ */
+
+#include "timer_chain.h"
+
+#include "wirish.h"
+
+timer_chain chain;
+
+volatile uint32 previous_capture;
+volatile uint32 capture_interval;
+volatile uint32 compare_late;
+volatile uint32 compares;
+uint32 compare_when;
+
+void captured(timer_chain *c, uint32 when) {
+    capture_interval = when - previous_capture;
+    previous_capture = when;
+}
+
+void compared(timer_chain *c) {
+    compare_late = timer_chain_read(c) - compare_when;
+    compares++;
+    toggleLED();
+    compare_when += 2500000;
+    timer_chain_compare(c, 3, compare_when, compared);
+}
+
+void setup() {
+    pinMode(BOARD_LED_PIN, OUTPUT);
+    pinMode(12, INPUT_FLOATING);
+
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+
+    int rc = timer_chain_init(&chain, TIMER3, TIMER4, NULL,
+                              CYCLES_PER_MICROSECOND - 1);
+    if (rc < 0) {
+        SerialUSB.print("timer_chain_init() failed: ");
+        SerialUSB.println(rc);
+        return;
+    }
+    pinMode(11, PWM);
+    pwmWrite(11, 0x8000);
+
+    timer_chain_capture_start(&chain, 1, 0, 0, captured);
+    timer_chain_start(&chain);
+    compare_when = timer_chain_read(&chain) + 2500000;
+    timer_chain_compare(&chain, 3, compare_when, compared);
+}
+
+void loop() {
+    delay(1000);
+
+    uint32 count = timer_chain_read(&chain);
+    uint32 us = micros();
+    SerialUSB.print("chain ");
+    SerialUSB.print(count);
+    SerialUSB.print(" us, micros() ");
+    SerialUSB.print(us);
+    SerialUSB.print(", difference ");
+    SerialUSB.println((int32)(us - count));
+
+    SerialUSB.print("\t");
+    SerialUSB.print(chain.captures);
+    SerialUSB.print(" captures, last interval ");
+    SerialUSB.print(capture_interval);
+    SerialUSB.println(" us");
+
+    SerialUSB.print("\t");
+    SerialUSB.print(compares);
+    SerialUSB.print(" compares, last ");
+    SerialUSB.print(compare_late);
+    SerialUSB.println(" us late");
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
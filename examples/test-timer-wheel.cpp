@@ -0,0 +1,128 @@
+/*
+ * Timer wheel test.
+ *
+ * Instructions: Connect via SerialUSB, and press any key to start.
+ *
+ * NTIMERS periodic software timers, with periods from 50 us up to
+ * about 20 ms, all run from TIMER2 channel 1 at 1 MHz.  Each counts
+ * its callbacks; after a second, the counts are compared with what
+ * each period predicts.  A one-shot is scheduled and cancelled before
+ * it fires, and another is scheduled and checked to fire once.  The
+ * wheel's worst latency, longest callback and overrun count are
+ * printed at the end.
+ *
+ * This file is released into the public domain.
+ */
+
+#include "timer_wheel.h"
+
+#include "wirish.h"
+
+#define NTIMERS 32
+
+timer_wheel wheel;
+timer_wheel_entry periodic[NTIMERS];
+timer_wheel_entry cancelled, oneshot;
+
+volatile uint32 counts[NTIMERS];
+volatile uint32 oneshot_fired;
+volatile uint32 cancelled_fired;
+
+void tick(timer_wheel_entry *entry) {
+    counts[(uint32)entry->arg]++;
+}
+
+void fire_once(timer_wheel_entry *entry) {
+    (*(volatile uint32*)entry->arg)++;
+}
+
+static uint32 period_of(uint32 i) {
+    return 50 + i * i * 20 + i * 7;
+}
+
+void setup() {
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+void loop() {
+    uint32 bad = 0;
+
+    int rc = timer_wheel_start(&wheel, TIMER2, 1, 1000000);
+    if (rc < 0) {
+        SerialUSB.print("timer_wheel_start() failed: ");
+        SerialUSB.println(rc);
+        return;
+    }
+
+    for (uint32 i = 0; i < NTIMERS; i++) {
+        counts[i] = 0;
+        timer_wheel_entry_init(&periodic[i], tick, (void*)i);
+        timer_wheel_add(&wheel, &periodic[i], period_of(i), period_of(i));
+    }
+    oneshot_fired = 0;
+    cancelled_fired = 0;
+    timer_wheel_entry_init(&oneshot, fire_once, (void*)&oneshot_fired);
+    timer_wheel_entry_init(&cancelled, fire_once, (void*)&cancelled_fired);
+    timer_wheel_add(&wheel, &oneshot, 123456, 0);
+    timer_wheel_add(&wheel, &cancelled, 500000, 0);
+
+    delay(200);
+    timer_wheel_cancel(&wheel, &cancelled);
+    delay(800);
+    for (uint32 i = 0; i < NTIMERS; i++) {
+        timer_wheel_cancel(&wheel, &periodic[i]);
+    }
+
+    for (uint32 i = 0; i < NTIMERS; i++) {
+        uint32 expected = 1000000 / period_of(i);
+        uint32 got = counts[i];
+        /* Allow for the milliseconds spent setting up and printing. */
+        if (got + expected / 100 + 1 < expected || got > expected + 1) {
+            SerialUSB.print("\tperiod ");
+            SerialUSB.print(period_of(i));
+            SerialUSB.print(" us: ");
+            SerialUSB.print(got);
+            SerialUSB.print(" calls, expected ");
+            SerialUSB.println(expected);
+            bad++;
+        }
+    }
+    SerialUSB.print(bad);
+    SerialUSB.println(" periodic timers off count");
+    SerialUSB.print("One-shot fired ");
+    SerialUSB.print(oneshot_fired);
+    SerialUSB.print(" time(s), cancelled one-shot fired ");
+    SerialUSB.print(cancelled_fired);
+    SerialUSB.println(" time(s)");
+    SerialUSB.print("Max latency ");
+    SerialUSB.print(wheel.max_latency);
+    SerialUSB.print(" us, longest callback ");
+    SerialUSB.print(wheel.max_duration);
+    SerialUSB.print(" us, ");
+    SerialUSB.print(wheel.overruns);
+    SerialUSB.println(" overruns");
+
+    timer_wheel_stop(&wheel);
+
+    SerialUSB.println("Done; press any key to run again.");
+    while (!SerialUSB.available())
+        continue;
+    SerialUSB.read();
+}
+
+// Force init to be called *first*, i.e. before static object allocation.
+// Otherwise, statically allocated objects that need libmaple may fail.
+__attribute__((constructor)) void premain() {
+    init();
+}
+
+int main(void) {
+    setup();
+
+    while (true) {
+        loop();
+    }
+    return 0;
+}
@@ -29,14 +29,16 @@
 
 #define USART USART2
 #define USART_HWSER Serial2
-#define USART_DMA_DEV DMA1
-#define USART_RX_DMA_CHANNEL DMA_CH6
+#define USART_RX_DMA_REQ DMA_REQ_USART2_RX
 #define USART_TX BOARD_USART2_TX_PIN
 #define USART_RX BOARD_USART2_RX_PIN
 
 #define BUF_SIZE 8
 uint8 rx_buf[BUF_SIZE];
 
+dma_dev *usart_dma_dev;
+dma_channel usart_rx_dma_channel;
+
 dma_irq_cause irq_cause;
 
 volatile uint32 irq_fired = 0;
@@ -56,8 +58,8 @@ void loop(void) {
     toggleLED();
     delay(100);
 
-    dma_channel_reg_map *ch_regs = dma_channel_regs(USART_DMA_DEV,
-                                                    USART_RX_DMA_CHANNEL);
+    dma_channel_reg_map *ch_regs = dma_channel_regs(usart_dma_dev,
+                                                    usart_rx_dma_channel);
     if (irq_fired) {
         USART_HWSER.println("** IRQ **");
         irq_fired = 0;
@@ -65,7 +67,7 @@ void loop(void) {
     USART_HWSER.print("[");
     USART_HWSER.print(millis());
     USART_HWSER.print("]\tISR bits: 0x");
-    uint8 isr_bits = dma_get_isr_bits(USART_DMA_DEV, USART_RX_DMA_CHANNEL);
+    uint8 isr_bits = dma_get_isr_bits(usart_dma_dev, usart_rx_dma_channel);
     USART_HWSER.print(isr_bits, HEX);
     USART_HWSER.print("\tCCR: 0x");
     USART_HWSER.print(ch_regs->CCR, HEX);
@@ -81,7 +83,7 @@ void loop(void) {
     USART_HWSER.println();
     if (isr_bits == 0x7) {
         USART_HWSER.println("** Clearing ISR bits.");
-        dma_clear_isr_bits(USART_DMA_DEV, USART_RX_DMA_CHANNEL);
+        dma_clear_isr_bits(usart_dma_dev, usart_rx_dma_channel);
     }
 }
 
@@ -93,14 +95,18 @@ void init_usart(void) {
 
 /* Configure DMA transmission */
 void init_dma_xfer(void) {
-    dma_init(USART_DMA_DEV);
-    dma_setup_transfer(USART_DMA_DEV, USART_RX_DMA_CHANNEL,
+    if (dma_request_channel(USART_RX_DMA_REQ, DMA_PRIORITY_MEDIUM,
+                            "test-usart-dma", &usart_dma_dev,
+                            &usart_rx_dma_channel) < 0) {
+        ASSERT(0);              // someone else has the channel
+    }
+    dma_setup_transfer(usart_dma_dev, usart_rx_dma_channel,
                        &USART->regs->DR, DMA_SIZE_8BITS,
                        rx_buf,           DMA_SIZE_8BITS,
                        (DMA_MINC_MODE | DMA_CIRC_MODE | DMA_TRNS_CMPLT));
-    dma_set_num_transfers(USART_DMA_DEV, USART_RX_DMA_CHANNEL, BUF_SIZE);
-    dma_attach_interrupt(USART_DMA_DEV, USART_RX_DMA_CHANNEL, rx_dma_irq);
-    dma_enable(USART_DMA_DEV, USART_RX_DMA_CHANNEL);
+    dma_set_num_transfers(usart_dma_dev, usart_rx_dma_channel, BUF_SIZE);
+    dma_attach_interrupt(usart_dma_dev, usart_rx_dma_channel, rx_dma_irq);
+    dma_enable(usart_dma_dev, usart_rx_dma_channel);
 }
 
 void rx_dma_irq(void) {
@@ -40,6 +40,8 @@
 #include "libmaple.h"
 #include "rcc.h"
 #include "adc.h"
+#include "dma.h"
+#include "timer.h"
 
 static adc_dev adc1 = {
     .regs   = ADC1_BASE,
@@ -162,3 +164,483 @@ uint16 adc_read(const adc_dev *dev, uint8 channel) {
 
     return (uint16)(regs->DR & ADC_DR_DATA);
 }
+
+/**
+ * @brief Set the regular conversion sequence.
+ *
+ * Don't call this during conversion.
+ *
+ * @param dev ADC device
+ * @param channels Channels to convert, in order.  A channel may
+ *                 appear more than once.
+ * @param length Number of channels in the sequence, from 1 to 16.
+ * @see adc_set_reg_seqlen()
+ */
+void adc_set_reg_sequence(const adc_dev *dev,
+                          const uint8 *channels,
+                          uint8 length) {
+    /* SQ1..SQ6 are in SQR3, SQ7..SQ12 in SQR2, SQ13..SQ16 in SQR1 */
+    uint32 sqr[3] = {0, 0, 0};
+    uint8 i;
+
+    ASSERT(length >= 1 && length <= 16);
+    for (i = 0; i < length; i++) {
+        sqr[i / 6] |= (channels[i] & 0x1F) << (5 * (i % 6));
+    }
+
+    dev->regs->SQR3 = sqr[0];
+    dev->regs->SQR2 = sqr[1];
+    dev->regs->SQR1 = sqr[2] | ((length - 1) << 20);
+}
+
+/*
+ * Streaming conversions
+ */
+
+static void adc_stream_dma(void *arg, dma_irq_cause cause) {
+    adc_stream *stream = (adc_stream*)arg;
+    uint16 *samples = stream->buffer;
+
+    switch (cause) {
+    case DMA_TRANSFER_HALF_COMPLETE:
+        break;
+    case DMA_TRANSFER_COMPLETE:
+        samples += stream->half_len;
+        break;
+    case DMA_TRANSFER_ERROR:
+        stream->error = 1;
+        return;
+    }
+
+    stream->sequence = stream->blocks * (stream->half_len /
+                                         stream->nchannels);
+    stream->blocks++;
+    if (stream->callback) {
+        stream->callback(stream, samples, stream->half_len);
+    }
+}
+
+/* Claim the DMA channel for dev and reset the stream's state */
+static int adc_stream_claim(adc_stream *stream,
+                            const adc_dev *dev,
+                            uint8 seq_samples) {
+    dma_request_line line;
+    int rc;
+
+    ASSERT(stream->half_len > 0 && stream->half_len % seq_samples == 0);
+    ASSERT(stream->half_len <= 0xFFFF / 2);
+
+    if (dev == ADC1) {
+        line = DMA_REQ_ADC1;
+#ifdef STM32_HIGH_DENSITY
+    } else if (dev == ADC3) {
+        line = DMA_REQ_ADC3;
+#endif
+    } else {
+        return ADC_ERROR_NO_DMA;
+    }
+    rc = dma_request_channel(line, DMA_PRIORITY_HIGH, "ADC stream",
+                             &stream->dma_d, &stream->dma_ch);
+    if (rc < 0) {
+        return rc;
+    }
+    stream->dev = dev;
+    stream->nchannels = seq_samples;
+    stream->dual = 0;
+    stream->timer = NULL;
+    stream->rate = 0;
+    stream->blocks = 0;
+    stream->sequence = 0;
+    stream->error = 0;
+    return 0;
+}
+
+/* Queue the circular transfer from the ADC data register.  32-bit
+ * transfers move both results of a dual conversion at once. */
+static int adc_stream_queue(adc_stream *stream, dma_xfer_size size) {
+    uint32 words = 2 * stream->half_len;
+    dma_xfer xfer;
+    int rc;
+
+    if (size == DMA_SIZE_32BITS) {
+        words /= 2;
+    }
+    xfer.peripheral_address = &stream->dev->regs->DR;
+    xfer.peripheral_size = size;
+    xfer.memory_address = stream->buffer;
+    xfer.memory_size = size;
+    xfer.num_transfers = words;
+    xfer.mode = DMA_MINC_MODE | DMA_CIRC_MODE | DMA_HALF_TRNS;
+    xfer.priority = DMA_PRIORITY_HIGH;
+    xfer.callback = adc_stream_dma;
+    xfer.arg = stream;
+    rc = dma_queue_xfer(stream->dma_d, stream->dma_ch, &xfer);
+    if (rc < 0) {
+        dma_release_channel(stream->dma_d, stream->dma_ch);
+    }
+    return rc;
+}
+
+/* Enable DMA requests and start converting on the trigger */
+static void adc_stream_go(const adc_dev *dev, adc_extsel_event trigger) {
+    adc_reg_map *regs = dev->regs;
+
+    regs->CR2 |= ADC_CR2_DMA;
+    adc_set_extsel(dev, trigger);
+    adc_set_exttrig(dev, 1);
+    if (trigger == ADC_SWSTART) {
+        regs->CR2 |= ADC_CR2_CONT;
+        regs->CR2 |= ADC_CR2_SWSTART;
+    }
+}
+
+/* Stop converting and program a sequence, with scan mode as needed */
+static void adc_stream_setup(const adc_dev *dev,
+                             const uint8 *channels,
+                             uint8 nchannels) {
+    dev->regs->CR2 &= ~(ADC_CR2_CONT | ADC_CR2_DMA);
+    adc_set_reg_sequence(dev, channels, nchannels);
+    *bb_perip(&dev->regs->CR1, ADC_CR1_SCAN_BIT) = nchannels > 1;
+}
+
+/**
+ * @brief Start converting a sequence of channels into a ping-pong buffer.
+ *
+ * If trigger is ADC_SWSTART, the ADC converts continuously, as fast as
+ * the sample time set with adc_set_sample_rate() allows.  Otherwise,
+ * each trigger event converts the whole sequence once.
+ *
+ * The ADC must already be enabled and calibrated, as ADC1 and ADC2
+ * are by Wirish.  adc_read() must not be used on it until the stream
+ * is stopped.
+ *
+ * @param stream Stream to start; its buffer, half_len, and callback
+ *               fields must be filled in.
+ * @param dev ADC1, or ADC3 on high-density devices.
+ * @param channels Channels to convert, in order.
+ * @param nchannels Sequence length, from 1 to 16.
+ * @param trigger Event which starts each sequence, or ADC_SWSTART to
+ *                convert continuously.
+ * @return 0 on success, ADC_ERROR_NO_DMA if the device has no DMA
+ *         request line, or a negative DMA error if its DMA channel
+ *         couldn't be claimed.
+ * @see adc_stream_stop()
+ */
+int adc_stream_start(adc_stream *stream,
+                     const adc_dev *dev,
+                     const uint8 *channels,
+                     uint8 nchannels,
+                     adc_extsel_event trigger) {
+    int rc;
+
+    rc = adc_stream_claim(stream, dev, nchannels);
+    if (rc < 0) {
+        return rc;
+    }
+    adc_stream_setup(dev, channels, nchannels);
+    rc = adc_stream_queue(stream, DMA_SIZE_16BITS);
+    if (rc < 0) {
+        return rc;
+    }
+    adc_stream_go(dev, trigger);
+    return 0;
+}
+
+/**
+ * @brief Start ADC1 and ADC2 converting together into one stream.
+ *
+ * Results are packed in pairs by DMA; see adc_dual_mode.  The stream's
+ * half_len must be a multiple of twice the sequence length, and the
+ * two ADCs should have the same sample times.
+ *
+ * In simultaneous mode, trigger works as for adc_stream_start(); it
+ * is ADC1's trigger, and ADC2 follows it.  No channel may appear at
+ * the same position in both sequences.  In fast interleaved mode,
+ * nchannels must be 1 and the channels the same; trigger should be
+ * ADC_SWSTART, for continuous conversion at twice the rate of one ADC
+ * (1.7 MHz with Wirish's 12 MHz ADC clock, at ADC_SMPR_1_5).  Any
+ * other trigger converts one closely spaced pair per event.
+ *
+ * ADC2 can't be used with adc_read() until the stream is stopped.
+ *
+ * @param stream Stream to start; see adc_stream_start().
+ * @param mode Dual mode.
+ * @param channels1 ADC1's sequence.
+ * @param channels2 ADC2's sequence.
+ * @param nchannels Length of each sequence, from 1 to 16.
+ * @param trigger ADC1 and ADC2 trigger event.
+ * @return 0 on success, or an adc_stream_start() error.
+ * @see adc_dual_stream_start_timer()
+ * @see adc_stream_stop()
+ */
+int adc_dual_stream_start(adc_stream *stream,
+                          adc_dual_mode mode,
+                          const uint8 *channels1,
+                          const uint8 *channels2,
+                          uint8 nchannels,
+                          adc_extsel_event trigger) {
+    int rc;
+
+    ASSERT(mode != ADC_DUAL_FAST_INTERLEAVED ||
+           (nchannels == 1 && channels1[0] == channels2[0]));
+
+    rc = adc_stream_claim(stream, ADC1, 2 * nchannels);
+    if (rc < 0) {
+        return rc;
+    }
+    stream->dual = 1;
+
+    adc_stream_setup(ADC1, channels1, nchannels);
+    adc_stream_setup(ADC2, channels2, nchannels);
+    ADC1->regs->CR1 = (ADC1->regs->CR1 & ~ADC_CR1_DUALMOD) | mode;
+    rc = adc_stream_queue(stream, DMA_SIZE_32BITS);
+    if (rc < 0) {
+        ADC1->regs->CR1 &= ~ADC_CR1_DUALMOD;
+        return rc;
+    }
+
+    /* ADC2 is started by ADC1; keep it from triggering itself. */
+    adc_set_extsel(ADC2, ADC_SWSTART);
+    adc_set_exttrig(ADC2, 1);
+    if (trigger == ADC_SWSTART) {
+        ADC2->regs->CR2 |= ADC_CR2_CONT;
+    }
+    adc_stream_go(ADC1, trigger);
+    return 0;
+}
+
+/*
+ * Timer sample clocks
+ */
+
+/* Timer events which can trigger a regular sequence.  channel is 0
+ * for TRGO, which is set to the update event. */
+static const struct adc_timer_trigger {
+    uint8 adc3;
+    timer_dev **timer;
+    uint8 channel;
+    adc_extsel_event event;
+} adc_timer_triggers[] = {
+    {0, &TIMER3, 0, ADC_ADC12_TIM3_TRGO},
+    {0, &TIMER1, 1, ADC_ADC12_TIM1_CC1},
+    {0, &TIMER2, 2, ADC_ADC12_TIM2_CC2},
+    {0, &TIMER4, 4, ADC_ADC12_TIM4_CC4},
+#ifdef STM32_HIGH_DENSITY
+    {1, &TIMER8, 0, ADC_ADC3_TIM8_TRGO},
+    {1, &TIMER3, 1, ADC_ADC3_TIM3_CC1},
+    {1, &TIMER2, 3, ADC_ADC3_TIM2_CC3},
+    {1, &TIMER1, 3, ADC_ADC3_TIM1_CC3},
+    {1, &TIMER5, 1, ADC_ADC3_TIM5_CC1},
+#endif
+};
+
+static const struct adc_timer_trigger* adc_find_trigger(const adc_dev *dev,
+                                                        timer_dev *timer) {
+    uint8 adc3 = 0;
+    uint32 i;
+
+#ifdef STM32_HIGH_DENSITY
+    adc3 = (dev == ADC3);
+#endif
+    for (i = 0; i < sizeof(adc_timer_triggers) / sizeof(*adc_timer_triggers);
+         i++) {
+        const struct adc_timer_trigger *t = &adc_timer_triggers[i];
+        if (t->adc3 == adc3 && *t->timer == timer) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+/* ADCCLK, from PCLK2 and the ADC prescaler */
+static uint32 adc_clock(void) {
+    uint32 adcpre = (RCC_BASE->CFGR & RCC_CFGR_ADCPRE) >> 14;
+    return STM32_PCLK2 / (2 * (adcpre + 1));
+}
+
+/* Conversion time in half ADCCLK cycles (sample time + 12.5), indexed
+ * by adc_smp_rate */
+static const uint16 adc_conv_half_cycles[] = {
+    28, 40, 52, 82, 108, 136, 168, 504,
+};
+
+static uint32 adc_sequence_half_cycles(const adc_dev *dev,
+                                       const uint8 *channels,
+                                       uint8 nchannels) {
+    uint32 total = 0;
+    uint8 i;
+
+    for (i = 0; i < nchannels; i++) {
+        uint8 ch = channels[i];
+        uint32 smp = (ch < 10 ?
+                      dev->regs->SMPR2 >> (3 * ch) :
+                      dev->regs->SMPR1 >> (3 * (ch - 10)));
+        total += adc_conv_half_cycles[smp & 0x7];
+    }
+    return total;
+}
+
+/* Whether the sequence fits in one period at the given rate */
+static int adc_rate_ok(const adc_dev *dev,
+                       const uint8 *channels,
+                       uint8 nchannels,
+                       uint32 rate) {
+    return rate > 0 && ((uint64)rate *
+                        adc_sequence_half_cycles(dev, channels, nchannels) <=
+                        2 * (uint64)adc_clock());
+}
+
+/* Set up a paused timer to produce the trigger event rate times a
+ * second.  Returns the rate actually achieved. */
+static uint32 adc_setup_clock(timer_dev *timer,
+                              uint8 channel,
+                              uint32 rate) {
+    uint32 actual;
+
+    timer_pause(timer);
+    timer_set_count(timer, 0);
+    actual = timer_set_rate(timer, rate);
+    if (channel) {
+        uint16 arr = timer_get_reload(timer);
+        timer_oc_set_mode(timer, channel, TIMER_OC_MODE_PWM_1, 0);
+        timer_set_compare(timer, channel, (arr + 1) / 2);
+        timer_cc_enable(timer, channel);
+    } else {
+        timer_set_master_mode(timer, TIMER_MMS_UPDATE);
+    }
+    return actual;
+}
+
+/**
+ * @brief Start a stream which converts its sequence at a fixed rate.
+ *
+ * The timer is set up as the sample clock, and each of its periods
+ * triggers one conversion of the whole sequence, so sampling is free
+ * of software jitter.  The timer is taken over entirely; its other
+ * channels can't be used while the stream runs.
+ *
+ * The rate is exact when it divides the timer clock (CLOCK_SPEED_HZ);
+ * otherwise the nearest achievable rate is used, and stored in the
+ * stream's rate field.  The sequence, at the sample times set with
+ * adc_set_sample_rate(), must fit in one period.  With the ADC clock
+ * Wirish sets up (12 MHz), this is at most 857 kHz for one channel at
+ * ADC_SMPR_1_5.
+ *
+ * Each ADC can be triggered by these timers:
+ *
+ * - ADC1: TIMER1 (CC1), TIMER2 (CC2), TIMER3 (TRGO), TIMER4 (CC4)
+ * - ADC3: TIMER1 (CC3), TIMER2 (CC3), TIMER3 (CC1), TIMER5 (CC1),
+ *   TIMER8 (TRGO)
+ *
+ * @param stream Stream to start; see adc_stream_start().
+ * @param dev ADC1, or ADC3 on high-density devices.
+ * @param channels Channels to convert, in order.
+ * @param nchannels Sequence length, from 1 to 16.
+ * @param timer Timer to use as the sample clock.
+ * @param rate Sequences per second.
+ * @return 0 on success, ADC_ERROR_NO_TRIGGER if the timer can't
+ *         trigger the ADC, ADC_ERROR_RATE if the rate is too high,
+ *         or an adc_stream_start() error.
+ * @see adc_stream_start()
+ * @see adc_stream_stop()
+ */
+int adc_stream_start_timer(adc_stream *stream,
+                           const adc_dev *dev,
+                           const uint8 *channels,
+                           uint8 nchannels,
+                           timer_dev *timer,
+                           uint32 rate) {
+    const struct adc_timer_trigger *trig = adc_find_trigger(dev, timer);
+    uint32 actual;
+    int rc;
+
+    if (!trig) {
+        return ADC_ERROR_NO_TRIGGER;
+    }
+    if (!adc_rate_ok(dev, channels, nchannels, rate)) {
+        return ADC_ERROR_RATE;
+    }
+
+    actual = adc_setup_clock(timer, trig->channel, rate);
+    rc = adc_stream_start(stream, dev, channels, nchannels, trig->event);
+    if (rc < 0) {
+        return rc;
+    }
+    stream->timer = timer;
+    stream->rate = actual;
+    timer_resume(timer);
+    return 0;
+}
+
+/**
+ * @brief Start a simultaneous dual stream at a fixed rate.
+ *
+ * As adc_stream_start_timer(), but ADC1 and ADC2 sample their
+ * sequences together, in ADC_DUAL_SIMULTANEOUS mode.  The timer must
+ * be able to trigger ADC1.
+ *
+ * @param stream Stream to start; see adc_stream_start().
+ * @param channels1 ADC1's sequence.
+ * @param channels2 ADC2's sequence.
+ * @param nchannels Length of each sequence, from 1 to 16.
+ * @param timer Timer to use as the sample clock.
+ * @param rate Sequences per second.
+ * @return As adc_stream_start_timer().
+ * @see adc_dual_stream_start()
+ */
+int adc_dual_stream_start_timer(adc_stream *stream,
+                                const uint8 *channels1,
+                                const uint8 *channels2,
+                                uint8 nchannels,
+                                timer_dev *timer,
+                                uint32 rate) {
+    const struct adc_timer_trigger *trig = adc_find_trigger(ADC1, timer);
+    uint32 actual;
+    int rc;
+
+    if (!trig) {
+        return ADC_ERROR_NO_TRIGGER;
+    }
+    if (!adc_rate_ok(ADC1, channels1, nchannels, rate) ||
+        !adc_rate_ok(ADC2, channels2, nchannels, rate)) {
+        return ADC_ERROR_RATE;
+    }
+
+    actual = adc_setup_clock(timer, trig->channel, rate);
+    rc = adc_dual_stream_start(stream, ADC_DUAL_SIMULTANEOUS,
+                               channels1, channels2, nchannels,
+                               trig->event);
+    if (rc < 0) {
+        return rc;
+    }
+    stream->timer = timer;
+    stream->rate = actual;
+    timer_resume(timer);
+    return 0;
+}
+
+/**
+ * @brief Stop a stream and release its DMA channel.
+ *
+ * The ADC is left set up for adc_read(): software triggered, with
+ * scan mode off.  A timer sample clock is paused, and a dual stream's
+ * ADCs are returned to independent mode.
+ *
+ * @param stream Stream started with adc_stream_start()
+ */
+void adc_stream_stop(adc_stream *stream) {
+    const adc_dev *dev = stream->dev;
+
+    if (stream->timer) {
+        timer_pause(stream->timer);
+    }
+    dev->regs->CR2 &= ~(ADC_CR2_CONT | ADC_CR2_DMA);
+    adc_set_extsel(dev, ADC_SWSTART);
+    *bb_perip(&dev->regs->CR1, ADC_CR1_SCAN_BIT) = 0;
+    if (stream->dual) {
+        dev->regs->CR1 &= ~ADC_CR1_DUALMOD;
+        ADC2->regs->CR2 &= ~ADC_CR2_CONT;
+        *bb_perip(&ADC2->regs->CR1, ADC_CR1_SCAN_BIT) = 0;
+    }
+    dma_release_channel(stream->dma_d, stream->dma_ch);
+}
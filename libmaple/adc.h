@@ -36,6 +36,8 @@
 #include "libmaple.h"
 #include "bitband.h"
 #include "rcc.h"
+#include "dma.h"
+#include "timer.h"
 
 #ifdef __cplusplus
 extern "C"{
@@ -131,6 +133,17 @@ extern const adc_dev *ADC3;
 #define ADC_CR1_DISCEN                  BIT(ADC_CR1_DISCEN_BIT)
 #define ADC_CR1_JDISCEN                 BIT(ADC_CR1_JDISCEN_BIT)
 #define ADC_CR1_DISCNUM                 (0xE000)
+#define ADC_CR1_DUALMOD                 (0xF << 16)
+#define ADC_CR1_DUALMOD_INDEPENDENT     (0x0 << 16)
+#define ADC_CR1_DUALMOD_REG_INJ_SIMUL   (0x1 << 16)
+#define ADC_CR1_DUALMOD_REG_ALT_TRIG    (0x2 << 16)
+#define ADC_CR1_DUALMOD_INJ_FAST_INTL   (0x3 << 16)
+#define ADC_CR1_DUALMOD_INJ_SLOW_INTL   (0x4 << 16)
+#define ADC_CR1_DUALMOD_INJ_SIMUL       (0x5 << 16)
+#define ADC_CR1_DUALMOD_REG_SIMUL       (0x6 << 16)
+#define ADC_CR1_DUALMOD_FAST_INTL       (0x7 << 16)
+#define ADC_CR1_DUALMOD_SLOW_INTL       (0x8 << 16)
+#define ADC_CR1_DUALMOD_ALT_TRIG        (0x9 << 16)
 #define ADC_CR1_JAWDEN                  BIT(ADC_CR1_JAWDEN_BIT)
 #define ADC_CR1_AWDEN                   BIT(ADC_CR1_AWDEN_BIT)
 
@@ -210,7 +223,7 @@ extern const adc_dev *ADC3;
 
 #define ADC_SQR2_SQ12                   (0x1F << 25)
 #define ADC_SQR2_SQ11                   (0x1F << 20)
-#define ADC_SQR2_SQ10                   (0x1F << 16)
+#define ADC_SQR2_SQ10                   (0x1F << 15)
 #define ADC_SQR2_SQ9                    (0x1F << 10)
 #define ADC_SQR2_SQ8                    (0x1F << 5)
 #define ADC_SQR2_SQ7                    0x1F
@@ -219,7 +232,7 @@ extern const adc_dev *ADC3;
 
 #define ADC_SQR3_SQ6                    (0x1F << 25)
 #define ADC_SQR3_SQ5                    (0x1F << 20)
-#define ADC_SQR3_SQ4                    (0x1F << 16)
+#define ADC_SQR3_SQ4                    (0x1F << 15)
 #define ADC_SQR3_SQ3                    (0x1F << 10)
 #define ADC_SQR3_SQ2                    (0x1F << 5)
 #define ADC_SQR3_SQ1                    0x1F
@@ -307,6 +320,124 @@ typedef enum {
 void adc_set_sample_rate(const adc_dev *dev, adc_smp_rate smp_rate);
 void adc_calibrate(const adc_dev *dev);
 uint16 adc_read(const adc_dev *dev, uint8 channel);
+void adc_set_reg_sequence(const adc_dev *dev,
+                          const uint8 *channels,
+                          uint8 length);
+
+/*
+ * Streaming conversions
+ */
+
+/**
+ * @brief Continuous ADC conversion stream.
+ *
+ * A stream converts a regular sequence of channels over and over, and
+ * DMAs the results into a ping-pong buffer.  Each time one half of the
+ * buffer fills, the callback is given that half while DMA fills the
+ * other.  The caller fills in the fields up to arg, then calls
+ * adc_stream_start().
+ *
+ * @see adc_stream_start()
+ */
+typedef struct adc_stream {
+    uint16 *buffer;             /**< Buffer of 2 * half_len samples */
+    uint16 half_len;            /**< Samples per half buffer; a multiple
+                                     of the sequence length */
+    /**
+     * Called from the DMA interrupt with each half buffer as it
+     * fills, or NULL.  Samples are in sequence order, one sequence
+     * after another.  The callback must be done with them before DMA
+     * comes back around to the same half.
+     */
+    void (*callback)(struct adc_stream *stream,
+                     uint16 *samples,
+                     uint16 count);
+    void *arg;                  /**< For the callback's use */
+
+    const adc_dev *dev;         /**< Converting ADC; set by
+                                     adc_stream_start() */
+    uint8 nchannels;            /**< Samples per sequence: the sequence
+                                     length, doubled for dual streams */
+    uint8 dual;                 /**< Nonzero for a dual stream */
+    timer_dev *timer;           /**< Sample clock, or NULL */
+    uint32 rate;                /**< Sequences per second, if timer
+                                     is set */
+    dma_dev *dma_d;             /**< For internal use */
+    dma_channel dma_ch;         /**< For internal use */
+    volatile uint32 blocks;     /**< Half buffers delivered so far */
+    /**
+     * Index of the first sequence in the half buffer being given to
+     * the callback, counting from 0 at the start of the stream.  With
+     * a timer sample clock, sequence n was triggered n / rate seconds
+     * after the first.  Wraps at 2^32.
+     */
+    volatile uint32 sequence;
+    volatile uint8 error;       /**< Nonzero if DMA failed; the stream
+                                     has stopped */
+} adc_stream;
+
+/*
+ * adc_stream_start() errors.  These are distinct from the DMA_ERROR_*
+ * values, which are passed through.
+ */
+
+/** No DMA request line reaches the ADC (ADC2 can only stream in
+ *  dual mode). */
+#define ADC_ERROR_NO_DMA        (-8)
+
+/** The timer can't trigger the ADC. */
+#define ADC_ERROR_NO_TRIGGER    (-9)
+
+/** The sequence can't be converted at the requested rate. */
+#define ADC_ERROR_RATE          (-10)
+
+int adc_stream_start(adc_stream *stream,
+                     const adc_dev *dev,
+                     const uint8 *channels,
+                     uint8 nchannels,
+                     adc_extsel_event trigger);
+int adc_stream_start_timer(adc_stream *stream,
+                           const adc_dev *dev,
+                           const uint8 *channels,
+                           uint8 nchannels,
+                           timer_dev *timer,
+                           uint32 rate);
+void adc_stream_stop(adc_stream *stream);
+
+/**
+ * @brief Dual ADC modes usable with adc_dual_stream_start().
+ *
+ * In both, ADC1 and ADC2 convert together, and each DMA transfer
+ * moves a 32-bit word holding one result from each: ADC1's in the low
+ * half-word, ADC2's in the high half-word.  In the stream's buffer,
+ * the ADC1 and ADC2 samples therefore alternate, ADC1 first.
+ *
+ * @see adc_dual_stream_start()
+ */
+typedef enum adc_dual_mode {
+    /** Each ADC converts its own sequence, in step with the other: the
+     *  nth channels of the two sequences are sampled at the same
+     *  instant. */
+    ADC_DUAL_SIMULTANEOUS = ADC_CR1_DUALMOD_REG_SIMUL,
+    /** Both ADCs convert the same single channel, ADC2 starting half
+     *  a conversion ahead of ADC1, for twice the sample rate of one
+     *  ADC.  In each pair of samples, the ADC2 one (second) was taken
+     *  7 ADC clock cycles before the ADC1 one (first). */
+    ADC_DUAL_FAST_INTERLEAVED = ADC_CR1_DUALMOD_FAST_INTL
+} adc_dual_mode;
+
+int adc_dual_stream_start(adc_stream *stream,
+                          adc_dual_mode mode,
+                          const uint8 *channels1,
+                          const uint8 *channels2,
+                          uint8 nchannels,
+                          adc_extsel_event trigger);
+int adc_dual_stream_start_timer(adc_stream *stream,
+                                const uint8 *channels1,
+                                const uint8 *channels2,
+                                uint8 nchannels,
+                                timer_dev *timer,
+                                uint32 rate);
 
 /**
  * @brief Set the regular channel sequence length.
@@ -0,0 +1,247 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Copyright (c) 2011 LeafLabs, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file adc_filter.c
+ * @brief Decimation and smoothing filters for ADC streams.
+ */
+
+#include "libmaple.h"
+#include "adc_filter.h"
+
+/* ADC results are 12 bits. */
+#define ADC_BITS 12
+
+/*
+ * CIC decimator
+ */
+
+/**
+ * @brief Initialize a CIC decimator.
+ *
+ * The DC gain is ratio ** order, which must fit in 32 bits along with
+ * the 12-bit input and a rounding bit: at most 2^19 for order 1, 2^9
+ * for order 2, and 80 for order 3.  When ratio is a power of two, a
+ * full scale input gives a full scale out_bits output; otherwise the
+ * output scale is rounded up to the next power of two.
+ *
+ * @param cic Decimator to initialize.
+ * @param nchannels Number of interleaved channels in the input, from
+ *                  1 to ADC_FILTER_MAX_CHANNELS.
+ * @param order Number of stages, from 1 to ADC_CIC_MAX_ORDER.
+ * @param ratio Decimation ratio: one output per ratio input samples
+ *              on each channel.
+ * @param out_bits Output resolution, from 12 to 16 bits.
+ * @return 0 on success, ADC_FILTER_ERROR_GAIN if the gain is too big.
+ */
+int adc_cic_init(adc_cic *cic,
+                 uint8 nchannels,
+                 uint8 order,
+                 uint16 ratio,
+                 uint8 out_bits) {
+    uint64 gain = 1;
+    uint8 gain_bits = 0;
+    uint8 i, j;
+
+    ASSERT(nchannels >= 1 && nchannels <= ADC_FILTER_MAX_CHANNELS);
+    ASSERT(order >= 1 && order <= ADC_CIC_MAX_ORDER);
+    ASSERT(ratio >= 1);
+    ASSERT(out_bits >= ADC_BITS && out_bits <= 16);
+
+    for (i = 0; i < order; i++) {
+        gain *= ratio;
+    }
+    while ((1ULL << gain_bits) < gain) {
+        gain_bits++;
+    }
+    if (ADC_BITS + gain_bits > 31) {
+        return ADC_FILTER_ERROR_GAIN;
+    }
+
+    for (i = 0; i < nchannels; i++) {
+        for (j = 0; j < order; j++) {
+            cic->integ[i][j] = 0;
+            cic->comb[i][j] = 0;
+        }
+    }
+    cic->ratio = ratio;
+    cic->count = 0;
+    cic->order = order;
+    cic->nchannels = nchannels;
+    cic->channel = 0;
+    cic->shift = gain_bits - (out_bits - ADC_BITS);
+    return 0;
+}
+
+/**
+ * @brief Initialize a decimator for oversampling.
+ *
+ * Sets up a boxcar average of 4 ** (out_bits - 12) samples, which
+ * gains one bit of resolution per factor of 4, provided the input has
+ * enough noise to dither it.
+ *
+ * @param cic Decimator to initialize.
+ * @param nchannels Number of interleaved channels in the input.
+ * @param out_bits Output resolution, from 12 to 16 bits.
+ * @return 0.
+ * @see adc_cic_init()
+ */
+int adc_oversample_init(adc_cic *cic, uint8 nchannels, uint8 out_bits) {
+    return adc_cic_init(cic, nchannels, 1,
+                        1 << (2 * (out_bits - ADC_BITS)), out_bits);
+}
+
+/**
+ * @brief Run samples through a CIC decimator.
+ *
+ * Blocks needn't be whole sequences; the decimator keeps track of
+ * which channel comes next.  Outputs are interleaved in the same
+ * channel order as the input.
+ *
+ * @param cic Decimator.
+ * @param in Input samples.
+ * @param count Number of input samples.
+ * @param out Where to put the output, at most count / ratio + nchannels
+ *            samples.  May be the same as in.
+ * @return Number of samples written to out.
+ */
+uint16 adc_cic_process(adc_cic *cic,
+                       const uint16 *in,
+                       uint16 count,
+                       uint16 *out) {
+    uint16 *start = out;
+    uint8 order = cic->order;
+    uint8 channel = cic->channel;
+    int8 shift = cic->shift;
+    uint32 round = shift > 0 ? 1U << (shift - 1) : 0;
+
+    while (count--) {
+        uint32 *integ = cic->integ[channel];
+        uint32 acc = *in++;
+        uint8 i;
+
+        /* Integrators run at the input rate; uint32 wraparound cancels
+         * out in the combs. */
+        for (i = 0; i < order; i++) {
+            acc += integ[i];
+            integ[i] = acc;
+        }
+
+        if (cic->count == cic->ratio - 1) {
+            uint32 *comb = cic->comb[channel];
+            for (i = 0; i < order; i++) {
+                uint32 prev = comb[i];
+                comb[i] = acc;
+                acc -= prev;
+            }
+            *out++ = (uint16)(shift >= 0 ?
+                              (acc + round) >> shift :
+                              acc << -shift);
+        }
+
+        if (++channel == cic->nchannels) {
+            channel = 0;
+            if (++cic->count == cic->ratio) {
+                cic->count = 0;
+            }
+        }
+    }
+
+    cic->channel = channel;
+    return out - start;
+}
+
+/*
+ * Moving average
+ */
+
+/**
+ * @brief Initialize a moving average filter.
+ * @param avg Filter to initialize.
+ * @param history Buffer of window * nchannels samples, which must
+ *                stay allocated while the filter is used.
+ * @param nchannels Number of interleaved channels in the input, from
+ *                  1 to ADC_FILTER_MAX_CHANNELS.
+ * @param window Number of samples to average on each channel.
+ */
+void adc_moving_avg_init(adc_moving_avg *avg,
+                         uint16 *history,
+                         uint8 nchannels,
+                         uint16 window) {
+    uint32 i;
+
+    ASSERT(nchannels >= 1 && nchannels <= ADC_FILTER_MAX_CHANNELS);
+    ASSERT(window >= 1);
+
+    for (i = 0; i < (uint32)window * nchannels; i++) {
+        history[i] = 0;
+    }
+    for (i = 0; i < nchannels; i++) {
+        avg->sum[i] = 0;
+    }
+    avg->history = history;
+    avg->window = window;
+    avg->pos = 0;
+    avg->nchannels = nchannels;
+    avg->channel = 0;
+}
+
+/**
+ * @brief Run samples through a moving average filter.
+ * @param avg Filter.
+ * @param in Input samples.
+ * @param count Number of samples.
+ * @param out Where to put count output samples.  May be the same as in.
+ */
+void adc_moving_avg_process(adc_moving_avg *avg,
+                            const uint16 *in,
+                            uint16 count,
+                            uint16 *out) {
+    uint16 *slot = avg->history + avg->pos * avg->nchannels + avg->channel;
+    uint16 *end = avg->history + avg->window * avg->nchannels;
+    uint32 window = avg->window;
+    uint8 channel = avg->channel;
+
+    while (count--) {
+        uint16 x = *in++;
+        uint32 sum = avg->sum[channel] - *slot + x;
+
+        avg->sum[channel] = sum;
+        *slot = x;
+        *out++ = (uint16)((sum + window / 2) / window);
+
+        slot++;
+        if (++channel == avg->nchannels) {
+            channel = 0;
+            if (slot == end) {
+                slot = avg->history;
+            }
+        }
+    }
+
+    avg->channel = channel;
+    avg->pos = (slot - avg->history) / avg->nchannels;
+}
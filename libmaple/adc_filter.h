@@ -0,0 +1,134 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Copyright (c) 2011 LeafLabs, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file adc_filter.h
+ * @brief Decimation and smoothing filters for ADC streams.
+ *
+ * These work on blocks of samples as delivered by an adc_stream
+ * callback, with the channels of each sequence interleaved, and keep
+ * separate state for each channel.  All arithmetic is integer.
+ */
+
+#ifndef _ADC_FILTER_H_
+#define _ADC_FILTER_H_
+
+#include "libmaple_types.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#ifndef ADC_FILTER_MAX_CHANNELS
+/**
+ * Most interleaved channels a filter can handle.  Each channel costs
+ * 24 bytes of decimator state and 4 of moving average state.
+ * Override by defining it when building libmaple.
+ */
+#define ADC_FILTER_MAX_CHANNELS 16
+#endif
+
+/** Highest CIC decimator order supported. */
+#define ADC_CIC_MAX_ORDER 3
+
+/*
+ * CIC decimator
+ */
+
+/**
+ * @brief CIC (cascaded integrator-comb) decimator.
+ *
+ * Each output is the sum of the filter's impulse response, a boxcar
+ * of length ratio convolved with itself order times, over the input,
+ * scaled to out_bits bits.  Order 1 is a plain boxcar average of each
+ * ratio samples, which is also how to oversample: averaging 4^k
+ * samples gives k more bits.  Higher orders reject aliases better,
+ * at the cost of a longer response.
+ *
+ * Initialize with adc_cic_init() or adc_oversample_init(), then feed
+ * blocks to adc_cic_process().
+ */
+typedef struct adc_cic {
+    uint32 integ[ADC_FILTER_MAX_CHANNELS][ADC_CIC_MAX_ORDER];
+    uint32 comb[ADC_FILTER_MAX_CHANNELS][ADC_CIC_MAX_ORDER];
+    uint16 ratio;               /**< Decimation ratio */
+    uint16 count;               /**< Sequences since the last output */
+    uint8 order;                /**< Number of integrator/comb stages */
+    uint8 nchannels;            /**< Interleaved channels */
+    uint8 channel;              /**< Channel of the next input sample */
+    int8 shift;                 /**< Right shift to out_bits */
+} adc_cic;
+
+/** adc_cic_init() error: ratio ** order too big for 32-bit state. */
+#define ADC_FILTER_ERROR_GAIN   (-1)
+
+int adc_cic_init(adc_cic *cic,
+                 uint8 nchannels,
+                 uint8 order,
+                 uint16 ratio,
+                 uint8 out_bits);
+int adc_oversample_init(adc_cic *cic, uint8 nchannels, uint8 out_bits);
+uint16 adc_cic_process(adc_cic *cic,
+                       const uint16 *in,
+                       uint16 count,
+                       uint16 *out);
+
+/*
+ * Moving average
+ */
+
+/**
+ * @brief Moving average filter.
+ *
+ * Each output is the rounded mean of the last window inputs on its
+ * channel.  The output rate equals the input rate.  History starts
+ * out zeroed, so the first window - 1 outputs on each channel ramp up
+ * from zero.
+ */
+typedef struct adc_moving_avg {
+    uint16 *history;            /**< window * nchannels samples; caller
+                                     allocated */
+    uint32 sum[ADC_FILTER_MAX_CHANNELS];
+    uint16 window;              /**< Samples averaged */
+    uint16 pos;                 /**< Index of the oldest sequence */
+    uint8 nchannels;            /**< Interleaved channels */
+    uint8 channel;              /**< Channel of the next input sample */
+} adc_moving_avg;
+
+void adc_moving_avg_init(adc_moving_avg *avg,
+                         uint16 *history,
+                         uint8 nchannels,
+                         uint16 window);
+void adc_moving_avg_process(adc_moving_avg *avg,
+                            const uint16 *in,
+                            uint16 count,
+                            uint16 *out);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -32,6 +32,8 @@
 #include "libmaple.h"
 #include "gpio.h"
 #include "dac.h"
+#include "dma.h"
+#include "timer.h"
 
 #ifdef STM32_HIGH_DENSITY
 
@@ -123,4 +125,198 @@ void dac_disable_channel(const dac_dev *dev, uint8 channel) {
     }
 }
 
+/*
+ * Waveform generation
+ */
+
+static uint8 dac_find_trigger(timer_dev *timer) {
+    if (timer == TIMER6) {
+        return DAC_CR_TSEL_TIM6_TRGO;
+    } else if (timer == TIMER7) {
+        return DAC_CR_TSEL_TIM7_TRGO;
+    } else if (timer == TIMER8) {
+        return DAC_CR_TSEL_TIM8_TRGO;
+    } else if (timer == TIMER5) {
+        return DAC_CR_TSEL_TIM5_TRGO;
+    } else if (timer == TIMER2) {
+        return DAC_CR_TSEL_TIM2_TRGO;
+    } else if (timer == TIMER4) {
+        return DAC_CR_TSEL_TIM4_TRGO;
+    }
+    return DAC_CR_TSEL_SWTRIG;
+}
+
+static void dac_wave_dma(void *arg, dma_irq_cause cause) {
+    dac_wave *wave = (dac_wave*)arg;
+    uint16 half = wave->length / 2;
+    /* In dual mode, each sample is a pair of uint16s. */
+    uint16 *block = (uint16*)wave->samples;
+
+    if (cause == DMA_TRANSFER_ERROR) {
+        wave->error = 1;
+        return;
+    }
+
+    wave->blocks++;
+    switch (wave->mode) {
+    case DAC_WAVE_ONESHOT:
+        /* The last sample is in the holding register; the timer must
+         * keep running to trigger it out. */
+        wave->done = 1;
+        if (wave->callback) {
+            wave->callback(wave, NULL, 0);
+        }
+        break;
+    case DAC_WAVE_LOOP:
+        break;
+    case DAC_WAVE_STREAM:
+        if (cause == DMA_TRANSFER_COMPLETE) {
+            block += (wave->channels == (DAC_CH1 | DAC_CH2) ?
+                      2 * half : half);
+        }
+        if (wave->callback) {
+            wave->callback(wave, block, half);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Start playing a waveform.
+ *
+ * The timer is set up as the sample clock, outputting its update
+ * event on TRGO, and is taken over entirely.  Each channel played is
+ * enabled as with dac_enable_channel().
+ *
+ * Each trigger moves the holding register to the output, then DMA
+ * loads the next sample into the holding register, so the output
+ * lags by one sample period: the first trigger outputs whatever was
+ * last written, and a one-shot's callback comes one period before its
+ * last sample appears.
+ *
+ * @param wave Waveform to play; its samples, length, mode, and
+ *             callback fields must be filled in.
+ * @param dev DAC device.
+ * @param channels DAC_CH1, DAC_CH2, or DAC_CH1 | DAC_CH2 for dual
+ *                 mode.  Channels not played keep working as before.
+ * @param timer Sample clock: TIMER6 or TIMER7 (basic timers, which
+ *              have no other use), or TIMER2, TIMER4, TIMER5, TIMER8.
+ * @param rate Samples per second.
+ * @return 0 on success, DAC_ERROR_NO_TRIGGER if the timer can't
+ *         trigger the DAC, or a negative DMA error if the DMA channel
+ *         couldn't be claimed.
+ * @see dac_wave_stop()
+ */
+int dac_wave_start(dac_wave *wave,
+                   const dac_dev *dev,
+                   uint8 channels,
+                   timer_dev *timer,
+                   uint32 rate) {
+    uint8 tsel = dac_find_trigger(timer);
+    uint8 dual = channels == (DAC_CH1 | DAC_CH2);
+    uint32 cr_bits = 0, cr_mask = 0;
+    dma_xfer xfer;
+    int rc;
+
+    ASSERT(channels & (DAC_CH1 | DAC_CH2));
+    ASSERT(wave->length > 0);
+    ASSERT(wave->mode != DAC_WAVE_STREAM || wave->length % 2 == 0);
+
+    if (tsel == DAC_CR_TSEL_SWTRIG) {
+        return DAC_ERROR_NO_TRIGGER;
+    }
+    rc = dma_request_channel(channels & DAC_CH1 ?
+                             DMA_REQ_DAC_CH1 : DMA_REQ_DAC_CH2,
+                             DMA_PRIORITY_HIGH, "DAC wave",
+                             &wave->dma_d, &wave->dma_ch);
+    if (rc < 0) {
+        return rc;
+    }
+    wave->dev = dev;
+    wave->channels = channels;
+    wave->timer = timer;
+    wave->blocks = 0;
+    wave->done = 0;
+    wave->error = 0;
+
+    timer_pause(timer);
+    timer_set_count(timer, 0);
+    wave->rate = timer_set_rate(timer, rate);
+    timer_set_master_mode(timer, TIMER_MMS_UPDATE);
+
+    /* Only channel 1 requests DMA in dual mode. */
+    if (channels & DAC_CH1) {
+        dac_enable_channel(dev, 1);
+        cr_mask |= DAC_CR_TSEL1 | DAC_CR_WAVE1 | DAC_CR_DMAEN1;
+        cr_bits |= DAC_CR_TEN1 | (tsel << 3) | DAC_CR_DMAEN1;
+    }
+    if (channels & DAC_CH2) {
+        dac_enable_channel(dev, 2);
+        cr_mask |= DAC_CR_TSEL2 | DAC_CR_WAVE2 | DAC_CR_DMAEN2;
+        cr_bits |= DAC_CR_TEN2 | (tsel << 19) | (dual ? 0 : DAC_CR_DMAEN2);
+    }
+
+    if (dual) {
+        xfer.peripheral_address = &dev->regs->DHR12RD;
+        xfer.memory_size = DMA_SIZE_32BITS;
+    } else {
+        xfer.peripheral_address = (channels & DAC_CH1 ?
+                                   &dev->regs->DHR12R1 :
+                                   &dev->regs->DHR12R2);
+        xfer.memory_size = DMA_SIZE_16BITS;
+    }
+    xfer.peripheral_size = DMA_SIZE_32BITS;
+    xfer.memory_address = (void*)wave->samples;
+    xfer.num_transfers = wave->length;
+    xfer.mode = DMA_MINC_MODE | DMA_FROM_MEM;
+    switch (wave->mode) {
+    case DAC_WAVE_ONESHOT:
+        break;
+    case DAC_WAVE_LOOP:
+        xfer.mode |= DMA_CIRC_MODE;
+        break;
+    case DAC_WAVE_STREAM:
+        xfer.mode |= DMA_CIRC_MODE | DMA_HALF_TRNS;
+        break;
+    }
+    xfer.priority = DMA_PRIORITY_HIGH;
+    xfer.callback = dac_wave_dma;
+    xfer.arg = wave;
+
+    /* The trigger enable and selection take effect with the channel
+     * enabled, so set them together with the DMA request enable. */
+    dev->regs->CR = (dev->regs->CR & ~cr_mask) | cr_bits;
+    rc = dma_queue_xfer(wave->dma_d, wave->dma_ch, &xfer);
+    if (rc < 0) {
+        dev->regs->CR &= ~(cr_mask | DAC_CR_TEN1 | DAC_CR_TEN2);
+        dma_release_channel(wave->dma_d, wave->dma_ch);
+        return rc;
+    }
+
+    timer_resume(timer);
+    return 0;
+}
+
+/**
+ * @brief Stop playing a waveform and release its DMA channel.
+ *
+ * The timer is paused.  The channels stay enabled, holding the last
+ * sample played, and can be written with dac_write_channel() again.
+ *
+ * @param wave Waveform started with dac_wave_start().
+ */
+void dac_wave_stop(dac_wave *wave) {
+    uint32 cr_mask = 0;
+
+    timer_pause(wave->timer);
+    if (wave->channels & DAC_CH1) {
+        cr_mask |= DAC_CR_TEN1 | DAC_CR_TSEL1 | DAC_CR_DMAEN1;
+    }
+    if (wave->channels & DAC_CH2) {
+        cr_mask |= DAC_CR_TEN2 | DAC_CR_TSEL2 | DAC_CR_DMAEN2;
+    }
+    wave->dev->regs->CR &= ~cr_mask;
+    dma_release_channel(wave->dma_d, wave->dma_ch);
+}
+
 #endif  /* STM32_HIGH_DENSITY */
@@ -35,6 +35,8 @@
 #define _DAC_H_
 
 #include "rcc.h"
+#include "dma.h"
+#include "timer.h"
 
 #ifdef __cplusplus
 extern "C"{
@@ -106,6 +108,15 @@ extern const dac_dev *DAC;
 #define DAC_CR_MAMP2            (0xF << 24) /* Mask/amplitude selector */
 #define DAC_CR_DMAEN2               BIT(28) /* DMA enable */
 
+#define DAC_CR_TSEL_TIM6_TRGO        0x0
+#define DAC_CR_TSEL_TIM8_TRGO        0x1
+#define DAC_CR_TSEL_TIM7_TRGO        0x2
+#define DAC_CR_TSEL_TIM5_TRGO        0x3
+#define DAC_CR_TSEL_TIM2_TRGO        0x4
+#define DAC_CR_TSEL_TIM4_TRGO        0x5
+#define DAC_CR_TSEL_EXTI9            0x6
+#define DAC_CR_TSEL_SWTRIG           0x7
+
 /* Software trigger register */
 #define DAC_SWTRIGR_SWTRIG1          BIT(0) /* Channel 1 software trigger */
 #define DAC_SWTRIGR_SWTRIG2          BIT(1) /* Channel 2 software trigger */
@@ -161,6 +172,78 @@ void dac_write_channel(const dac_dev *dev, uint8 channel, uint16 val);
 void dac_enable_channel(const dac_dev *dev, uint8 channel);
 void dac_disable_channel(const dac_dev *dev, uint8 channel);
 
+/*
+ * Waveform generation
+ */
+
+/**
+ * @brief How a dac_wave plays its samples.
+ * @see dac_wave
+ */
+typedef enum dac_wave_mode {
+    /** Play the samples once, then call the callback (with no
+     *  samples).  The output holds the last sample. */
+    DAC_WAVE_ONESHOT,
+    /** Play the samples over and over; no callbacks. */
+    DAC_WAVE_LOOP,
+    /** Play the samples as a ping-pong buffer.  Each time one half
+     *  has been played, the callback gets it to refill while the
+     *  other half plays. */
+    DAC_WAVE_STREAM
+} dac_wave_mode;
+
+/**
+ * @brief DAC waveform.
+ *
+ * A waveform is played by DMA, one sample per trigger from a timer,
+ * with no CPU time per sample.  The caller fills in the fields up to
+ * arg, then calls dac_wave_start().
+ *
+ * When both channels play (dual mode), samples holds pairs: the
+ * channel 1 sample, then the channel 2 sample.  Each pair goes out in
+ * one 32-bit DMA transfer, and both channels change together.
+ *
+ * @see dac_wave_start()
+ */
+typedef struct dac_wave {
+    /** 12-bit, right-aligned samples.  Must be writable in
+     *  DAC_WAVE_STREAM mode. */
+    const uint16 *samples;
+    uint16 length;              /**< Number of samples (pairs, in dual
+                                     mode); even in DAC_WAVE_STREAM
+                                     mode */
+    dac_wave_mode mode;         /**< How to play the samples */
+    /**
+     * Called from the DMA interrupt, or NULL.  In DAC_WAVE_STREAM mode,
+     * block is the half just played and count its length in samples
+     * (pairs, in dual mode).  In DAC_WAVE_ONESHOT mode, it's called
+     * once at the end, with block NULL.
+     */
+    void (*callback)(struct dac_wave *wave, uint16 *block, uint16 count);
+    void *arg;                  /**< For the callback's use */
+
+    const dac_dev *dev;         /**< For internal use */
+    uint8 channels;             /**< DAC_CH1, DAC_CH2, or both */
+    timer_dev *timer;           /**< Sample clock */
+    uint32 rate;                /**< Samples per second achieved */
+    dma_dev *dma_d;             /**< For internal use */
+    dma_channel dma_ch;         /**< For internal use */
+    volatile uint32 blocks;     /**< Half buffers (DAC_WAVE_STREAM) or
+                                     whole plays (otherwise) done */
+    volatile uint8 done;        /**< Set when a one-shot ends */
+    volatile uint8 error;       /**< Nonzero if DMA failed */
+} dac_wave;
+
+/** dac_wave_start() error: the timer can't trigger the DAC. */
+#define DAC_ERROR_NO_TRIGGER    (-8)
+
+int dac_wave_start(dac_wave *wave,
+                   const dac_dev *dev,
+                   uint8 channels,
+                   timer_dev *timer,
+                   uint32 rate);
+void dac_wave_stop(dac_wave *wave);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -67,6 +67,28 @@ static dma_dev dma2 = {
 dma_dev *DMA2 = &dma2;
 #endif
 
+/* Channel ownership, for dma_request_channel() */
+
+typedef struct dma_owner {
+    const char *name;           /* NULL if the channel is free */
+    dma_priority priority;
+} dma_owner;
+
+static dma_owner dma1_owners[7];
+#ifdef STM32_HIGH_DENSITY
+static dma_owner dma2_owners[5];
+#endif
+
+static inline dma_owner* channel_owner(dma_dev *dev,
+                                                 dma_channel channel) {
+#ifdef STM32_HIGH_DENSITY
+    if (dev == DMA2) {
+        return &dma2_owners[channel - 1];
+    }
+#endif
+    return &dma1_owners[channel - 1];
+}
+
 /*
  * Convenience routines
  */
@@ -83,7 +105,9 @@ void dma_init(dma_dev *dev) {
  * @brief Set up a DMA transfer.
  *
  * The channel will be disabled before being reconfigured.  The
- * transfer will have low priority by default.  You may choose another
+ * transfer will have low priority by default, or the priority given
+ * to dma_request_channel() if the channel was claimed with it.  You
+ * may choose another
  * priority before the transfer begins using dma_set_priority(), as
  * well as performing any other configuration you desire.  When the
  * channel is configured to your liking, enable it using dma_enable().
@@ -113,8 +137,12 @@ void dma_setup_transfer(dma_dev       *dev,
                         uint32         mode) {
     dma_channel_reg_map *channel_regs = dma_channel_regs(dev, channel);
 
+    dma_owner *owner = channel_owner(dev, channel);
+    uint32 priority = owner->name ? owner->priority : DMA_PRIORITY_LOW;
+
     dma_disable(dev, channel);  /* can't write to CMAR/CPAR otherwise */
-    channel_regs->CCR = (memory_size << 10) | (peripheral_size << 8) | mode;
+    channel_regs->CCR = ((memory_size << 10) | (peripheral_size << 8) |
+                         priority | mode);
     channel_regs->CMAR = (uint32)memory_address;
     channel_regs->CPAR = (uint32)peripheral_address;
 }
@@ -319,13 +347,559 @@ void dma_set_per_addr(dma_dev *dev, dma_channel channel, __io void *addr) {
     chan_regs->CPAR = (uint32)addr;
 }
 
+/*
+ * Channel allocation
+ */
+
+/* Call with interrupts disabled. */
+static int claim_channel(dma_dev *dev, dma_channel channel,
+                         dma_priority priority, const char *owner) {
+    dma_owner *o = channel_owner(dev, channel);
+
+    /* An enabled channel without an owner belongs to code that
+     * doesn't use the allocator. */
+    if (o->name || dma_is_channel_enabled(dev, channel)) {
+        return DMA_ERROR_CONFLICT;
+    }
+    o->name = owner;
+    o->priority = priority;
+    return 0;
+}
+
+/* Claim the highest numbered free channel up to highest, returning it,
+ * or -1 if none is free.  Call with interrupts disabled. */
+static int claim_free_channel(dma_dev *dev, dma_channel highest,
+                              dma_priority priority, const char *owner) {
+    int ch;
+
+    for (ch = highest; ch >= DMA_CH1; ch--) {
+        if (claim_channel(dev, (dma_channel)ch, priority, owner) == 0) {
+            return ch;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Claim the DMA channel serving a request line.
+ *
+ * Each peripheral request line is hard-wired to a single channel,
+ * which this function returns, provided no one else owns it.
+ * Requests for DMA_REQ_MEM_2_MEM get any free channel, trying DMA2
+ * (where present) before DMA1, and higher numbered channels first, so
+ * that DMA1 channel 1, ADC1's only channel, is tried last.
+ *
+ * On success, the DMA device is initialized, and the channel's
+ * priority is set.  dma_setup_transfer() preserves the priority.
+ *
+ * Drivers should claim their channels this way instead of hard-coding
+ * them, so that conflicting uses of a channel are detected rather
+ * than silently corrupting each other's transfers.
+ *
+ * @param line Request line which will drive the channel.
+ * @param priority Channel priority.
+ * @param owner Name of the claiming driver, for debugging.
+ * @param dev Set to the DMA device on success.
+ * @param channel Set to the DMA channel on success.
+ * @return 0 on success, DMA_ERROR_CONFLICT if the channel (or, for
+ *         DMA_REQ_MEM_2_MEM, every channel) is owned or enabled.
+ * @see dma_release_channel()
+ * @see dma_channel_owner()
+ */
+int dma_request_channel(dma_request_line line,
+                        dma_priority priority,
+                        const char *owner,
+                        dma_dev **dev,
+                        dma_channel *channel) {
+    uint32 primask;
+    dma_dev *d = DMA1;
+    int ch;
+    int ret = DMA_ERROR_CONFLICT;
+
+    ASSERT(owner != NULL);
+
+    primask = nvic_globalirq_save();
+    if (line == DMA_REQ_MEM_2_MEM) {
+        ch = -1;
+#ifdef STM32_HIGH_DENSITY
+        d = DMA2;
+        ch = claim_free_channel(d, DMA_CH5, priority, owner);
+        if (ch < 0) {
+            d = DMA1;
+        }
+#endif
+        if (ch < 0) {
+            ch = claim_free_channel(d, DMA_CH7, priority, owner);
+        }
+        if (ch >= 0) {
+            ret = 0;
+        }
+    } else {
+#ifdef STM32_HIGH_DENSITY
+        if ((line >> 8) == 2) {
+            d = DMA2;
+        }
+#endif
+        ch = (line >> 4) & 0xF;
+        ret = claim_channel(d, (dma_channel)ch, priority, owner);
+    }
+    nvic_globalirq_restore(primask);
+
+    if (ret == 0) {
+        dma_init(d);
+        dma_set_priority(d, (dma_channel)ch, priority);
+        *dev = d;
+        *channel = (dma_channel)ch;
+    }
+    return ret;
+}
+
+/**
+ * @brief Release a channel claimed with dma_request_channel().
+ *
+ * Any queued transfers are dropped, and any attached interrupt handler
+ * is detached.
+ *
+ * @param dev DMA device
+ * @param channel Channel to release.
+ * @sideeffect Disables the given DMA channel.
+ * @see dma_request_channel()
+ */
+void dma_release_channel(dma_dev *dev, dma_channel channel) {
+    dma_queue_cancel(dev, channel);
+    dma_detach_interrupt(dev, channel);
+    channel_owner(dev, channel)->name = NULL;
+}
+
+/**
+ * @brief Get the name of a DMA channel's owner.
+ * @param dev DMA device
+ * @param channel Channel to check.
+ * @return Name passed to dma_request_channel() by the channel's
+ *         owner, or NULL if the channel is free.
+ */
+const char* dma_channel_owner(dma_dev *dev, dma_channel channel) {
+    return channel_owner(dev, channel)->name;
+}
+
+/*
+ * Transfer queues
+ */
+
+/* A queued transfer, stored as the register values that launch it so
+ * the IRQ handler can start the next one with a handful of stores. */
+struct dma_queued_xfer {
+    uint32 ccr;
+    uint32 cpar;
+    uint32 cmar;
+    uint16 cndtr;
+    void (*callback)(void*, dma_irq_cause);
+    void *arg;
+    struct dma_queued_xfer *next;
+};
+
+static struct dma_queued_xfer xfer_pool[DMA_XFER_POOL_SIZE];
+static uint32 xfer_pool_used;   /* slots of xfer_pool ever handed out */
+static uint32 xfer_pool_avail = DMA_XFER_POOL_SIZE;
+static struct dma_queued_xfer *xfer_free_list;
+
+/* Call with interrupts disabled. */
+static struct dma_queued_xfer* xfer_alloc(void) {
+    struct dma_queued_xfer *x = xfer_free_list;
+    if (x) {
+        xfer_free_list = x->next;
+    } else if (xfer_pool_used < DMA_XFER_POOL_SIZE) {
+        x = &xfer_pool[xfer_pool_used++];
+    }
+    if (x) {
+        xfer_pool_avail--;
+    }
+    return x;
+}
+
+/* Call with interrupts disabled. */
+static void xfer_free(struct dma_queued_xfer *x) {
+    x->next = xfer_free_list;
+    xfer_free_list = x;
+    xfer_pool_avail++;
+}
+
+static void xfer_start(dma_dev *dev, dma_channel channel,
+                       struct dma_queued_xfer *x) {
+    dma_channel_reg_map *chan_regs = dma_channel_regs(dev, channel);
+    chan_regs->CCR = 0;
+    chan_regs->CPAR = x->cpar;
+    chan_regs->CMAR = x->cmar;
+    chan_regs->CNDTR = x->cndtr;
+    dma_clear_isr_bits(dev, channel);
+    chan_regs->CCR = x->ccr | DMA_CCR_EN;
+}
+
+/**
+ * @brief Queue a DMA transfer on a channel.
+ *
+ * If the channel's queue is empty, the transfer starts immediately.
+ * Otherwise, it starts from the channel's interrupt handler as soon
+ * as the transfers queued before it have completed, without any
+ * involvement from the caller.
+ *
+ * Transfer complete and transfer error interrupts are always enabled
+ * for queued transfers.  A transfer which fails is dropped, and the
+ * queue moves on to the next one.  A circular transfer never
+ * completes; it remains at the head of the queue until
+ * dma_queue_cancel() is called.
+ *
+ * The queue takes over the channel's interrupt, so you must not
+ * attach a handler with dma_attach_interrupt() while transfers are
+ * queued.  This function may be called from interrupt handlers,
+ * including queued transfer callbacks.
+ *
+ * @param dev DMA device; it must have been initialized with dma_init().
+ * @param channel Channel through which the transfer occurs.
+ * @param xfer Transfer to queue.  It is copied, so it need not
+ *             outlive the call.
+ * @return 0 on success, DMA_ERROR_POOL_EMPTY if DMA_XFER_POOL_SIZE
+ *         transfers are already queued.
+ * @see dma_queue_cancel()
+ * @see dma_queue_is_empty()
+ */
+int dma_queue_xfer(dma_dev *dev, dma_channel channel, const dma_xfer *xfer) {
+    dma_handler_config *config = &dev->handlers[channel - 1];
+    struct dma_queued_xfer *x;
+    uint32 primask;
+
+    ASSERT(config->handler == NULL);
+    ASSERT(xfer->num_transfers > 0);
+
+    primask = nvic_globalirq_save();
+    x = xfer_alloc();
+    if (!x) {
+        nvic_globalirq_restore(primask);
+        return DMA_ERROR_POOL_EMPTY;
+    }
+    x->ccr = ((xfer->memory_size << 10) | (xfer->peripheral_size << 8) |
+              xfer->mode | xfer->priority | DMA_TRNS_CMPLT | DMA_TRNS_ERR);
+    x->cpar = (uint32)xfer->peripheral_address;
+    x->cmar = (uint32)xfer->memory_address;
+    x->cndtr = xfer->num_transfers;
+    x->callback = xfer->callback;
+    x->arg = xfer->arg;
+    x->next = NULL;
+
+    if (config->queue_head) {
+        config->queue_tail->next = x;
+        config->queue_tail = x;
+    } else {
+        config->queue_head = config->queue_tail = x;
+        nvic_irq_enable(config->irq_line);
+        xfer_start(dev, channel, x);
+    }
+    nvic_globalirq_restore(primask);
+    return 0;
+}
+
+/**
+ * @brief Stop a channel's current queued transfer and drop the rest.
+ *
+ * No callbacks are made for the dropped transfers.
+ *
+ * @param dev DMA device
+ * @param channel Channel whose queue to empty.
+ * @sideeffect Disables the given DMA channel.
+ * @see dma_queue_xfer()
+ */
+void dma_queue_cancel(dma_dev *dev, dma_channel channel) {
+    dma_handler_config *config = &dev->handlers[channel - 1];
+    uint32 primask = nvic_globalirq_save();
+    struct dma_queued_xfer *x = config->queue_head;
+
+    dma_channel_regs(dev, channel)->CCR = 0;
+    dma_clear_isr_bits(dev, channel);
+    while (x) {
+        struct dma_queued_xfer *next = x->next;
+        xfer_free(x);
+        x = next;
+    }
+    config->queue_head = config->queue_tail = NULL;
+    nvic_globalirq_restore(primask);
+}
+
+/*
+ * Memory-to-memory operations
+ */
+
+/* Largest CNDTR value. */
+#define MAX_XFER_COUNT 0xFFFF
+
+static dma_dev *mem_dev;
+static dma_channel mem_channel;
+
+/**
+ * @brief Choose the channel used by dma_memcpy_async() and
+ *        dma_memset_async().
+ *
+ * Any channel will do, as memory-to-memory transfers don't use a
+ * peripheral request line, but the channel must not be used for
+ * anything else afterwards.  Use dma_request_channel() with
+ * DMA_REQ_MEM_2_MEM to find one nobody else owns.  Memory operations run at
+ * DMA_PRIORITY_LOW, so peripheral transfers on other channels take
+ * precedence over them.
+ *
+ * @param dev DMA device.  This function initializes it.
+ * @param channel Channel to reserve for memory operations.
+ */
+void dma_mem_reserve(dma_dev *dev, dma_channel channel) {
+    dma_init(dev);
+    mem_dev = dev;
+    mem_channel = channel;
+}
+
+static void mem_op_xfer_done(void *arg, dma_irq_cause cause) {
+    dma_mem_op *op = arg;
+    if (cause == DMA_TRANSFER_ERROR) {
+        op->error = 1;
+    }
+    if (--op->xfers_left == 0) {
+        op->done = 1;
+        if (op->callback) {
+            op->callback(op);
+        }
+    }
+}
+
+/* Queue the DMA part of a memory operation as transfers of at most
+ * MAX_XFER_COUNT units each.  If src_inc is zero, every unit is read
+ * from src. */
+static int mem_op_start(dma_mem_op *op, uint32 dst, uint32 src,
+                        uint8 src_inc, uint32 count, dma_xfer_size size) {
+    uint32 nxfers = (count + MAX_XFER_COUNT - 1) / MAX_XFER_COUNT;
+    uint32 unit = 1 << size;
+    uint32 primask;
+    dma_xfer xfer;
+
+    ASSERT(mem_dev != NULL);
+
+    op->error = 0;
+    if (nxfers == 0) {
+        op->done = 1;
+        if (op->callback) {
+            op->callback(op);
+        }
+        return 0;
+    }
+
+    xfer.peripheral_size = size;
+    xfer.memory_size = size;
+    xfer.mode = DMA_MEM_2_MEM | DMA_MINC_MODE | (src_inc ? DMA_PINC_MODE : 0);
+    xfer.priority = DMA_PRIORITY_LOW;
+    xfer.callback = mem_op_xfer_done;
+    xfer.arg = op;
+
+    /* All of the operation's transfers are queued, or none are. */
+    primask = nvic_globalirq_save();
+    if (xfer_pool_avail < nxfers) {
+        nvic_globalirq_restore(primask);
+        return DMA_ERROR_POOL_EMPTY;
+    }
+    op->done = 0;
+    op->xfers_left = nxfers;
+    while (count > 0) {
+        uint32 n = count < MAX_XFER_COUNT ? count : MAX_XFER_COUNT;
+        xfer.peripheral_address = (__io void*)src;
+        xfer.memory_address = (__io void*)dst;
+        xfer.num_transfers = n;
+        dma_queue_xfer(mem_dev, mem_channel, &xfer);
+        dst += n * unit;
+        if (src_inc) {
+            src += n * unit;
+        }
+        count -= n;
+    }
+    nvic_globalirq_restore(primask);
+    return 0;
+}
+
+/**
+ * @brief Start copying memory in the background.
+ *
+ * The widest transfer size the relative alignment of dst and src
+ * allows is used; any leading and trailing bytes that don't fit that
+ * size are copied by the CPU before this function returns.  For the
+ * fastest copies, make dst and src both word-aligned.
+ *
+ * The regions must not overlap, and must not be touched until the
+ * operation is done.
+ *
+ * @param dst Destination address.
+ * @param src Source address (RAM or flash).
+ * @param len Number of bytes to copy.
+ * @param op Operation state.  Set op->callback first; it is called
+ *           (possibly before this function returns, if len is
+ *           small) when the copy is done.
+ * @return 0 on success, DMA_ERROR_POOL_EMPTY if there's no room in
+ *         the transfer queue.  In the latter case, only the leading
+ *         and trailing bytes have been copied.
+ * @see dma_mem_reserve()
+ * @see dma_mem_op_done()
+ */
+int dma_memcpy_async(void *dst, const void *src, uint32 len, dma_mem_op *op) {
+    uint8 *d = dst;
+    const uint8 *s = src;
+    uint32 align = ((uint32)d ^ (uint32)s) & 0x3;
+    dma_xfer_size size;
+    uint32 unit, head, count;
+
+    if (align == 0) {
+        size = DMA_SIZE_32BITS;
+    } else if (align == 2) {
+        size = DMA_SIZE_16BITS;
+    } else {
+        size = DMA_SIZE_8BITS;
+    }
+    unit = 1 << size;
+
+    if (len < 4 * unit) {
+        /* Not worth it; the CPU will be done before DMA gets going. */
+        head = len;
+        count = 0;
+    } else {
+        head = (unit - ((uint32)d & (unit - 1))) & (unit - 1);
+        count = (len - head) >> size;
+    }
+
+    /* Copy the ends first, so they're in place by the time the
+     * operation can complete. */
+    len -= head + (count << size);
+    while (head--) {
+        *d++ = *s++;
+    }
+    while (len--) {
+        d[(count << size) + len] = s[(count << size) + len];
+    }
+
+    return mem_op_start(op, (uint32)d, (uint32)s, 1, count, size);
+}
+
+/**
+ * @brief Start filling memory with a byte value in the background.
+ *
+ * Word transfers are used for the word-aligned part of dst; any
+ * leading and trailing bytes are filled by the CPU before this
+ * function returns.
+ *
+ * @param dst Destination address.
+ * @param value Value to fill with.
+ * @param len Number of bytes to fill.
+ * @param op Operation state.  As the fill pattern is stored in it, it
+ *           must remain valid until the operation is done.
+ * @return 0 on success, DMA_ERROR_POOL_EMPTY if there's no room in
+ *         the transfer queue.  In the latter case, only the leading
+ *         and trailing bytes have been written.
+ * @see dma_memcpy_async()
+ */
+int dma_memset_async(void *dst, uint8 value, uint32 len, dma_mem_op *op) {
+    uint8 *d = dst;
+    uint32 head, count;
+
+    op->fill = value * 0x01010101UL;
+
+    if (len < 16) {
+        head = len;
+        count = 0;
+    } else {
+        head = (4 - ((uint32)d & 0x3)) & 0x3;
+        count = (len - head) >> 2;
+    }
+
+    len -= head + (count << 2);
+    while (head--) {
+        *d++ = value;
+    }
+    while (len--) {
+        d[(count << 2) + len] = value;
+    }
+
+    return mem_op_start(op, (uint32)d, (uint32)&op->fill, 0, count,
+                        DMA_SIZE_32BITS);
+}
+
 /*
  * IRQ handlers
  */
 
+static void dispatch_queue(dma_dev *dev, dma_channel channel) {
+    dma_handler_config *config = &dev->handlers[channel - 1];
+    struct dma_queued_xfer *x;
+    uint8 status_bits = dma_get_isr_bits(dev, channel);
+    dma_irq_cause cause;
+    uint32 primask;
+
+    /* DMA2 channels 4 and 5 share an IRQ line; this one might not
+     * be the one that fired. */
+    if (!(status_bits & BIT(0))) {
+        return;
+    }
+    dma_clear_isr_bits(dev, channel);
+
+    /* Higher priority interrupts may queue transfers; keep them out
+     * while looking at the queue. */
+    primask = nvic_globalirq_save();
+    x = config->queue_head;
+    nvic_globalirq_restore(primask);
+    if (!x) {
+        return;
+    }
+
+    if (status_bits & BIT(3)) {
+        cause = DMA_TRANSFER_ERROR;
+    } else {
+        /* A late interrupt can find both halves done.  Report the
+         * first half too, and first, so that double buffering callers
+         * don't lose a refill. */
+        if ((status_bits & BIT(2)) && (x->ccr & DMA_HALF_TRNS) &&
+            x->callback) {
+            x->callback(x->arg, DMA_TRANSFER_HALF_COMPLETE);
+        }
+        if (!(status_bits & BIT(1))) {
+            return;
+        }
+        cause = DMA_TRANSFER_COMPLETE;
+        if (x->ccr & DMA_CIRC_MODE) {
+            if (x->callback) {
+                x->callback(x->arg, cause);
+            }
+            return;
+        }
+    }
+
+    /* Launch the next transfer before running the callback, so the
+     * callback's latency doesn't add to the gap between them.  Higher
+     * priority interrupts may queue transfers, so keep them out while
+     * the queue is inconsistent. */
+    primask = nvic_globalirq_save();
+    config->queue_head = x->next;
+    if (x->next) {
+        xfer_start(dev, channel, x->next);
+    } else {
+        config->queue_tail = NULL;
+        dma_channel_regs(dev, channel)->CCR = 0;
+    }
+    nvic_globalirq_restore(primask);
+
+    if (x->callback) {
+        x->callback(x->arg, cause);
+    }
+
+    primask = nvic_globalirq_save();
+    xfer_free(x);
+    nvic_globalirq_restore(primask);
+}
+
 static inline void dispatch_handler(dma_dev *dev, dma_channel channel) {
     void (*handler)(void) = dev->handlers[channel - 1].handler;
-    if (handler) {
+    if (dev->handlers[channel - 1].queue_head) {
+        dispatch_queue(dev, channel);
+    } else if (handler) {
         handler();
         dma_clear_isr_bits(dev, channel); /* in case handler doesn't */
     }
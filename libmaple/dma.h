@@ -269,11 +269,17 @@ typedef struct dma_reg_map {
  * Devices
  */
 
+struct dma_queued_xfer;
+
 /** Encapsulates state related to a DMA channel interrupt. */
 typedef struct dma_handler_config {
     void (*handler)(void);      /**< User-specified channel interrupt
                                      handler */
     nvic_irq_num irq_line;      /**< Channel's NVIC interrupt number */
+    struct dma_queued_xfer *queue_head; /**< Transfer in progress, if the
+                                             channel is driven by
+                                             dma_queue_xfer() */
+    struct dma_queued_xfer *queue_tail; /**< Last queued transfer */
 } dma_handler_config;
 
 /** DMA device type */
@@ -376,6 +382,218 @@ void dma_disable(dma_dev *dev, dma_channel channel);
 void dma_set_mem_addr(dma_dev *dev, dma_channel channel, __io void *address);
 void dma_set_per_addr(dma_dev *dev, dma_channel channel, __io void *address);
 
+/*
+ * Channel allocation
+ */
+
+/**
+ * @brief Encode a DMA request line.
+ * @param controller DMA controller number (1 or 2).
+ * @param channel Channel the request line is hard-wired to.
+ * @param n Distinguishes request lines sharing a channel.
+ * @see dma_request_line
+ */
+#define DMA_REQ_LINE(controller, channel, n)            \
+    (((controller) << 8) | ((channel) << 4) | (n))
+
+/**
+ * @brief Peripheral DMA request lines.
+ *
+ * Each request line is hard-wired to one channel; see /notes/dma.txt.
+ *
+ * @see dma_request_channel()
+ */
+typedef enum dma_request_line {
+    /** Memory-to-memory; may use any channel. */
+    DMA_REQ_MEM_2_MEM     = 0,
+    /* DMA1, channel 1 */
+    DMA_REQ_ADC1          = DMA_REQ_LINE(1, 1, 0),
+    DMA_REQ_TIM2_CH3      = DMA_REQ_LINE(1, 1, 1),
+    DMA_REQ_TIM4_CH1      = DMA_REQ_LINE(1, 1, 2),
+    /* DMA1, channel 2 */
+    DMA_REQ_USART3_TX     = DMA_REQ_LINE(1, 2, 0),
+    DMA_REQ_TIM1_CH1      = DMA_REQ_LINE(1, 2, 1),
+    DMA_REQ_TIM2_UP       = DMA_REQ_LINE(1, 2, 2),
+    DMA_REQ_TIM3_CH3      = DMA_REQ_LINE(1, 2, 3),
+    DMA_REQ_SPI1_RX       = DMA_REQ_LINE(1, 2, 4),
+    /* DMA1, channel 3 */
+    DMA_REQ_USART3_RX     = DMA_REQ_LINE(1, 3, 0),
+    DMA_REQ_TIM1_CH2      = DMA_REQ_LINE(1, 3, 1),
+    DMA_REQ_TIM3_CH4      = DMA_REQ_LINE(1, 3, 2),
+    DMA_REQ_TIM3_UP       = DMA_REQ_LINE(1, 3, 3),
+    DMA_REQ_SPI1_TX       = DMA_REQ_LINE(1, 3, 4),
+    /* DMA1, channel 4 */
+    DMA_REQ_USART1_TX     = DMA_REQ_LINE(1, 4, 0),
+    DMA_REQ_TIM1_CH4      = DMA_REQ_LINE(1, 4, 1),
+    DMA_REQ_TIM1_TRIG     = DMA_REQ_LINE(1, 4, 2),
+    DMA_REQ_TIM1_COM      = DMA_REQ_LINE(1, 4, 3),
+    DMA_REQ_TIM4_CH2      = DMA_REQ_LINE(1, 4, 4),
+    DMA_REQ_SPI2_RX       = DMA_REQ_LINE(1, 4, 5),
+    DMA_REQ_I2C2_TX       = DMA_REQ_LINE(1, 4, 6),
+    /* DMA1, channel 5 */
+    DMA_REQ_USART1_RX     = DMA_REQ_LINE(1, 5, 0),
+    DMA_REQ_TIM1_UP       = DMA_REQ_LINE(1, 5, 1),
+    DMA_REQ_TIM2_CH1      = DMA_REQ_LINE(1, 5, 2),
+    DMA_REQ_TIM4_CH3      = DMA_REQ_LINE(1, 5, 3),
+    DMA_REQ_SPI2_TX       = DMA_REQ_LINE(1, 5, 4),
+    DMA_REQ_I2C2_RX       = DMA_REQ_LINE(1, 5, 5),
+    /* DMA1, channel 6 */
+    DMA_REQ_USART2_RX     = DMA_REQ_LINE(1, 6, 0),
+    DMA_REQ_TIM1_CH3      = DMA_REQ_LINE(1, 6, 1),
+    DMA_REQ_TIM3_CH1      = DMA_REQ_LINE(1, 6, 2),
+    DMA_REQ_TIM3_TRIG     = DMA_REQ_LINE(1, 6, 3),
+    DMA_REQ_I2C1_TX       = DMA_REQ_LINE(1, 6, 4),
+    /* DMA1, channel 7 */
+    DMA_REQ_USART2_TX     = DMA_REQ_LINE(1, 7, 0),
+    DMA_REQ_TIM2_CH2      = DMA_REQ_LINE(1, 7, 1),
+    DMA_REQ_TIM2_CH4      = DMA_REQ_LINE(1, 7, 2),
+    DMA_REQ_TIM4_UP       = DMA_REQ_LINE(1, 7, 3),
+    DMA_REQ_I2C1_RX       = DMA_REQ_LINE(1, 7, 4),
+#ifdef STM32_HIGH_DENSITY
+    /* DMA2, channel 1 */
+    DMA_REQ_TIM5_CH4      = DMA_REQ_LINE(2, 1, 0),
+    DMA_REQ_TIM5_TRIG     = DMA_REQ_LINE(2, 1, 1),
+    DMA_REQ_TIM8_CH3      = DMA_REQ_LINE(2, 1, 2),
+    DMA_REQ_TIM8_UP       = DMA_REQ_LINE(2, 1, 3),
+    DMA_REQ_SPI3_RX       = DMA_REQ_LINE(2, 1, 4),
+    /* DMA2, channel 2 */
+    DMA_REQ_TIM8_CH4      = DMA_REQ_LINE(2, 2, 0),
+    DMA_REQ_TIM8_TRIG     = DMA_REQ_LINE(2, 2, 1),
+    DMA_REQ_TIM8_COM      = DMA_REQ_LINE(2, 2, 2),
+    DMA_REQ_TIM5_CH3      = DMA_REQ_LINE(2, 2, 3),
+    DMA_REQ_TIM5_UP       = DMA_REQ_LINE(2, 2, 4),
+    DMA_REQ_SPI3_TX       = DMA_REQ_LINE(2, 2, 5),
+    /* DMA2, channel 3 */
+    DMA_REQ_TIM8_CH1      = DMA_REQ_LINE(2, 3, 0),
+    DMA_REQ_UART4_RX      = DMA_REQ_LINE(2, 3, 1),
+    DMA_REQ_TIM6_UP       = DMA_REQ_LINE(2, 3, 2),
+    DMA_REQ_DAC_CH1       = DMA_REQ_LINE(2, 3, 3),
+    /* DMA2, channel 4 */
+    DMA_REQ_TIM5_CH2      = DMA_REQ_LINE(2, 4, 0),
+    DMA_REQ_SDIO          = DMA_REQ_LINE(2, 4, 1),
+    DMA_REQ_TIM7_UP       = DMA_REQ_LINE(2, 4, 2),
+    DMA_REQ_DAC_CH2       = DMA_REQ_LINE(2, 4, 3),
+    /* DMA2, channel 5 */
+    DMA_REQ_ADC3          = DMA_REQ_LINE(2, 5, 0),
+    DMA_REQ_TIM8_CH2      = DMA_REQ_LINE(2, 5, 1),
+    DMA_REQ_TIM5_CH1      = DMA_REQ_LINE(2, 5, 2),
+    DMA_REQ_UART4_TX      = DMA_REQ_LINE(2, 5, 3),
+#endif
+} dma_request_line;
+
+/** dma_request_channel() error: the channel is already in use. */
+#define DMA_ERROR_CONFLICT (-2)
+
+int dma_request_channel(dma_request_line line,
+                        dma_priority priority,
+                        const char *owner,
+                        dma_dev **dev,
+                        dma_channel *channel);
+void dma_release_channel(dma_dev *dev, dma_channel channel);
+const char* dma_channel_owner(dma_dev *dev, dma_channel channel);
+
+/*
+ * Transfer queues
+ */
+
+#ifndef DMA_XFER_POOL_SIZE
+/**
+ * Number of transfers that may be queued with dma_queue_xfer(), shared
+ * among all channels.  Override by defining it when building libmaple.
+ */
+#define DMA_XFER_POOL_SIZE 16
+#endif
+
+/** dma_queue_xfer() error: all DMA_XFER_POOL_SIZE slots are in use. */
+#define DMA_ERROR_POOL_EMPTY (-1)
+
+/**
+ * @brief Description of a transfer to be queued with dma_queue_xfer().
+ *
+ * The fields mirror the arguments to dma_setup_transfer(),
+ * dma_set_num_transfers(), and dma_set_priority().
+ */
+typedef struct dma_xfer {
+    __io void *peripheral_address; /**< Peripheral (or source) address */
+    dma_xfer_size peripheral_size; /**< Peripheral data transfer size */
+    __io void *memory_address;     /**< Memory (or destination) address */
+    dma_xfer_size memory_size;     /**< Memory data transfer size */
+    uint16 num_transfers;          /**< Number of data to transfer */
+    uint32 mode;                   /**< Logical OR of dma_mode_flags */
+    dma_priority priority;         /**< Channel priority */
+
+    /**
+     * Called from the channel's interrupt with the transfer's arg when
+     * it completes or fails (or is half complete, if mode contains
+     * DMA_HALF_TRNS).  By the time a completion callback runs, the
+     * next queued transfer has already been started.  May be NULL.
+     */
+    void (*callback)(void *arg, dma_irq_cause cause);
+    void *arg;                     /**< Argument to callback */
+} dma_xfer;
+
+int dma_queue_xfer(dma_dev *dev, dma_channel channel, const dma_xfer *xfer);
+void dma_queue_cancel(dma_dev *dev, dma_channel channel);
+
+/**
+ * @brief Check whether a channel's transfer queue is empty.
+ * @param dev DMA device
+ * @param channel Channel to check
+ * @return Nonzero if no transfer is queued or in progress.
+ * @see dma_queue_xfer()
+ */
+static inline uint8 dma_queue_is_empty(dma_dev *dev, dma_channel channel) {
+    return dev->handlers[channel - 1].queue_head == NULL;
+}
+
+/*
+ * Memory-to-memory operations
+ */
+
+/**
+ * @brief State of an asynchronous memory operation.
+ *
+ * Pass one to dma_memcpy_async() or dma_memset_async(), and keep it
+ * alive until the operation is done.  Either poll it with
+ * dma_mem_op_done(), or set callback before starting the operation.
+ */
+typedef struct dma_mem_op {
+    /**
+     * Called from the DMA interrupt when the operation finishes.
+     * May be NULL.
+     */
+    void (*callback)(struct dma_mem_op *op);
+    volatile uint8 done;        /**< Nonzero once the operation finishes */
+    volatile uint8 error;       /**< Nonzero if a transfer error occurred */
+
+    /* Private; used by the implementation. */
+    volatile uint32 xfers_left;
+    uint32 fill;
+} dma_mem_op;
+
+void dma_mem_reserve(dma_dev *dev, dma_channel channel);
+int dma_memcpy_async(void *dst, const void *src, uint32 len, dma_mem_op *op);
+int dma_memset_async(void *dst, uint8 value, uint32 len, dma_mem_op *op);
+
+/**
+ * @brief Check whether an asynchronous memory operation is done.
+ * @param op Operation to check.
+ * @see dma_memcpy_async()
+ * @see dma_memset_async()
+ */
+static inline uint8 dma_mem_op_done(dma_mem_op *op) {
+    return op->done;
+}
+
+/**
+ * @brief Busy-wait for an asynchronous memory operation to finish.
+ * @param op Operation to wait for.
+ */
+static inline void dma_mem_wait(dma_mem_op *op) {
+    while (!op->done)
+        ;
+}
+
 /**
  * @brief DMA channel register map type.
  *
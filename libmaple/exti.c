@@ -139,33 +139,51 @@ void exti_detach_interrupt(afio_exti_num num) {
  * Interrupt handlers
  */
 
+/* EXTI lines whose bits are set in EXTI_DIRECT_IRQS have their IRQ
+ * handlers defined by the application instead; see exti.h. */
+#define DIRECT(lines) (EXTI_DIRECT_IRQS & (lines))
+
+#if !DIRECT(BIT(0))
 void __irq_exti0(void) {
     dispatch_single_exti(AFIO_EXTI_0);
 }
+#endif
 
+#if !DIRECT(BIT(1))
 void __irq_exti1(void) {
     dispatch_single_exti(AFIO_EXTI_1);
 }
+#endif
 
+#if !DIRECT(BIT(2))
 void __irq_exti2(void) {
     dispatch_single_exti(AFIO_EXTI_2);
 }
+#endif
 
+#if !DIRECT(BIT(3))
 void __irq_exti3(void) {
     dispatch_single_exti(AFIO_EXTI_3);
 }
+#endif
 
+#if !DIRECT(BIT(4))
 void __irq_exti4(void) {
     dispatch_single_exti(AFIO_EXTI_4);
 }
+#endif
 
+#if !DIRECT(0x3E0)
 void __irq_exti9_5(void) {
     dispatch_extis(5, 9);
 }
+#endif
 
+#if !DIRECT(0xFC00)
 void __irq_exti15_10(void) {
     dispatch_extis(10, 15);
 }
+#endif
 
 /*
  * Auxiliary functions
@@ -198,19 +216,20 @@ static inline void dispatch_single_exti(uint32 exti) {
 
 /* Dispatch routine for EXTIs which share an IRQ. */
 static inline void dispatch_extis(uint32 start, uint32 stop) {
-    uint32 pr = EXTI_BASE->PR;
+    uint32 pr = EXTI_BASE->PR & (BIT(stop + 1) - BIT(start));
     uint32 handled_msk = 0;
-    uint32 exti;
 
-    /* Dispatch user handlers for pending EXTIs. */
-    for (exti = start; exti <= stop; exti++) {
+    /* Dispatch user handlers for pending EXTIs, lowest line first,
+     * finding each with a count trailing zeros. */
+    while (pr) {
+        uint32 exti = __builtin_ctz(pr);
         uint32 eb = BIT(exti);
-        if (pr & eb) {
-            voidFuncPtr handler = exti_channels[exti].handler;
-            if (handler) {
-                handler();
-                handled_msk |= eb;
-            }
+        voidFuncPtr handler = exti_channels[exti].handler;
+
+        pr &= ~eb;
+        if (handler) {
+            handler();
+            handled_msk |= eb;
         }
     }
 
@@ -61,6 +61,23 @@ typedef enum exti_trigger_mode {
     EXTI_RISING_FALLING  /**< Trigger on both the rising and falling edges */
 } exti_trigger_mode;
 
+/**
+ * @brief EXTI lines whose IRQ handlers the application defines itself.
+ *
+ * Bit n set means libmaple doesn't define the IRQ handler for EXTI
+ * line n (__irq_exti0() through __irq_exti4(), __irq_exti9_5(), or
+ * __irq_exti15_10()), so the application's own definition goes
+ * straight into the vector table.  For the shared handlers, setting
+ * the bit for any one of their lines is enough.  Such a handler must
+ * clear the pending bits itself, e.g. with EXTI_BASE->PR = BIT(0).
+ *
+ * Must be the same for libmaple and the application; set it with e.g.
+ * "make EXTI_DIRECT_IRQS=0x1" for EXTI line 0.  See notes/exti.txt.
+ */
+#ifndef EXTI_DIRECT_IRQS
+#define EXTI_DIRECT_IRQS 0
+#endif
+
 void exti_attach_interrupt(afio_exti_num num,
                            afio_exti_port port,
                            voidFuncPtr handler,
@@ -65,9 +65,10 @@ static i2c_dev i2c_dev2 = {
 /** I2C2 device */
 i2c_dev* const I2C2 = &i2c_dev2;
 
-static inline int32 wait_for_state_change(i2c_dev *dev,
-                                          i2c_state state,
-                                          uint32 timeout);
+static void xfer_finish(i2c_dev *dev, int32 result);
+static void i2c_claim_dma(i2c_dev *dev);
+static int i2c_dma_start(i2c_dev *dev, i2c_msg *msg, uint8 read);
+static void i2c_dma_cancel(i2c_dev *dev);
 
 /**
  * @brief Fill data register with slave address
@@ -80,49 +81,75 @@ static inline void i2c_send_slave_addr(i2c_dev *dev, uint32 addr, uint32 rw) {
 }
 
 /*
- * Simple debugging trail. Define I2C_DEBUG to turn on.
+ * Event tracing.  See I2C_TRACE_SIZE in i2c.h.
  */
-#ifdef I2C_DEBUG
-
-#define NR_CRUMBS       128
-static struct crumb crumbs[NR_CRUMBS];
-static uint32 cur_crumb = 0;
-
-static inline void i2c_drop_crumb(uint32 event, uint32 arg0, uint32 arg1) {
-    if (cur_crumb < NR_CRUMBS) {
-        struct crumb *crumb = &crumbs[cur_crumb++];
-        crumb->event = event;
-        crumb->arg0 = arg0;
-        crumb->arg1 = arg1;
-    }
-}
-#define I2C_CRUMB(event, arg0, arg1) i2c_drop_crumb(event, arg0, arg1)
+#if I2C_TRACE_SIZE
 
-#else
-#define I2C_CRUMB(event, arg0, arg1)
+#if I2C_TRACE_SIZE & (I2C_TRACE_SIZE - 1)
+#error "I2C_TRACE_SIZE must be a power of two"
 #endif
 
-struct crumb {
-    uint32 event;
-    uint32 arg0;
-    uint32 arg1;
+/* Cortex-M3 cycle counter */
+#define DEMCR                   (*(__io uint32*)0xE000EDFC)
+#define DEMCR_TRCENA            BIT(24)
+#define DWT_CTRL                (*(__io uint32*)0xE0001000)
+#define DWT_CTRL_CYCCNTENA      BIT(0)
+#define DWT_CYCCNT              (*(__io uint32*)0xE0001004)
+
+i2c_trace_buffer i2c_trace_buf = {
+    .magic      = I2C_TRACE_MAGIC,
+    .size       = I2C_TRACE_SIZE,
+    .entry_size = sizeof(i2c_trace_entry),
+    .cpu_hz     = CLOCK_SPEED_HZ,
 };
+volatile uint8 i2c_trace_on;
+
+/**
+ * @brief Start recording I2C events, discarding any recorded before.
+ * @see i2c_trace_buffer
+ */
+void i2c_trace_enable(void) {
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+    i2c_trace_buf.count = 0;
+    i2c_trace_on = 1;
+}
+
+/**
+ * @brief Stop recording I2C events.  The buffer is left intact.
+ */
+void i2c_trace_disable(void) {
+    i2c_trace_on = 0;
+}
+
+/**
+ * @brief Record an I2C event.  Use I2C_TRACE() instead, which skips
+ *        the call while tracing is off.
+ */
+void i2c_trace_record(i2c_dev *dev, uint8 event, uint32 arg0, uint32 arg1) {
+    uint32 primask = nvic_globalirq_save();
+    i2c_trace_entry *e =
+        &i2c_trace_buf.entries[i2c_trace_buf.count++ & (I2C_TRACE_SIZE - 1)];
+    e->cycles = DWT_CYCCNT;
+    e->bus = dev == I2C1 ? 1 : 2;
+    e->event = event;
+    e->addr = dev->msg ? dev->msg->addr : 0;
+    e->arg0 = arg0;
+    e->arg1 = arg1;
+    nvic_globalirq_restore(primask);
+}
+
+#define I2C_TRACE(dev, event, arg0, arg1)                       \
+    do {                                                        \
+        if (i2c_trace_on) {                                     \
+            i2c_trace_record(dev, event, arg0, arg1);           \
+        }                                                       \
+    } while (0)
+
+#else
+#define I2C_TRACE(dev, event, arg0, arg1)
+#endif
 
-enum {
-    IRQ_ENTRY           = 1,
-    TXE_ONLY            = 2,
-    TXE_BTF             = 3,
-    STOP_SENT           = 4,
-    TEST                = 5,
-    RX_ADDR_START       = 6,
-    RX_ADDR_STOP        = 7,
-    RXNE_ONLY           = 8,
-    RXNE_SENDING        = 9,
-    RXNE_START_SENT     = 10,
-    RXNE_STOP_SENT      = 11,
-    RXNE_DONE           = 12,
-    ERROR_ENTRY         = 13,
-};
 
 /**
  * @brief IRQ handler for I2C master. Handles transmission/reception.
@@ -130,12 +157,21 @@ enum {
  */
 static void i2c_irq_handler(i2c_dev *dev) {
     i2c_msg *msg = dev->msg;
-
-    uint8 read = msg->flags & I2C_MSG_READ;
+    uint8 read;
 
     uint32 sr1 = dev->regs->SR1;
     uint32 sr2 = dev->regs->SR2;
-    I2C_CRUMB(IRQ_ENTRY, sr1, sr2);
+    I2C_TRACE(dev, I2C_TRACE_IRQ_ENTRY, sr1, sr2);
+
+    /*
+     * Stray event after a transaction was aborted; nothing to do.
+     */
+    if (dev->state != I2C_STATE_BUSY) {
+        i2c_disable_irq(dev, I2C_IRQ_EVENT | I2C_IRQ_BUFFER);
+        return;
+    }
+
+    read = msg->flags & I2C_MSG_READ;
 
     /*
      * Reset timeout counter
@@ -164,22 +200,42 @@ static void i2c_irq_handler(i2c_dev *dev) {
      * EV6: Slave address sent
      */
     if (sr1 & I2C_SR1_ADDR) {
-        /*
-         * Special case event EV6_1 for master receiver.
-         * Generate NACK and restart/stop condition after ADDR
-         * is cleared.
-         */
-        if (read) {
+        if (dev->dma_d && msg->length >= I2C_DMA_THRESHOLD &&
+            i2c_dma_start(dev, msg, read) == 0) {
+            /*
+             * DMA moves the data; see i2c_dma_rx_done() and the
+             * DMA transmitter case below.
+             */
+            I2C_TRACE(dev, I2C_TRACE_DMA_START, msg->length, read);
+        } else if (read) {
+            /*
+             * Special case event EV6_1 for master receiver.
+             * Generate NACK and restart/stop condition after ADDR
+             * is cleared.
+             */
             if (msg->length == 1) {
                 i2c_disable_ack(dev);
                 if (dev->msgs_left > 1) {
                     i2c_start_condition(dev);
-                    I2C_CRUMB(RX_ADDR_START, 0, 0);
+                    I2C_TRACE(dev, I2C_TRACE_RX_ADDR_START, 0, 0);
                 } else {
                     i2c_stop_condition(dev);
-                    I2C_CRUMB(RX_ADDR_STOP, 0, 0);
+                    I2C_TRACE(dev, I2C_TRACE_RX_ADDR_STOP, 0, 0);
                 }
             }
+        } else if (msg->length == 0) {
+            /*
+             * Address-only write, e.g. probing for a slave.  There's
+             * no data to send, so move straight on.
+             */
+            i2c_disable_irq(dev, I2C_IRQ_BUFFER);
+            if (--dev->msgs_left) {
+                dev->msg++;
+                i2c_start_condition(dev);
+            } else {
+                i2c_stop_condition(dev);
+                xfer_finish(dev, 0);
+            }
         } else {
             /*
              * Master transmitter: write first byte to fill shift
@@ -193,13 +249,34 @@ static void i2c_irq_handler(i2c_dev *dev) {
         sr1 = sr2 = 0;
     }
 
+    /*
+     * DMA transfer in progress.  The only event we care about is BTF
+     * at the end of a transmission, after which we carry on as for
+     * EV8_2; the receiver finishes from the DMA interrupt.  BTF also
+     * sets if DMA stalls for a byte time mid-message, so it only
+     * counts once DMA has written the last byte (RM0008, "DMA
+     * requests": end of DMA transfer, then BTF).
+     */
+    if (dev->dma_busy) {
+        if (!read && (sr1 & I2C_SR1_BTF) &&
+            dma_channel_regs(dev->dma_d, dev->tx_dma_ch)->CNDTR == 0) {
+            I2C_TRACE(dev, I2C_TRACE_DMA_TX_DONE, 0, 0);
+            dev->regs->CR2 &= ~I2C_CR2_DMAEN;
+            dev->dma_busy = 0;
+            msg->xferred = msg->length;
+            dev->msgs_left--;
+        } else {
+            sr1 = sr2 = 0;
+        }
+    }
+
     /*
      * EV8: Master transmitter
      * Transmit buffer empty, but we haven't finished transmitting the last
      * byte written.
      */
     if ((sr1 & I2C_SR1_TXE) && !(sr1 & I2C_SR1_BTF)) {
-        I2C_CRUMB(TXE_ONLY, 0, 0);
+        I2C_TRACE(dev, I2C_TRACE_TXE_ONLY, 0, 0);
         if (dev->msgs_left) {
             i2c_write(dev, msg->data[msg->xferred++]);
             if (msg->xferred == msg->length) {
@@ -224,9 +301,9 @@ static void i2c_irq_handler(i2c_dev *dev) {
      * Last byte sent, program repeated start/stop
      */
     if ((sr1 & I2C_SR1_TXE) && (sr1 & I2C_SR1_BTF)) {
-        I2C_CRUMB(TXE_BTF, 0, 0);
+        I2C_TRACE(dev, I2C_TRACE_TXE_BTF, 0, 0);
         if (dev->msgs_left) {
-            I2C_CRUMB(TEST, 0, 0);
+            I2C_TRACE(dev, I2C_TRACE_TX_RESTART, 0, 0);
             /*
              * Repeated start insanity: We can't disable ITEVTEN or else SB
              * won't interrupt, but if we don't disable ITEVTEN, BTF will
@@ -246,8 +323,8 @@ static void i2c_irq_handler(i2c_dev *dev) {
              * me.
              */
             i2c_disable_irq(dev, I2C_IRQ_EVENT);
-            I2C_CRUMB(STOP_SENT, 0, 0);
-            dev->state = I2C_STATE_XFER_DONE;
+            I2C_TRACE(dev, I2C_TRACE_STOP_SENT, 0, 0);
+            xfer_finish(dev, 0);
         }
         sr1 = sr2 = 0;
     }
@@ -256,7 +333,7 @@ static void i2c_irq_handler(i2c_dev *dev) {
      * EV7: Master Receiver
      */
     if (sr1 & I2C_SR1_RXNE) {
-        I2C_CRUMB(RXNE_ONLY, 0, 0);
+        I2C_TRACE(dev, I2C_TRACE_RXNE_ONLY, 0, 0);
         msg->data[msg->xferred++] = dev->regs->DR;
 
         /*
@@ -268,10 +345,10 @@ static void i2c_irq_handler(i2c_dev *dev) {
             i2c_disable_ack(dev);
             if (dev->msgs_left > 2) {
                 i2c_start_condition(dev);
-                I2C_CRUMB(RXNE_START_SENT, 0, 0);
+                I2C_TRACE(dev, I2C_TRACE_RXNE_START_SENT, 0, 0);
             } else {
                 i2c_stop_condition(dev);
-                I2C_CRUMB(RXNE_STOP_SENT, 0, 0);
+                I2C_TRACE(dev, I2C_TRACE_RXNE_STOP_SENT, 0, 0);
             }
         } else if (msg->xferred == msg->length) {
             dev->msgs_left--;
@@ -279,8 +356,8 @@ static void i2c_irq_handler(i2c_dev *dev) {
                 /*
                  * We're done.
                  */
-                I2C_CRUMB(RXNE_DONE, 0, 0);
-                dev->state = I2C_STATE_XFER_DONE;
+                I2C_TRACE(dev, I2C_TRACE_RXNE_DONE, 0, 0);
+                xfer_finish(dev, 0);
             } else {
                 dev->msg++;
             }
@@ -302,9 +379,9 @@ void __irq_i2c2_ev(void) {
  * @sideeffect Aborts any pending I2C transactions
  */
 static void i2c_irq_error_handler(i2c_dev *dev) {
-    I2C_CRUMB(ERROR_ENTRY, dev->regs->SR1, dev->regs->SR2);
+    I2C_TRACE(dev, I2C_TRACE_ERROR_ENTRY, dev->regs->SR1, dev->regs->SR2);
 
-    dev->error_flags = dev->regs->SR2 & (I2C_SR1_BERR |
+    dev->error_flags = dev->regs->SR1 & (I2C_SR1_BERR |
                                          I2C_SR1_ARLO |
                                          I2C_SR1_AF |
                                          I2C_SR1_OVR);
@@ -312,9 +389,12 @@ static void i2c_irq_error_handler(i2c_dev *dev) {
     dev->regs->SR1 = 0;
     dev->regs->SR2 = 0;
 
+    i2c_dma_cancel(dev);
     i2c_stop_condition(dev);
     i2c_disable_irq(dev, I2C_IRQ_BUFFER | I2C_IRQ_EVENT | I2C_IRQ_ERROR);
-    dev->state = I2C_STATE_ERROR;
+    if (dev->state == I2C_STATE_BUSY) {
+        xfer_finish(dev, I2C_ERROR_PROTOCOL);
+    }
 }
 
 void __irq_i2c1_er(void) {
@@ -390,7 +470,10 @@ void i2c_init(i2c_dev *dev) {
  *              I2C_BUS_RESET: Reset the bus and clock out any hung slaves on
  *                             initialization,
  *              I2C_10BIT_ADDRESSING: Enable 10-bit addressing,
- *              I2C_REMAP: Remap I2C1 to SCL/PB8 SDA/PB9.
+ *              I2C_REMAP: Remap I2C1 to SCL/PB8 SDA/PB9,
+ *              I2C_DMA: Move messages of I2C_DMA_THRESHOLD bytes or
+ *                       more by DMA, if the I2C device's DMA
+ *                       channels are free.
  */
 void i2c_master_enable(i2c_dev *dev, uint32 flags) {
 #define I2C_CLK                (STM32_PCLK1/1000000)
@@ -413,6 +496,9 @@ void i2c_master_enable(i2c_dev *dev, uint32 flags) {
 
     /* Turn on clock and set GPIO modes */
     i2c_init(dev);
+    if (flags & I2C_DMA) {
+        i2c_claim_dma(dev);
+    }
     gpio_set_mode(dev->gpio_port, dev->sda_pin, GPIO_AF_OUTPUT_OD);
     gpio_set_mode(dev->gpio_port, dev->scl_pin, GPIO_AF_OUTPUT_OD);
 
@@ -485,9 +571,297 @@ void i2c_master_enable(i2c_dev *dev, uint32 flags) {
     i2c_peripheral_enable(dev);
 
     dev->state = I2C_STATE_IDLE;
+    systick_attach_timeout_callback(i2c_check_timeouts);
 }
 
 
+/*
+ * Transaction queue
+ */
+
+/* Start xfer, which must be at the head of dev's queue. */
+static void xfer_start(i2c_dev *dev, i2c_xfer *xfer) {
+    dev->msg = xfer->msgs;
+    I2C_TRACE(dev, I2C_TRACE_XFER_START, xfer->num, 0);
+    dev->msgs_left = xfer->num;
+    dev->timestamp = systick_uptime();
+    dev->state = I2C_STATE_BUSY;
+
+    i2c_enable_irq(dev, I2C_IRQ_EVENT | I2C_IRQ_ERROR);
+    i2c_start_condition(dev);
+}
+
+/* Pop the transaction at the head of dev's queue, and start the next
+ * one, if any.  Call with interrupts disabled. */
+static i2c_xfer* xfer_dequeue(i2c_dev *dev) {
+    i2c_xfer *xfer = dev->queue_head;
+
+    dev->queue_head = xfer->next;
+    if (dev->queue_head) {
+        xfer_start(dev, dev->queue_head);
+    } else {
+        dev->queue_tail = NULL;
+        i2c_disable_irq(dev, I2C_IRQ_EVENT | I2C_IRQ_BUFFER);
+        dev->state = I2C_STATE_IDLE;
+    }
+    return xfer;
+}
+
+static void xfer_complete(i2c_dev *dev, i2c_xfer *xfer, int32 result) {
+    I2C_TRACE(dev, I2C_TRACE_XFER_DONE, result, 0);
+    xfer->result = result;
+    xfer->done = 1;
+    if (xfer->callback) {
+        xfer->callback(xfer);
+    }
+}
+
+static void xfer_finish(i2c_dev *dev, int32 result) {
+    i2c_xfer *xfer;
+    uint32 primask = nvic_globalirq_save();
+    xfer = xfer_dequeue(dev);
+    nvic_globalirq_restore(primask);
+    xfer_complete(dev, xfer, result);
+}
+
+/*
+ * DMA
+ */
+
+static void i2c_claim_dma(i2c_dev *dev) {
+    dma_request_line rx_req = dev == I2C1 ? DMA_REQ_I2C1_RX : DMA_REQ_I2C2_RX;
+    dma_request_line tx_req = dev == I2C1 ? DMA_REQ_I2C1_TX : DMA_REQ_I2C2_TX;
+    dma_dev *tx_dev;
+
+    if (dev->dma_d) {
+        return;
+    }
+    if (dma_request_channel(rx_req, DMA_PRIORITY_HIGH, "I2C RX",
+                            &dev->dma_d, &dev->rx_dma_ch) < 0) {
+        dev->dma_d = NULL;
+        return;
+    }
+    if (dma_request_channel(tx_req, DMA_PRIORITY_MEDIUM, "I2C TX",
+                            &tx_dev, &dev->tx_dma_ch) < 0) {
+        dma_release_channel(dev->dma_d, dev->rx_dma_ch);
+        dev->dma_d = NULL;
+    }
+}
+
+/* Stop a DMA transfer started by i2c_dma_start() without completing
+ * the message. */
+static void i2c_dma_cancel(i2c_dev *dev) {
+    if (!dev->dma_busy) {
+        return;
+    }
+    dev->regs->CR2 &= ~(I2C_CR2_DMAEN | I2C_CR2_LAST);
+    dma_queue_cancel(dev->dma_d, dev->rx_dma_ch);
+    dma_queue_cancel(dev->dma_d, dev->tx_dma_ch);
+    dev->dma_busy = 0;
+}
+
+static void i2c_dma_abort(i2c_dev *dev) {
+    i2c_xfer *xfer;
+    uint32 primask = nvic_globalirq_save();
+
+    if (!dev->dma_busy) {
+        nvic_globalirq_restore(primask);
+        return;
+    }
+    i2c_dma_cancel(dev);
+    i2c_disable_irq(dev, I2C_IRQ_BUFFER | I2C_IRQ_EVENT | I2C_IRQ_ERROR);
+    i2c_stop_condition(dev);
+    xfer = xfer_dequeue(dev);
+    nvic_globalirq_restore(primask);
+
+    xfer_complete(dev, xfer, I2C_ERROR_PROTOCOL);
+}
+
+/*
+ * Master receiver, DMA transfer complete.  With LAST set, the
+ * peripheral NACKed the final byte after DMA took the one before it
+ * (EOT-1); all that's left is the restart/stop condition.
+ */
+static void i2c_dma_rx_done(void *arg, dma_irq_cause cause) {
+    i2c_dev *dev = (i2c_dev*)arg;
+    i2c_xfer *xfer = NULL;
+    uint32 primask;
+
+    if (cause == DMA_TRANSFER_ERROR) {
+        i2c_dma_abort(dev);
+        return;
+    }
+
+    primask = nvic_globalirq_save();
+    if (!dev->dma_busy) {
+        /* Aborted while the interrupt was pending */
+        nvic_globalirq_restore(primask);
+        return;
+    }
+    I2C_TRACE(dev, I2C_TRACE_DMA_RX_DONE, 0, 0);
+    dev->regs->CR2 &= ~(I2C_CR2_DMAEN | I2C_CR2_LAST);
+    dev->dma_busy = 0;
+    dev->msg->xferred = dev->msg->length;
+    dev->timestamp = systick_uptime();
+
+    /*
+     * Point at the next message before asking for the repeated
+     * start, so its SB event finds it.
+     */
+    if (--dev->msgs_left) {
+        dev->msg++;
+        i2c_start_condition(dev);
+    } else {
+        i2c_stop_condition(dev);
+        xfer = xfer_dequeue(dev);
+    }
+    nvic_globalirq_restore(primask);
+
+    if (xfer) {
+        xfer_complete(dev, xfer, 0);
+    }
+}
+
+/* Master transmitter: BTF in the event handler finishes the message.
+ * Only errors need attention here. */
+static void i2c_dma_tx_done(void *arg, dma_irq_cause cause) {
+    if (cause == DMA_TRANSFER_ERROR) {
+        i2c_dma_abort((i2c_dev*)arg);
+    }
+}
+
+/*
+ * Hand msg's data phase to DMA.  Called at EV6, after ADDR is
+ * cleared.  Returns 0 on success, or a negative value if the DMA
+ * transfer couldn't be queued, in which case the caller should fall
+ * back on interrupts.
+ */
+static int i2c_dma_start(i2c_dev *dev, i2c_msg *msg, uint8 read) {
+    dma_xfer x;
+
+    x.peripheral_address = &dev->regs->DR;
+    x.peripheral_size = DMA_SIZE_8BITS;
+    x.memory_address = msg->data;
+    x.memory_size = DMA_SIZE_8BITS;
+    x.num_transfers = msg->length;
+    x.arg = dev;
+    if (read) {
+        x.mode = DMA_MINC_MODE;
+        x.priority = DMA_PRIORITY_HIGH;
+        x.callback = i2c_dma_rx_done;
+    } else {
+        x.mode = DMA_MINC_MODE | DMA_FROM_MEM;
+        x.priority = DMA_PRIORITY_MEDIUM;
+        x.callback = i2c_dma_tx_done;
+    }
+    if (dma_queue_xfer(dev->dma_d, read ? dev->rx_dma_ch : dev->tx_dma_ch,
+                       &x) < 0) {
+        return -1;
+    }
+
+    dev->dma_busy = 1;
+    i2c_disable_irq(dev, I2C_IRQ_BUFFER);
+    dev->regs->CR2 |= I2C_CR2_DMAEN | (read ? I2C_CR2_LAST : 0);
+    return 0;
+}
+
+/*
+ * Reset the peripheral after a timeout, keeping its clock
+ * configuration.  This unsticks START/STOP requests the peripheral
+ * couldn't act on; a slave still holding the bus needs
+ * i2c_bus_reset().
+ */
+static void i2c_soft_reset(i2c_dev *dev) {
+    i2c_reg_map *regs = dev->regs;
+    uint32 freq = regs->CR2 & I2C_CR2_FREQ;
+    uint32 ccr = regs->CCR;
+    uint32 trise = regs->TRISE;
+
+    regs->CR1 = I2C_CR1_SWRST;
+    regs->CR1 = 0;
+    regs->CR2 = freq;
+    regs->CCR = ccr;
+    regs->TRISE = trise;
+    regs->CR1 = I2C_CR1_PE;
+}
+
+static void check_timeout(i2c_dev *dev) {
+    i2c_xfer *xfer;
+    uint32 primask;
+
+    if (!dev->queue_head) {
+        return;
+    }
+
+    primask = nvic_globalirq_save();
+    xfer = dev->queue_head;
+    if (!xfer || !xfer->timeout ||
+        (uint32)(systick_uptime() - dev->timestamp) < xfer->timeout) {
+        nvic_globalirq_restore(primask);
+        return;
+    }
+    I2C_TRACE(dev, I2C_TRACE_TIMEOUT,
+              systick_uptime() - dev->timestamp, 0);
+    i2c_dma_cancel(dev);
+    i2c_soft_reset(dev);
+    xfer = xfer_dequeue(dev);
+    nvic_globalirq_restore(primask);
+
+    xfer_complete(dev, xfer, I2C_ERROR_TIMEOUT);
+}
+
+/**
+ * @brief Abort queued transactions whose bus idle timeout has expired.
+ *
+ * Called every millisecond from the SysTick exception handler, once
+ * i2c_master_enable() has attached it.
+ *
+ * @see i2c_xfer
+ */
+void i2c_check_timeouts(void) {
+    check_timeout(&i2c_dev1);
+    check_timeout(&i2c_dev2);
+}
+
+/**
+ * @brief Queue an i2c transaction, without waiting for it.
+ *
+ * The transaction starts right away if the bus is idle, and otherwise
+ * after every transaction submitted before it is done.  Its result
+ * and done fields are updated, and its callback is called, from
+ * interrupt context when it finishes.
+ *
+ * Timeouts are checked by the SysTick handler, so they work only
+ * while SysTick is running and able to interrupt.
+ *
+ * @param dev I2C device, enabled with i2c_master_enable()
+ * @param xfer Transaction to queue.  The caller must fill in its msgs,
+ *             num, timeout, and callback fields.
+ * @see i2c_xfer_wait()
+ * @see i2c_master_is_idle()
+ */
+void i2c_master_submit(i2c_dev *dev, i2c_xfer *xfer) {
+    uint32 primask;
+
+    ASSERT(dev->state != I2C_STATE_DISABLED);
+    ASSERT(xfer->num > 0);
+
+    xfer->result = 0;
+    xfer->done = 0;
+    xfer->next = NULL;
+
+    primask = nvic_globalirq_save();
+    if (dev->queue_head) {
+        dev->queue_tail->next = xfer;
+        dev->queue_tail = xfer;
+    } else {
+        dev->queue_head = xfer;
+        dev->queue_tail = xfer;
+        xfer_start(dev, xfer);
+    }
+    nvic_globalirq_restore(primask);
+}
+
 /**
  * @brief Process an i2c transaction.
  *
@@ -495,6 +869,9 @@ void i2c_master_enable(i2c_dev *dev, uint32 flags) {
  * or write tranfers.  Multiple i2c_msg's will generate a repeated
  * start in between messages.
  *
+ * The transaction is queued behind any others submitted with
+ * i2c_master_submit(), and this function waits for it to finish.
+ *
  * @param dev I2C device
  * @param msgs Messages to send/receive
  * @param num Number of messages to send/receive
@@ -508,58 +885,13 @@ int32 i2c_master_xfer(i2c_dev *dev,
                       i2c_msg *msgs,
                       uint16 num,
                       uint32 timeout) {
-    int32 rc;
-
-    ASSERT(dev->state == I2C_STATE_IDLE);
+    i2c_xfer xfer;
 
-    dev->msg = msgs;
-    dev->msgs_left = num;
-    dev->timestamp = systick_uptime();
-    dev->state = I2C_STATE_BUSY;
+    xfer.msgs = msgs;
+    xfer.num = num;
+    xfer.timeout = timeout;
+    xfer.callback = NULL;
+    i2c_master_submit(dev, &xfer);
 
-    i2c_enable_irq(dev, I2C_IRQ_EVENT);
-    i2c_start_condition(dev);
-
-    rc = wait_for_state_change(dev, I2C_STATE_XFER_DONE, timeout);
-    if (rc < 0) {
-        goto out;
-    }
-
-    dev->state = I2C_STATE_IDLE;
-out:
-    return rc;
-}
-
-
-/**
- * @brief Wait for an I2C event, or time out in case of error.
- * @param dev I2C device
- * @param state I2C_state state to wait for
- * @param timeout Timeout, in milliseconds
- * @return 0 if target state is reached, a negative value on error.
- */
-static inline int32 wait_for_state_change(i2c_dev *dev,
-                                          i2c_state state,
-                                          uint32 timeout) {
-    i2c_state tmp;
-
-    while (1) {
-        tmp = dev->state;
-
-        if (tmp == I2C_STATE_ERROR) {
-            return I2C_STATE_ERROR;
-        }
-
-        if (tmp == state) {
-            return 0;
-        }
-
-        if (timeout) {
-            if (systick_uptime() > (dev->timestamp + timeout)) {
-                /* TODO: overflow? */
-                /* TODO: racy? */
-                return I2C_ERROR_TIMEOUT;
-            }
-        }
-    }
+    return i2c_xfer_wait(&xfer);
 }
@@ -33,6 +33,7 @@
 #include "rcc.h"
 #include "nvic.h"
 #include "gpio.h"
+#include "dma.h"
 
 #ifndef _I2C_H_
 #define _I2C_H_
@@ -73,6 +74,36 @@ typedef struct i2c_msg {
     uint8 *data;                /**< Data */
 } i2c_msg;
 
+/**
+ * @brief Queued I2C transaction.
+ *
+ * A transaction is a sequence of messages, separated by repeated
+ * starts, which is submitted to a bus's queue with
+ * i2c_master_submit().  The caller owns the structure and its
+ * messages, and must leave them alone until the transaction is done.
+ *
+ * @see i2c_master_submit()
+ */
+typedef struct i2c_xfer {
+    i2c_msg *msgs;              /**< Messages to send/receive */
+    uint16 num;                 /**< Number of messages */
+    uint32 timeout;             /**< Bus idle timeout in milliseconds
+                                     before aborting the transaction;
+                                     0 denotes no timeout */
+    /**
+     * Called from interrupt context when the transaction is done, or
+     * NULL.  The next queued transaction has already been started by
+     * then, and the callback may submit more transactions.
+     */
+    void (*callback)(struct i2c_xfer *xfer);
+    void *arg;                  /**< For the callback's use */
+    volatile int32 result;      /**< 0 on success, or I2C_ERROR_PROTOCOL
+                                     or I2C_ERROR_TIMEOUT */
+    volatile uint8 done;        /**< Nonzero once the transaction is
+                                     done */
+    struct i2c_xfer *next;      /**< For internal use */
+} i2c_xfer;
+
 /**
  * @brief I2C device type.
  */
@@ -89,8 +120,85 @@ typedef struct i2c_dev {
     i2c_msg *msg;               /**< Messages */
     volatile uint32 timestamp;  /**< For internal use */
     uint32 error_flags;         /**< Error flags, set on I2C error condition */
+    i2c_xfer *volatile queue_head; /**< Transaction in progress */
+    i2c_xfer *queue_tail;       /**< Last queued transaction */
+    dma_dev *dma_d;             /**< DMA controller, if I2C_DMA was given
+                                     and its channels were free */
+    dma_channel rx_dma_ch;      /**< DMA receive channel */
+    dma_channel tx_dma_ch;      /**< DMA transmit channel */
+    volatile uint8 dma_busy;    /**< For internal use */
 } i2c_dev;
 
+/*
+ * Event tracing
+ */
+
+/*
+ * Define I2C_TRACE_SIZE to a power of two to build in a ring buffer
+ * of that many trace entries, and turn it on with i2c_trace_enable().
+ * I2C_DEBUG is a shorthand for a 128-entry buffer.
+ */
+#if defined(I2C_DEBUG) && !defined(I2C_TRACE_SIZE)
+#define I2C_TRACE_SIZE          128
+#endif
+#ifndef I2C_TRACE_SIZE
+#define I2C_TRACE_SIZE          0
+#endif
+
+/** I2C trace event types */
+typedef enum i2c_trace_event {
+    I2C_TRACE_IRQ_ENTRY         = 1,  /**< Event IRQ; arg0 = SR1, arg1 = SR2 */
+    I2C_TRACE_TXE_ONLY          = 2,  /**< EV8, byte written */
+    I2C_TRACE_TXE_BTF           = 3,  /**< EV8_2, last byte sent */
+    I2C_TRACE_STOP_SENT         = 4,  /**< Transmitter stop condition */
+    I2C_TRACE_TX_RESTART        = 5,  /**< Transmitter repeated start */
+    I2C_TRACE_RX_ADDR_START     = 6,  /**< EV6_1, repeated start */
+    I2C_TRACE_RX_ADDR_STOP      = 7,  /**< EV6_1, stop condition */
+    I2C_TRACE_RXNE_ONLY         = 8,  /**< EV7, byte read */
+    I2C_TRACE_RXNE_START_SENT   = 10, /**< EV7_1, repeated start */
+    I2C_TRACE_RXNE_STOP_SENT    = 11, /**< EV7_1, stop condition */
+    I2C_TRACE_RXNE_DONE         = 12, /**< Last byte read */
+    I2C_TRACE_ERROR_ENTRY       = 13, /**< Error IRQ; arg0 = SR1, arg1 = SR2 */
+    I2C_TRACE_DMA_START         = 14, /**< arg0 = length, arg1 = read */
+    I2C_TRACE_DMA_TX_DONE       = 15, /**< DMA transmission finished */
+    I2C_TRACE_DMA_RX_DONE       = 16, /**< DMA reception finished */
+    I2C_TRACE_XFER_START        = 17, /**< arg0 = number of messages */
+    I2C_TRACE_XFER_DONE         = 18, /**< arg0 = result */
+    I2C_TRACE_TIMEOUT           = 19, /**< arg0 = ms since last event */
+} i2c_trace_event;
+
+/** I2C trace buffer entry */
+typedef struct i2c_trace_entry {
+    uint32 cycles;              /**< CPU cycle counter (DWT_CYCCNT) */
+    uint8 bus;                  /**< 1 for I2C1, 2 for I2C2 */
+    uint8 event;                /**< An i2c_trace_event */
+    uint16 addr;                /**< Current message's slave address */
+    uint32 arg0;                /**< Event-specific */
+    uint32 arg1;                /**< Event-specific */
+} i2c_trace_entry;
+
+/** i2c_trace_buffer magic number ("I2CT") */
+#define I2C_TRACE_MAGIC         0x54433249
+
+/**
+ * @brief I2C trace ring buffer.
+ *
+ * Entry (count - 1) % size is the newest; once count exceeds size,
+ * the oldest entries are overwritten.  The layout is read as-is by
+ * support/scripts/i2c-trace.py, from a debugger memory dump or a raw
+ * copy sent over a serial port.
+ */
+typedef struct i2c_trace_buffer {
+    uint32 magic;               /**< I2C_TRACE_MAGIC */
+    uint16 size;                /**< Number of entries */
+    uint16 entry_size;          /**< sizeof(i2c_trace_entry) */
+    uint32 cpu_hz;              /**< Cycle counter frequency */
+    volatile uint32 count;      /**< Events recorded since enabled */
+#if I2C_TRACE_SIZE
+    i2c_trace_entry entries[I2C_TRACE_SIZE]; /**< Ring buffer */
+#endif
+} i2c_trace_buffer;
+
 /*
  * Devices
  */
@@ -180,11 +288,49 @@ void i2c_init(i2c_dev *dev);
 #define I2C_DUTY_16_9           BIT(1)      // 16/9 duty ratio
 #define I2C_REMAP               BIT(2)      // Use alternate pin mapping
 #define I2C_BUS_RESET           BIT(3)      // Perform a bus reset
+#define I2C_DMA                 BIT(4)      // Use DMA for long messages
+
+/**
+ * Messages at least this long are moved by DMA when the device was
+ * enabled with I2C_DMA.  Must be at least 2.
+ */
+#ifndef I2C_DMA_THRESHOLD
+#define I2C_DMA_THRESHOLD       8
+#endif
 void i2c_master_enable(i2c_dev *dev, uint32 flags);
 
 #define I2C_ERROR_PROTOCOL      (-1)
 #define I2C_ERROR_TIMEOUT       (-2)
 int32 i2c_master_xfer(i2c_dev *dev, i2c_msg *msgs, uint16 num, uint32 timeout);
+void i2c_master_submit(i2c_dev *dev, i2c_xfer *xfer);
+void i2c_check_timeouts(void);
+
+#if I2C_TRACE_SIZE
+extern i2c_trace_buffer i2c_trace_buf;
+extern volatile uint8 i2c_trace_on;
+void i2c_trace_enable(void);
+void i2c_trace_disable(void);
+void i2c_trace_record(i2c_dev *dev, uint8 event, uint32 arg0, uint32 arg1);
+#endif
+
+/**
+ * @brief Returns nonzero if an I2C device has no queued transactions.
+ * @param dev I2C device
+ */
+static inline uint8 i2c_master_is_idle(i2c_dev *dev) {
+    return dev->queue_head == NULL;
+}
+
+/**
+ * @brief Wait for a queued transaction to finish.
+ * @param xfer Transaction submitted with i2c_master_submit()
+ * @return The transaction's result.
+ */
+static inline int32 i2c_xfer_wait(i2c_xfer *xfer) {
+    while (!xfer->done)
+        ;
+    return xfer->result;
+}
 
 void i2c_bus_reset(const i2c_dev *dev);
 
@@ -192,13 +338,19 @@ void i2c_bus_reset(const i2c_dev *dev);
  * @brief Disable an I2C device
  *
  * This function disables the corresponding peripheral and marks dev's
- * state as I2C_STATE_DISABLED.
+ * state as I2C_STATE_DISABLED.  Any DMA channels claimed by
+ * i2c_master_enable() are released.
  *
  * @param dev Device to disable.
  */
 static inline void i2c_disable(i2c_dev *dev) {
     dev->regs->CR1 &= ~I2C_CR1_PE;
     dev->state = I2C_STATE_DISABLED;
+    if (dev->dma_d) {
+        dma_release_channel(dev->dma_d, dev->rx_dma_ch);
+        dma_release_channel(dev->dma_d, dev->tx_dma_ch);
+        dev->dma_d = NULL;
+    }
 }
 
 /**
@@ -193,6 +193,30 @@ static inline void nvic_globalirq_disable() {
     asm volatile("cpsid i");
 }
 
+/**
+ * @brief Disable interrupts, returning the previous PRIMASK value.
+ *
+ * Unlike nvic_globalirq_disable()/nvic_globalirq_enable(), a
+ * nvic_globalirq_save()/nvic_globalirq_restore() pair nests safely,
+ * and may be used from interrupt handlers.
+ *
+ * @see nvic_globalirq_restore()
+ */
+static inline uint32 nvic_globalirq_save(void) {
+    uint32 primask;
+    asm volatile("mrs %0, primask\n\t"
+                 "cpsid i" : "=r" (primask) : : "memory");
+    return primask;
+}
+
+/**
+ * @brief Restore a PRIMASK value returned by nvic_globalirq_save().
+ * @param primask Value to restore.
+ */
+static inline void nvic_globalirq_restore(uint32 primask) {
+    asm volatile("msr primask, %0" : : "r" (primask) : "memory");
+}
+
 /**
  * @brief Enable interrupt irq_num
  * @param irq_num Interrupt to enable
@@ -15,6 +15,7 @@ CFLAGS_$(d) = -I$(d) $(LIBMAPLE_INCLUDES) -Wall -Werror
 
 # Local rules and targets
 cSRCS_$(d) := adc.c                    \
+              adc_filter.c             \
               bkp.c                    \
               dac.c                    \
               dma.c                    \
@@ -31,6 +32,11 @@ cSRCS_$(d) := adc.c                    \
               syscalls.c               \
               systick.c                \
               timer.c                  \
+              timer_capture.c          \
+              timer_chain.c            \
+              timer_encoder.c          \
+              timer_pwm_stream.c       \
+              timer_wheel.c            \
               usart.c                  \
               util.c                   
 
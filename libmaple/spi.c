@@ -192,6 +192,27 @@ void spi_peripheral_disable(spi_dev *dev) {
     bb_peri_set_bit(&dev->regs->CR1, SPI_CR1_SPE_BIT, 0);
 }
 
+/**
+ * @brief Change a SPI peripheral's data frame format.
+ *
+ * The peripheral is briefly disabled if the format changes, so the
+ * bus must be idle (for a master, wait until spi_is_tx_empty() and
+ * !spi_is_busy()).
+ *
+ * @param dev Device whose data frame format to set.
+ * @param dff SPI_DFF_8_BIT or SPI_DFF_16_BIT.
+ * @see spi_dff()
+ */
+void spi_set_dff(spi_dev *dev, spi_cfg_flag dff) {
+    uint32 cr1 = dev->regs->CR1;
+    if ((cr1 & SPI_CR1_DFF) == (uint32)dff) {
+        return;
+    }
+    spi_peripheral_disable(dev);
+    dev->regs->CR1 = (cr1 & ~(SPI_CR1_DFF | SPI_CR1_SPE)) | dff;
+    spi_peripheral_enable(dev);
+}
+
 /**
  * @brief Enable DMA requests whenever the transmit buffer is empty
  * @param dev SPI device on which to enable TX DMA requests
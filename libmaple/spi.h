@@ -304,6 +304,8 @@ void spi_foreach(void (*fn)(spi_dev (*dev)));
 void spi_peripheral_enable(spi_dev *dev);
 void spi_peripheral_disable(spi_dev *dev);
 
+void spi_set_dff(spi_dev *dev, spi_cfg_flag dff);
+
 void spi_tx_dma_enable(spi_dev *dev);
 void spi_tx_dma_disable(spi_dev *dev);
 
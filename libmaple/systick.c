@@ -33,6 +33,7 @@
 
 volatile uint32 systick_uptime_millis;
 static void (*systick_user_callback)(void);
+static void (*systick_timeout_callback)(void);
 
 /**
  * @brief Initialize and enable SysTick.
@@ -75,12 +76,28 @@ void systick_attach_callback(void (*callback)(void)) {
     systick_user_callback = callback;
 }
 
+/**
+ * @brief Attach a driver's timeout check to the SysTick handler.
+ *
+ * Separate from systick_attach_callback(), which is left to the user.
+ * Drivers register here when they are enabled, so that programs not
+ * using them don't pay for the call.  There is room for one.
+ *
+ * @param callback Function to call every millisecond, or NULL.
+ */
+void systick_attach_timeout_callback(void (*callback)(void)) {
+    systick_timeout_callback = callback;
+}
+
 /*
  * SysTick ISR
  */
 
 void __exc_systick(void) {
     systick_uptime_millis++;
+    if (systick_timeout_callback) {
+        systick_timeout_callback();
+    }
     if (systick_user_callback) {
         systick_user_callback();
     }
@@ -88,6 +88,7 @@ static inline uint32 systick_uptime(void) {
 void systick_init(uint32 reload_val);
 void systick_disable();
 void systick_enable();
+void systick_attach_timeout_callback(void (*callback)(void));
 
 /**
  * @brief Returns the current value of the SysTick counter.
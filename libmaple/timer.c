@@ -125,6 +125,7 @@ timer_dev *TIMER8 = &timer8;
 static void disable_channel(timer_dev *dev, uint8 channel);
 static void pwm_mode(timer_dev *dev, uint8 channel);
 static void output_compare_mode(timer_dev *dev, uint8 channel);
+static void input_capture_mode(timer_dev *dev, uint8 channel);
 
 static inline void enable_irq(timer_dev *dev, uint8 interrupt);
 
@@ -187,6 +188,9 @@ void timer_set_mode(timer_dev *dev, uint8 channel, timer_mode mode) {
     case TIMER_OUTPUT_COMPARE:
         output_compare_mode(dev, channel);
         break;
+    case TIMER_INPUT_CAPTURE:
+        input_capture_mode(dev, channel);
+        break;
     }
 }
 
@@ -207,6 +211,87 @@ void timer_foreach(void (*fn)(timer_dev*)) {
 #endif
 }
 
+/**
+ * @brief Set a timer to overflow a given number of times a second.
+ *
+ * Chooses the prescaler and reload value, and generates an update
+ * event so they take effect at once.  The rate is exact if it divides
+ * the timer clock (CLOCK_SPEED_HZ on all timers); otherwise the
+ * closest achievable rate is used.
+ *
+ * @param dev Timer to set.
+ * @param rate Overflows per second, from 1 to CLOCK_SPEED_HZ / 2.  A
+ *             counter must count at least two ticks: with a reload
+ *             value of 0 it stops.
+ * @return The rate actually achieved, rounded to the nearest integer.
+ * @see timer_generate_update()
+ */
+uint32 timer_set_rate(timer_dev *dev, uint32 rate) {
+    uint32 ticks, psc, arr, period;
+
+    ASSERT(rate > 0 && rate <= CLOCK_SPEED_HZ / 2);
+
+    ticks = (CLOCK_SPEED_HZ + rate / 2) / rate;
+    psc = (ticks - 1) / 65536;
+    arr = (ticks + (psc + 1) / 2) / (psc + 1) - 1;
+
+    timer_set_prescaler(dev, psc);
+    timer_set_reload(dev, arr);
+    timer_generate_update(dev);
+
+    period = (psc + 1) * (arr + 1);
+    return (CLOCK_SPEED_HZ + period / 2) / period;
+}
+
+/* DMA request lines for each timer's update event and channels, in
+ * that order; 0 where there is none. */
+static const struct timer_dma_lines {
+    timer_dev **dev;
+    dma_request_line lines[5];
+} timer_dma_lines[] = {
+    {&TIMER1, {DMA_REQ_TIM1_UP, DMA_REQ_TIM1_CH1, DMA_REQ_TIM1_CH2,
+               DMA_REQ_TIM1_CH3, DMA_REQ_TIM1_CH4}},
+    {&TIMER2, {DMA_REQ_TIM2_UP, DMA_REQ_TIM2_CH1, DMA_REQ_TIM2_CH2,
+               DMA_REQ_TIM2_CH3, DMA_REQ_TIM2_CH4}},
+    {&TIMER3, {DMA_REQ_TIM3_UP, DMA_REQ_TIM3_CH1, (dma_request_line)0,
+               DMA_REQ_TIM3_CH3, DMA_REQ_TIM3_CH4}},
+    {&TIMER4, {DMA_REQ_TIM4_UP, DMA_REQ_TIM4_CH1, DMA_REQ_TIM4_CH2,
+               DMA_REQ_TIM4_CH3, (dma_request_line)0}},
+#ifdef STM32_HIGH_DENSITY
+    {&TIMER5, {DMA_REQ_TIM5_UP, DMA_REQ_TIM5_CH1, DMA_REQ_TIM5_CH2,
+               DMA_REQ_TIM5_CH3, DMA_REQ_TIM5_CH4}},
+    {&TIMER6, {DMA_REQ_TIM6_UP}},
+    {&TIMER7, {DMA_REQ_TIM7_UP}},
+    {&TIMER8, {DMA_REQ_TIM8_UP, DMA_REQ_TIM8_CH1, DMA_REQ_TIM8_CH2,
+               DMA_REQ_TIM8_CH3, DMA_REQ_TIM8_CH4}},
+#endif
+};
+
+/**
+ * @brief Get the DMA request line for a timer event.
+ *
+ * Not every channel has one; TIMER3 channel 2 and TIMER4 channel 4
+ * don't.
+ *
+ * @param dev Timer device.
+ * @param channel Channel whose capture/compare event to look up, or
+ *                0 for the update event.
+ * @return The request line, or 0 if there isn't one.
+ * @see dma_request_channel()
+ */
+dma_request_line timer_dma_line(timer_dev *dev, uint8 channel) {
+    uint32 i;
+
+    ASSERT(channel <= 4);
+    for (i = 0; i < sizeof(timer_dma_lines) / sizeof(*timer_dma_lines);
+         i++) {
+        if (*timer_dma_lines[i].dev == dev) {
+            return timer_dma_lines[i].lines[channel];
+        }
+    }
+    return (dma_request_line)0;
+}
+
 /**
  * @brief Attach a timer interrupt.
  * @param dev Timer device
@@ -214,6 +299,14 @@ void timer_foreach(void (*fn)(timer_dev*)) {
  *                  timer_interrupt_id or timer_channel value appropriate
  *                  for the timer.
  * @param handler Handler to attach to the given interrupt.
+ *
+ * The interrupt's flag in the timer's SR register is cleared just
+ * before the handler is called, so the handler can't read it to tell
+ * which interrupt it is serving; attach a separate handler to each
+ * interrupt instead.  If the flag is set again while the handler
+ * runs (e.g. a compare the handler moved matches already), the
+ * handler is called again.  Overcapture flags aren't cleared.
+ *
  * @see timer_interrupt_id
  * @see timer_channel
  */
@@ -250,6 +343,11 @@ static inline void dispatch_adv_cc(timer_dev *dev);
 static inline void dispatch_general(timer_dev *dev);
 static inline void dispatch_basic(timer_dev *dev);
 
+/* Timers whose bits are set in TIMER_DIRECT_IRQS have their IRQ
+ * handlers defined by the application instead; see timer.h. */
+#define DIRECT(n) (TIMER_DIRECT_IRQS & (1 << (n)))
+
+#if !DIRECT(1)
 void __irq_tim1_brk(void) {
     dispatch_adv_brk(TIMER1);
 }
@@ -265,33 +363,47 @@ void __irq_tim1_trg_com(void) {
 void __irq_tim1_cc(void) {
     dispatch_adv_cc(TIMER1);
 }
+#endif
 
+#if !DIRECT(2)
 void __irq_tim2(void) {
     dispatch_general(TIMER2);
 }
+#endif
 
+#if !DIRECT(3)
 void __irq_tim3(void) {
     dispatch_general(TIMER3);
 }
+#endif
 
+#if !DIRECT(4)
 void __irq_tim4(void) {
     dispatch_general(TIMER4);
 }
+#endif
 
 #if defined(STM32_HIGH_DENSITY) || defined(STM32_XL_DENSITY)
 
+#if !DIRECT(5)
 void __irq_tim5(void) {
     dispatch_general(TIMER5);
 }
+#endif
 
+#if !DIRECT(6)
 void __irq_tim6(void) {
     dispatch_basic(TIMER6);
 }
+#endif
 
+#if !DIRECT(7)
 void __irq_tim7(void) {
     dispatch_basic(TIMER7);
 }
+#endif
 
+#if !DIRECT(8)
 void __irq_tim8_brk(void) {
     dispatch_adv_brk(TIMER8);
 }
@@ -308,6 +420,7 @@ void __irq_tim8_cc(void) {
     dispatch_adv_cc(TIMER8);
 }
 #endif
+#endif
 
 /* Note: the following dispatch routines make use of the fact that
  * DIER interrupt enable bits and SR interrupt flags have common bit
@@ -317,28 +430,40 @@ void __irq_tim8_cc(void) {
 
 /* A special-case dispatch routine for single-interrupt NVIC lines.
  * This function assumes that the interrupt corresponding to `iid' has
- * in fact occurred (i.e., it doesn't check DIER & SR). */
+ * in fact occurred (i.e., it doesn't check DIER & SR).  The flag is
+ * cleared before the handler runs, so that if it is set again
+ * meanwhile, the interrupt comes back rather than being lost. */
 static inline void dispatch_single_irq(timer_dev *dev,
                                        timer_interrupt_id iid,
                                        uint32 irq_mask) {
     timer_bas_reg_map *regs = (dev->regs).bas;
     void (*handler)(void) = dev->handlers[iid];
     if (handler) {
+        regs->SR = ~irq_mask;
         handler();
-        regs->SR &= ~irq_mask;
     }
 }
 
-/* For dispatch routines which service multiple interrupts. */
-#define handle_irq(dier_sr, irq_mask, handlers, iid, handled_irq) do {  \
-        if ((dier_sr) & (irq_mask)) {                                   \
-            void (*__handler)(void) = (handlers)[iid];                  \
-            if (__handler) {                                            \
-                __handler();                                            \
-                handled_irq |= (irq_mask);                              \
-            }                                                           \
-        }                                                               \
-    } while (0)
+/* For dispatch routines which service multiple interrupts.  Calls
+ * the handlers for the interrupts set in dsr, highest bit first,
+ * finding each with a count leading zeros rather than testing every
+ * flag.  Each flag is cleared just before its handler is called, as
+ * in dispatch_single_irq().  User handlers must clear overcapture
+ * flags, to avoid wasting time in output mode. */
+static inline void dispatch_flags(timer_dev *dev, uint32 dsr) {
+    void (**hs)(void) = dev->handlers;
+
+    while (dsr) {
+        uint32 iid = 31 - __builtin_clz(dsr);
+        uint32 irq_mask = BIT(iid);
+
+        dsr &= ~irq_mask;
+        if (hs[iid]) {
+            (dev->regs).gen->SR = ~irq_mask;
+            hs[iid]();
+        }
+    }
+}
 
 static inline void dispatch_adv_brk(timer_dev *dev) {
     dispatch_single_irq(dev, TIMER_BREAK_INTERRUPT, TIMER_SR_BIF);
@@ -351,46 +476,25 @@ static inline void dispatch_adv_up(timer_dev *dev) {
 static inline void dispatch_adv_trg_com(timer_dev *dev) {
     timer_adv_reg_map *regs = (dev->regs).adv;
     uint32 dsr = regs->DIER & regs->SR;
-    void (**hs)(void) = dev->handlers;
-    uint32 handled = 0; /* Logical OR of SR interrupt flags we end up
-                         * handling.  We clear these.  User handlers
-                         * must clear overcapture flags, to avoid
-                         * wasting time in output mode. */
-
-    handle_irq(dsr, TIMER_SR_TIF,   hs, TIMER_TRG_INTERRUPT, handled);
-    handle_irq(dsr, TIMER_SR_COMIF, hs, TIMER_COM_INTERRUPT, handled);
 
-    regs->SR &= ~handled;
+    dispatch_flags(dev, dsr & (TIMER_SR_TIF | TIMER_SR_COMIF));
 }
 
 static inline void dispatch_adv_cc(timer_dev *dev) {
     timer_adv_reg_map *regs = (dev->regs).adv;
     uint32 dsr = regs->DIER & regs->SR;
-    void (**hs)(void) = dev->handlers;
-    uint32 handled = 0;
 
-    handle_irq(dsr, TIMER_SR_CC4IF, hs, TIMER_CC4_INTERRUPT, handled);
-    handle_irq(dsr, TIMER_SR_CC3IF, hs, TIMER_CC3_INTERRUPT, handled);
-    handle_irq(dsr, TIMER_SR_CC2IF, hs, TIMER_CC2_INTERRUPT, handled);
-    handle_irq(dsr, TIMER_SR_CC1IF, hs, TIMER_CC1_INTERRUPT, handled);
-
-    regs->SR &= ~handled;
+    dispatch_flags(dev, dsr & (TIMER_SR_CC4IF | TIMER_SR_CC3IF |
+                               TIMER_SR_CC2IF | TIMER_SR_CC1IF));
 }
 
 static inline void dispatch_general(timer_dev *dev) {
     timer_gen_reg_map *regs = (dev->regs).gen;
     uint32 dsr = regs->DIER & regs->SR;
-    void (**hs)(void) = dev->handlers;
-    uint32 handled = 0;
 
-    handle_irq(dsr, TIMER_SR_TIF,   hs, TIMER_TRG_INTERRUPT,    handled);
-    handle_irq(dsr, TIMER_SR_CC4IF, hs, TIMER_CC4_INTERRUPT,    handled);
-    handle_irq(dsr, TIMER_SR_CC3IF, hs, TIMER_CC3_INTERRUPT,    handled);
-    handle_irq(dsr, TIMER_SR_CC2IF, hs, TIMER_CC2_INTERRUPT,    handled);
-    handle_irq(dsr, TIMER_SR_CC1IF, hs, TIMER_CC1_INTERRUPT,    handled);
-    handle_irq(dsr, TIMER_SR_UIF,   hs, TIMER_UPDATE_INTERRUPT, handled);
-
-    regs->SR &= ~handled;
+    dispatch_flags(dev, dsr & (TIMER_SR_TIF | TIMER_SR_CC4IF |
+                               TIMER_SR_CC3IF | TIMER_SR_CC2IF |
+                               TIMER_SR_CC1IF | TIMER_SR_UIF));
 }
 
 static inline void dispatch_basic(timer_dev *dev) {
@@ -417,6 +521,13 @@ static void output_compare_mode(timer_dev *dev, uint8 channel) {
     timer_cc_enable(dev, channel);
 }
 
+static void input_capture_mode(timer_dev *dev, uint8 channel) {
+    timer_cc_disable(dev, channel);
+    timer_ic_set_mode(dev, channel, TIMER_IC_INPUT_DEFAULT, 0);
+    timer_cc_set_pol(dev, channel, 0);
+    timer_cc_enable(dev, channel);
+}
+
 static void enable_advanced_irq(timer_dev *dev, timer_interrupt_id id);
 static void enable_nonmuxed_irq(timer_dev *dev);
 
@@ -39,6 +39,7 @@
 #include "rcc.h"
 #include "nvic.h"
 #include "bitband.h"
+#include "dma.h"
 
 #ifdef __cplusplus
 extern "C"{
@@ -256,9 +257,9 @@ extern timer_dev *TIMER8;
 #define TIMER_SMCR_ETPS_DIV2            (0x1 << 12)
 #define TIMER_SMCR_ETPS_DIV4            (0x2 << 12)
 #define TIMER_SMCR_ETPS_DIV8            (0x3 << 12)
-#define TIMER_SMCR_ETF                  (0xF << 12)
+#define TIMER_SMCR_ETF                  (0xF << 8)
 #define TIMER_SMCR_MSM                  BIT(TIMER_SMCR_MSM_BIT)
-#define TIMER_SMCR_TS                   (0x3 << 4)
+#define TIMER_SMCR_TS                   (0x7 << 4)
 #define TIMER_SMCR_TS_ITR0              (0x0 << 4)
 #define TIMER_SMCR_TS_ITR1              (0x1 << 4)
 #define TIMER_SMCR_TS_ITR2              (0x2 << 4)
@@ -267,7 +268,7 @@ extern timer_dev *TIMER8;
 #define TIMER_SMCR_TS_TI1FP1            (0x5 << 4)
 #define TIMER_SMCR_TS_TI2FP2            (0x6 << 4)
 #define TIMER_SMCR_TS_ETRF              (0x7 << 4)
-#define TIMER_SMCR_SMS                  0x3
+#define TIMER_SMCR_SMS                  0x7
 #define TIMER_SMCR_SMS_DISABLED         0x0
 #define TIMER_SMCR_SMS_ENCODER1         0x1
 #define TIMER_SMCR_SMS_ENCODER2         0x2
@@ -513,7 +514,7 @@ extern timer_dev *TIMER8;
  * Used to configure the behavior of a timer channel.  Note that not
  * all timers can be configured in every mode.
  */
-/* TODO TIMER_PWM_CENTER_ALIGNED, TIMER_INPUT_CAPTURE, TIMER_ONE_PULSE */
+/* TODO TIMER_PWM_CENTER_ALIGNED, TIMER_ONE_PULSE */
 typedef enum timer_mode {
     TIMER_DISABLED, /**< In this mode, the timer stops counting,
                          channel interrupts are detached, and no state
@@ -526,8 +527,11 @@ typedef enum timer_mode {
                                time the counter value reaches one of
                                the channel compare values, the
                                corresponding interrupt is fired. */
-    /* TIMER_INPUT_CAPTURE, /\**< In this mode, the timer can measure the */
-    /*                           pulse lengths of input signals. *\/ */
+    TIMER_INPUT_CAPTURE, /**< In this mode, the channel latches the
+                              counter on each rising edge of its input
+                              pin, and the corresponding interrupt is
+                              fired.  See timer_capture.h for a fuller
+                              capture API. */
     /* TIMER_ONE_PULSE /\**< In this mode, the timer can generate a single */
     /*                      pulse on a GPIO pin for a specified amount of */
     /*                      time. *\/ */
@@ -551,10 +555,31 @@ typedef enum timer_channel {
  * without the compiler yelling at us.
  */
 
+/**
+ * @brief Timers whose IRQ handlers the application defines itself.
+ *
+ * Bit n set means libmaple doesn't define TIMERn's IRQ handlers
+ * (__irq_timn(), or __irq_timn_brk(), __irq_timn_up(),
+ * __irq_timn_trg_com() and __irq_timn_cc() for advanced timers), so
+ * the application's own definitions go straight into the vector
+ * table, with no dispatch table in between.  Such a handler must
+ * clear the interrupt flags itself, e.g. with
+ * TIMER2_BASE->SR = ~TIMER_SR_UIF.  timer_attach_interrupt() still
+ * enables the interrupt, but the handler it is given is never called.
+ *
+ * Must be the same for libmaple and the application; set it with e.g.
+ * "make TIMER_DIRECT_IRQS=0x4" for TIMER2.  See notes/timers.txt.
+ */
+#ifndef TIMER_DIRECT_IRQS
+#define TIMER_DIRECT_IRQS 0
+#endif
+
 void timer_init(timer_dev *dev);
 void timer_disable(timer_dev *dev);
 void timer_set_mode(timer_dev *dev, uint8 channel, timer_mode mode);
 void timer_foreach(void (*fn)(timer_dev*));
+uint32 timer_set_rate(timer_dev *dev, uint32 rate);
+dma_request_line timer_dma_line(timer_dev *dev, uint8 channel);
 
 /**
  * @brief Timer interrupt number.
@@ -725,6 +750,39 @@ static inline void timer_generate_update(timer_dev *dev) {
     *bb_perip(&(dev->regs).bas->EGR, TIMER_EGR_UG_BIT) = 1;
 }
 
+/**
+ * @brief Timer master mode: what the timer sends out as TRGO.
+ *
+ * TRGO can trigger other timers (as their ITR input), the ADCs, and
+ * the DAC.
+ *
+ * @see timer_set_master_mode()
+ */
+typedef enum timer_master_mode {
+    TIMER_MMS_RESET = TIMER_CR2_MMS_RESET, /**< UG bit */
+    TIMER_MMS_ENABLE = TIMER_CR2_MMS_ENABLE, /**< Counter enable */
+    TIMER_MMS_UPDATE = TIMER_CR2_MMS_UPDATE, /**< Update event */
+    TIMER_MMS_COMPARE_PULSE = TIMER_CR2_MMS_COMPARE_PULSE, /**< CC1 match
+                                                                or capture */
+    TIMER_MMS_OC1REF = TIMER_CR2_MMS_COMPARE_OC1REF, /**< OC1REF */
+    TIMER_MMS_OC2REF = TIMER_CR2_MMS_COMPARE_OC2REF, /**< OC2REF */
+    TIMER_MMS_OC3REF = TIMER_CR2_MMS_COMPARE_OC3REF, /**< OC3REF */
+    TIMER_MMS_OC4REF = TIMER_CR2_MMS_COMPARE_OC4REF  /**< OC4REF */
+} timer_master_mode;
+
+/**
+ * @brief Set a timer's master mode.
+ * @param dev Timer device.
+ * @param mode Event to output as TRGO.
+ */
+static inline void timer_set_master_mode(timer_dev *dev,
+                                         timer_master_mode mode) {
+    uint32 cr2 = (dev->regs).bas->CR2;
+    cr2 &= ~TIMER_CR2_MMS;
+    cr2 |= mode;
+    (dev->regs).bas->CR2 = cr2;
+}
+
 /**
  * @brief Enable a timer's trigger DMA request
  * @param dev Timer device, must have type TIMER_ADVANCED or TIMER_GENERAL
@@ -843,18 +901,18 @@ static inline void timer_cc_set_pol(timer_dev *dev, uint8 channel, uint8 pol) {
 /**
  * @brief Get a timer's DMA burst length.
  * @param dev Timer device, must have type TIMER_ADVANCED or TIMER_GENERAL.
- * @return Number of bytes to be transferred per DMA request, from 1 to 18.
+ * @return Number of transfers per DMA request, from 1 to 18.
  */
 static inline uint8 timer_dma_get_burst_len(timer_dev *dev) {
     uint32 dbl = ((dev->regs).gen->DCR & TIMER_DCR_DBL) >> 8;
-    return dbl + 1;             /* 0 means 1 byte, etc. */
+    return dbl + 1;             /* 0 means 1 transfer, etc. */
 }
 
 /**
  * @brief Set a timer's DMA burst length.
  * @param dev Timer device, must have type TIMER_ADVANCED or TIMER_GENERAL.
- * @param length DMA burst length; i.e., number of bytes to transfer
- *               per DMA request, from 1 to 18.
+ * @param length DMA burst length; i.e., number of transfers (to
+ *               consecutive registers) per DMA request, from 1 to 18.
  */
 static inline void timer_dma_set_burst_len(timer_dev *dev, uint8 length) {
     uint32 tmp = (dev->regs).gen->DCR;
@@ -1005,6 +1063,50 @@ static inline void timer_oc_set_mode(timer_dev *dev,
     *ccmr = tmp;
 }
 
+/**
+ * @brief Input capture input selection.
+ * @see timer_ic_set_mode()
+ */
+typedef enum timer_ic_input_select {
+    /** The channel's own input: TI1 for channel 1, TI2 for channel 2,
+     *  and so on. */
+    TIMER_IC_INPUT_DEFAULT = TIMER_CCMR_CCS_INPUT_TI1,
+    /** The paired channel's input: TI2 for channel 1, TI1 for channel
+     *  2, TI4 for channel 3, TI3 for channel 4. */
+    TIMER_IC_INPUT_SWITCH = TIMER_CCMR_CCS_INPUT_TI2,
+    /** The trigger input selected in the slave mode controller. */
+    TIMER_IC_INPUT_TRC = TIMER_CCMR_CCS_INPUT_TRC
+} timer_ic_input_select;
+
+/**
+ * @brief Configure a channel for input capture.
+ *
+ * The capture prescaler is cleared, so every edge is captured.  Use
+ * timer_cc_set_pol() to choose the edge (0 for rising, 1 for
+ * falling), and timer_cc_enable() to start capturing.
+ *
+ * @param dev Timer device, must have type TIMER_ADVANCED or TIMER_GENERAL.
+ * @param channel Channel to configure in input capture mode.
+ * @param input Input to capture from.
+ * @param filter Input filter, from 0 (none) to 15; see the ICxF field
+ *               description in RM0008.  Pulses shorter than the filter
+ *               length are ignored.
+ * @see timer_ic_input_select
+ */
+static inline void timer_ic_set_mode(timer_dev *dev,
+                                     uint8 channel,
+                                     timer_ic_input_select input,
+                                     uint8 filter) {
+    /* Same layout as timer_oc_set_mode() */
+    __io uint32 *ccmr = &(dev->regs).gen->CCMR1 + (((channel - 1) >> 1) & 1);
+    uint8 shift = 8 * (1 - (channel & 1));
+
+    uint32 tmp = *ccmr;
+    tmp &= ~(0xFF << shift);
+    tmp |= (input | ((filter & 0xF) << 4)) << shift;
+    *ccmr = tmp;
+}
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,492 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Copyright (c) 2011 LeafLabs, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file timer_capture.c
+ * @brief Timer input capture engine.
+ */
+
+#include "libmaple.h"
+#include "timer_capture.h"
+
+/* Internal flag: cap->last holds a timestamp. */
+#define TIMER_CAPTURE_HAVE_LAST BIT(7)
+
+#ifdef STM32_HIGH_DENSITY
+#define NR_CAPTURE_TIMERS 8
+#else
+#define NR_CAPTURE_TIMERS 4
+#endif
+
+/*
+ * Interrupt mode state.  Timer handlers take no arguments, so each
+ * timer gets its own pair of trampolines into the shared handlers,
+ * which find their state here.
+ */
+
+static struct capture_timer {
+    volatile uint32 overflows;
+    timer_capture *caps[4];     /* Interrupt mode captures, by channel */
+} capture_timers[NR_CAPTURE_TIMERS];
+
+static int capture_timer_index(timer_dev *dev) {
+    if (dev == TIMER1) return 0;
+    if (dev == TIMER2) return 1;
+    if (dev == TIMER3) return 2;
+    if (dev == TIMER4) return 3;
+#ifdef STM32_HIGH_DENSITY
+    if (dev == TIMER5) return 4;
+    if (dev == TIMER6) return 5;
+    if (dev == TIMER7) return 6;
+    if (dev == TIMER8) return 7;
+#endif
+    return -1;
+}
+
+static void capture_update(int index) {
+    capture_timers[index].overflows++;
+}
+
+/* The dispatcher has already cleared CCxIF, so this is only called
+ * for a channel with a fresh capture. */
+static void capture_cc(int index, timer_dev *dev, uint8 ch) {
+    struct capture_timer *ct = &capture_timers[index];
+    timer_capture *cap = ct->caps[ch - 1];
+    timer_gen_reg_map *regs = dev->regs.gen;
+    uint32 ovf = ct->overflows;
+    uint16 value, next;
+
+    if (!cap) {
+        return;
+    }
+
+    value = (uint16)*(&regs->CCR1 + (ch - 1));
+    /* If the counter wrapped but the update interrupt hasn't run
+     * yet, a capture just after the wrap needs its overflow. */
+    if ((regs->SR & TIMER_SR_UIF) && value < 0x8000) {
+        ovf++;
+    }
+    if (regs->SR & (TIMER_SR_CC1OF << (ch - 1))) {
+        regs->SR = ~(TIMER_SR_CC1OF << (ch - 1));
+        cap->dropped++;
+    }
+
+    next = cap->head + 1;
+    if (next == cap->size) {
+        next = 0;
+    }
+    if (next == cap->tail) {
+        cap->dropped++;
+        return;
+    }
+    cap->ring[cap->head] = (ovf << 16) | value;
+    cap->head = next;
+}
+
+#define CAPTURE_TRAMPOLINES(n, timer)                                   \
+    static void capture_update_##n(void) { capture_update(n); }         \
+    static void capture_cc1_##n(void) { capture_cc(n, timer, 1); }      \
+    static void capture_cc2_##n(void) { capture_cc(n, timer, 2); }      \
+    static void capture_cc3_##n(void) { capture_cc(n, timer, 3); }      \
+    static void capture_cc4_##n(void) { capture_cc(n, timer, 4); }
+
+#define CAPTURE_HANDLERS(n)                                             \
+    {capture_update_##n,                                                \
+     {capture_cc1_##n, capture_cc2_##n, capture_cc3_##n, capture_cc4_##n}}
+
+CAPTURE_TRAMPOLINES(0, TIMER1)
+CAPTURE_TRAMPOLINES(1, TIMER2)
+CAPTURE_TRAMPOLINES(2, TIMER3)
+CAPTURE_TRAMPOLINES(3, TIMER4)
+#ifdef STM32_HIGH_DENSITY
+CAPTURE_TRAMPOLINES(4, TIMER5)
+CAPTURE_TRAMPOLINES(5, TIMER6)
+CAPTURE_TRAMPOLINES(6, TIMER7)
+CAPTURE_TRAMPOLINES(7, TIMER8)
+#endif
+
+static const struct {
+    voidFuncPtr update;
+    voidFuncPtr cc[4];          /* By channel */
+} capture_handlers[NR_CAPTURE_TIMERS] = {
+    CAPTURE_HANDLERS(0),
+    CAPTURE_HANDLERS(1),
+    CAPTURE_HANDLERS(2),
+    CAPTURE_HANDLERS(3),
+#ifdef STM32_HIGH_DENSITY
+    CAPTURE_HANDLERS(4),
+    CAPTURE_HANDLERS(5),
+    CAPTURE_HANDLERS(6),
+    CAPTURE_HANDLERS(7),
+#endif
+};
+
+/*
+ * Capture rings
+ */
+
+static int capture_start_irq(timer_capture *cap, int index) {
+    timer_dev *dev = cap->dev;
+    voidFuncPtr update = capture_handlers[index].update;
+
+    if (dev->handlers[TIMER_UPDATE_INTERRUPT] &&
+        dev->handlers[TIMER_UPDATE_INTERRUPT] != update) {
+        return TIMER_CAPTURE_ERROR_BUSY;
+    }
+    capture_timers[index].caps[cap->channel - 1] = cap;
+    if (!dev->handlers[TIMER_UPDATE_INTERRUPT]) {
+        capture_timers[index].overflows = 0;
+        timer_attach_interrupt(dev, TIMER_UPDATE_INTERRUPT, update);
+    }
+    timer_attach_interrupt(dev, cap->channel,
+                           capture_handlers[index].cc[cap->channel - 1]);
+    return 0;
+}
+
+static int capture_start_dma(timer_capture *cap) {
+    dma_request_line line = timer_dma_line(cap->dev, cap->channel);
+    dma_xfer xfer;
+    int rc;
+
+    if (!line) {
+        return TIMER_CAPTURE_ERROR_NO_DMA;
+    }
+    rc = dma_request_channel(line, DMA_PRIORITY_HIGH, "timer capture",
+                             &cap->dma_d, &cap->dma_ch);
+    if (rc < 0) {
+        return rc;
+    }
+
+    /* Each 16-bit capture is zero-extended into a 32-bit slot. */
+    xfer.peripheral_address = &cap->dev->regs.gen->CCR1 + (cap->channel - 1);
+    xfer.peripheral_size = DMA_SIZE_16BITS;
+    xfer.memory_address = cap->ring;
+    xfer.memory_size = DMA_SIZE_32BITS;
+    xfer.num_transfers = cap->size;
+    xfer.mode = DMA_MINC_MODE | DMA_CIRC_MODE;
+    xfer.priority = DMA_PRIORITY_HIGH;
+    xfer.callback = NULL;
+    xfer.arg = NULL;
+    rc = dma_queue_xfer(cap->dma_d, cap->dma_ch, &xfer);
+    if (rc < 0) {
+        dma_release_channel(cap->dma_d, cap->dma_ch);
+        return rc;
+    }
+    timer_dma_enable_req(cap->dev, cap->channel);
+    return 0;
+}
+
+/**
+ * @brief Start timestamping edges on a timer channel's input.
+ *
+ * The timer must count through all 16 bits, so its reload value is
+ * set to 0xFFFF, and it is started if it was paused.  Its prescaler
+ * is left alone; set it first to choose the timestamp resolution.
+ * Other channels of the timer can capture at the same time, but not
+ * generate PWM.
+ *
+ * In DMA mode, the timestamps are 16 bits, and are extended to 32 as
+ * they are read, on the assumption that successive edges are less
+ * than 65536 ticks apart.  The ring must be read at least once every
+ * size edges, or it is silently overwritten.
+ *
+ * With TIMER_CAPTURE_IRQ, each edge is timestamped by the capture
+ * interrupt, with the timer's overflow count as the top 16 bits, so
+ * edges can be any distance apart.  Edges that find the ring full are
+ * counted in cap->dropped, as are those lost because an edge came
+ * before the previous one was handled.
+ *
+ * @param cap Capture state; ring and size must be filled in.
+ * @param dev Timer device, general purpose or advanced.
+ * @param channel Channel whose input to capture, from 1 to 4.
+ * @param flags TIMER_CAPTURE_FALLING and/or TIMER_CAPTURE_IRQ, or 0.
+ * @param filter Input filter, as for timer_ic_set_mode().
+ * @return 0 on success, TIMER_CAPTURE_ERROR_NO_DMA if the channel
+ *         can't use DMA, TIMER_CAPTURE_ERROR_BUSY if the timer's
+ *         update interrupt is in use by something else (interrupt
+ *         mode), or a negative DMA error.
+ * @see timer_capture_read()
+ * @see timer_capture_stats_read()
+ */
+int timer_capture_start(timer_capture *cap,
+                        timer_dev *dev,
+                        uint8 channel,
+                        uint8 flags,
+                        uint8 filter) {
+    int index = capture_timer_index(dev);
+    int rc;
+
+    ASSERT(dev->type != TIMER_BASIC && index >= 0);
+    ASSERT(channel >= 1 && channel <= 4);
+    ASSERT(cap->size >= 2);
+
+    cap->dev = dev;
+    cap->channel = channel;
+    cap->flags = flags & (TIMER_CAPTURE_FALLING | TIMER_CAPTURE_IRQ);
+    cap->head = 0;
+    cap->tail = 0;
+    cap->last = 0;
+    cap->dropped = 0;
+
+    timer_cc_disable(dev, channel);
+    timer_ic_set_mode(dev, channel, TIMER_IC_INPUT_DEFAULT, filter);
+    timer_cc_set_pol(dev, channel, !!(flags & TIMER_CAPTURE_FALLING));
+    timer_set_reload(dev, 0xFFFF);
+
+    if (flags & TIMER_CAPTURE_IRQ) {
+        rc = capture_start_irq(cap, index);
+    } else {
+        rc = capture_start_dma(cap);
+    }
+    if (rc < 0) {
+        return rc;
+    }
+
+    timer_cc_enable(dev, channel);
+    timer_resume(dev);
+    return 0;
+}
+
+/**
+ * @brief Stop capturing.
+ *
+ * Timestamps still in the ring can be read afterwards.  The timer
+ * keeps running.
+ *
+ * @param cap Capture started with timer_capture_start().
+ */
+void timer_capture_stop(timer_capture *cap) {
+    timer_dev *dev = cap->dev;
+
+    timer_cc_disable(dev, cap->channel);
+    if (cap->flags & TIMER_CAPTURE_IRQ) {
+        struct capture_timer *ct =
+            &capture_timers[capture_timer_index(dev)];
+        uint8 ch;
+
+        timer_detach_interrupt(dev, cap->channel);
+        ct->caps[cap->channel - 1] = NULL;
+        for (ch = 0; ch < 4 && !ct->caps[ch]; ch++)
+            ;
+        if (ch == 4) {
+            timer_detach_interrupt(dev, TIMER_UPDATE_INTERRUPT);
+        }
+    } else {
+        timer_dma_disable_req(dev, cap->channel);
+        /* Freeze the DMA write position for later reads. */
+        cap->head = cap->size - dma_channel_regs(cap->dma_d,
+                                                 cap->dma_ch)->CNDTR;
+        if (cap->head == cap->size) {
+            cap->head = 0;
+        }
+        dma_release_channel(cap->dma_d, cap->dma_ch);
+        cap->dma_d = NULL;
+    }
+}
+
+static uint16 capture_head(timer_capture *cap) {
+    uint16 head;
+
+    if ((cap->flags & TIMER_CAPTURE_IRQ) || !cap->dma_d) {
+        return cap->head;
+    }
+    head = cap->size - dma_channel_regs(cap->dma_d, cap->dma_ch)->CNDTR;
+    return head == cap->size ? 0 : head;
+}
+
+/**
+ * @brief Number of timestamps waiting to be read.
+ * @param cap Capture state.
+ */
+uint16 timer_capture_available(timer_capture *cap) {
+    uint16 head = capture_head(cap);
+    return head >= cap->tail ? head - cap->tail : head + cap->size - cap->tail;
+}
+
+/**
+ * @brief Read timestamps from the ring.
+ * @param cap Capture state.
+ * @param times Where to put the timestamps, oldest first, in ticks
+ *              since the timer started (modulo 2^32).
+ * @param max Most timestamps to read.
+ * @return Number of timestamps read.
+ */
+uint16 timer_capture_read(timer_capture *cap, uint32 *times, uint16 max) {
+    uint16 head = capture_head(cap);
+    uint16 tail = cap->tail;
+    uint16 n = 0;
+
+    while (tail != head && n < max) {
+        uint32 raw = cap->ring[tail];
+        uint32 t;
+
+        if ((cap->flags & TIMER_CAPTURE_IRQ) ||
+            !(cap->flags & TIMER_CAPTURE_HAVE_LAST)) {
+            t = raw;
+        } else {
+            t = cap->last + ((raw - cap->last) & 0xFFFF);
+        }
+        cap->last = t;
+        cap->flags |= TIMER_CAPTURE_HAVE_LAST;
+        times[n++] = t;
+
+        if (++tail == cap->size) {
+            tail = 0;
+        }
+    }
+    cap->tail = tail;
+    return n;
+}
+
+/**
+ * @brief Consume the ring's timestamps and compute statistics.
+ *
+ * Intervals are measured between successive edges, including from
+ * the last edge consumed by a previous read.
+ *
+ * @param cap Capture state.
+ * @param stats Filled in with the statistics.  All zero if there were
+ *              no intervals to measure.
+ * @return Number of timestamps consumed.
+ */
+uint16 timer_capture_stats_read(timer_capture *cap,
+                                timer_capture_stats *stats) {
+    uint32 times[16];
+    uint64 sum = 0;
+    uint64 mhz;
+    uint32 intervals = 0;
+    uint16 total = 0;
+    uint16 n;
+
+    stats->min_period = 0xFFFFFFFF;
+    stats->max_period = 0;
+    do {
+        uint8 had_last = !!(cap->flags & TIMER_CAPTURE_HAVE_LAST);
+        uint32 prev = cap->last;
+        uint16 i;
+
+        n = timer_capture_read(cap, times, 16);
+        for (i = 0; i < n; i++) {
+            if (i > 0 || had_last) {
+                uint32 period = times[i] - prev;
+                if (period < stats->min_period) {
+                    stats->min_period = period;
+                }
+                if (period > stats->max_period) {
+                    stats->max_period = period;
+                }
+                sum += period;
+                intervals++;
+            }
+            prev = times[i];
+        }
+        total += n;
+    } while (n == 16);
+
+    stats->edges = total;
+    if (intervals == 0) {
+        stats->min_period = 0;
+        stats->mean_period = 0;
+        stats->millihertz = 0;
+        return total;
+    }
+    stats->mean_period = (uint32)((sum + intervals / 2) / intervals);
+    /* Edges less than a tick apart give sum == 0. */
+    mhz = 0xFFFFFFFF;
+    if (sum > 0) {
+        mhz = ((uint64)timer_capture_tick_hz(cap->dev) * 1000 * intervals +
+               sum / 2) / sum;
+    }
+    stats->millihertz = mhz > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32)mhz;
+    return total;
+}
+
+/*
+ * PWM input mode
+ */
+
+/**
+ * @brief Measure a PWM signal's period and duty cycle in hardware.
+ *
+ * The signal goes to the timer's channel 1 pin.  Each rising edge
+ * captures the period into channel 1 and resets the counter (slave
+ * reset mode on TI1FP1); each falling edge captures the pulse width
+ * into channel 2.  No interrupts or DMA are involved; read the results
+ * whenever convenient.
+ *
+ * The timer is taken over entirely.  Its prescaler is left alone, and
+ * must be set so the period fits in 16 bits.
+ *
+ * @param dev Timer device, general purpose or advanced.
+ * @param filter Input filter, as for timer_ic_set_mode().
+ * @see timer_pwm_input_period()
+ * @see timer_pwm_input_width()
+ * @see timer_pwm_input_duty()
+ */
+void timer_pwm_input_start(timer_dev *dev, uint8 filter) {
+    timer_gen_reg_map *regs = dev->regs.gen;
+
+    ASSERT(dev->type != TIMER_BASIC);
+
+    timer_pause(dev);
+    timer_cc_disable(dev, 1);
+    timer_cc_disable(dev, 2);
+    timer_set_reload(dev, 0xFFFF);
+    timer_ic_set_mode(dev, 1, TIMER_IC_INPUT_DEFAULT, filter);
+    timer_cc_set_pol(dev, 1, 0);
+    timer_ic_set_mode(dev, 2, TIMER_IC_INPUT_SWITCH, filter);
+    timer_cc_set_pol(dev, 2, 1);
+    regs->SMCR = TIMER_SMCR_TS_TI1FP1 | TIMER_SMCR_SMS_RESET;
+    timer_cc_enable(dev, 1);
+    timer_cc_enable(dev, 2);
+    timer_resume(dev);
+}
+
+/**
+ * @brief Leave PWM input mode.
+ * @param dev Timer started with timer_pwm_input_start().
+ */
+void timer_pwm_input_stop(timer_dev *dev) {
+    timer_cc_disable(dev, 1);
+    timer_cc_disable(dev, 2);
+    dev->regs.gen->SMCR = 0;
+}
+
+/**
+ * @brief Duty cycle measured in PWM input mode.
+ * @param dev Timer in PWM input mode.
+ * @return Pulse width as a fraction of the period, in hundredths of a
+ *         percent (0 to 10000), or 0 if no period has been measured.
+ */
+uint32 timer_pwm_input_duty(timer_dev *dev) {
+    uint32 period = timer_pwm_input_period(dev);
+    uint32 width = timer_pwm_input_width(dev);
+
+    if (period == 0) {
+        return 0;
+    }
+    return (width * 10000 + period / 2) / period;
+}
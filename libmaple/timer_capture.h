@@ -0,0 +1,164 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Copyright (c) 2011 LeafLabs, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file timer_capture.h
+ * @brief Timer input capture engine.
+ *
+ * Timestamps edges on a timer channel's input pin into a ring, either
+ * by DMA (fast, 16-bit timestamps extended in software) or by
+ * interrupt (slower, with 32-bit timestamps extended by counting
+ * overflows), and computes frequency and pulse train statistics from
+ * them.  Also supports PWM input mode, which measures period and duty
+ * cycle in hardware.
+ */
+
+#ifndef _TIMER_CAPTURE_H_
+#define _TIMER_CAPTURE_H_
+
+#include "timer.h"
+#include "dma.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * Capture rings
+ */
+
+/**
+ * @brief Input capture state for one timer channel.
+ *
+ * The caller fills in ring and size, then calls timer_capture_start().
+ * Timestamps are in timer ticks; see timer_capture_tick_hz().
+ */
+typedef struct timer_capture {
+    uint32 *ring;               /**< Timestamp ring; caller allocated */
+    uint16 size;                /**< Ring size, in timestamps */
+
+    timer_dev *dev;             /**< For internal use */
+    uint8 channel;              /**< For internal use */
+    uint8 flags;                /**< For internal use */
+    dma_dev *dma_d;             /**< For internal use */
+    dma_channel dma_ch;         /**< For internal use */
+    volatile uint16 head;       /**< Next slot written (interrupt mode) */
+    uint16 tail;                /**< Next slot read */
+    uint32 last;                /**< Last timestamp read, extended */
+    volatile uint32 dropped;    /**< Edges lost to a full ring or
+                                     overcapture (interrupt mode) */
+} timer_capture;
+
+/* timer_capture_start() flags */
+
+/** Capture falling edges instead of rising edges. */
+#define TIMER_CAPTURE_FALLING   BIT(0)
+
+/**
+ * Capture by interrupt instead of DMA, extending each timestamp to 32
+ * bits with a count of timer overflows.  Handles any interval between
+ * edges, but each edge costs an interrupt.
+ */
+#define TIMER_CAPTURE_IRQ       BIT(1)
+
+/** timer_capture_start() error: the channel has no DMA request line
+ *  (TIMER3 channel 2, TIMER4 channel 4).  Use TIMER_CAPTURE_IRQ. */
+#define TIMER_CAPTURE_ERROR_NO_DMA      (-8)
+
+/** timer_capture_start() error: another capture is using the timer
+ *  in a different mode. */
+#define TIMER_CAPTURE_ERROR_BUSY        (-9)
+
+int timer_capture_start(timer_capture *cap,
+                        timer_dev *dev,
+                        uint8 channel,
+                        uint8 flags,
+                        uint8 filter);
+void timer_capture_stop(timer_capture *cap);
+uint16 timer_capture_available(timer_capture *cap);
+uint16 timer_capture_read(timer_capture *cap, uint32 *times, uint16 max);
+
+/**
+ * @brief Get the frequency of a timer's ticks.
+ * @param dev Timer device.
+ * @return Timer clock divided by its prescaler, in Hz.
+ */
+static inline uint32 timer_capture_tick_hz(timer_dev *dev) {
+    return CLOCK_SPEED_HZ / (timer_get_prescaler(dev) + 1);
+}
+
+/**
+ * @brief Pulse train statistics.
+ * @see timer_capture_stats_read()
+ */
+typedef struct timer_capture_stats {
+    uint32 edges;               /**< Timestamps consumed */
+    uint32 min_period;          /**< Shortest interval, in ticks */
+    uint32 max_period;          /**< Longest interval, in ticks */
+    uint32 mean_period;         /**< Mean interval, in ticks */
+    uint32 millihertz;          /**< Frequency from mean_period, in
+                                     thousandths of a Hz; saturates at
+                                     0xFFFFFFFF, about 4.29 MHz */
+} timer_capture_stats;
+
+uint16 timer_capture_stats_read(timer_capture *cap,
+                                timer_capture_stats *stats);
+
+/*
+ * PWM input mode
+ */
+
+void timer_pwm_input_start(timer_dev *dev, uint8 filter);
+void timer_pwm_input_stop(timer_dev *dev);
+
+/**
+ * @brief Read the last period measured in PWM input mode.
+ * @param dev Timer in PWM input mode.
+ * @return Ticks from one rising edge to the next.  Meaningless until
+ *         two rising edges have been seen.
+ * @see timer_pwm_input_start()
+ */
+static inline uint16 timer_pwm_input_period(timer_dev *dev) {
+    return timer_get_compare(dev, 1);
+}
+
+/**
+ * @brief Read the last pulse width measured in PWM input mode.
+ * @param dev Timer in PWM input mode.
+ * @return Ticks from a rising edge to the following falling edge.
+ * @see timer_pwm_input_start()
+ */
+static inline uint16 timer_pwm_input_width(timer_dev *dev) {
+    return timer_get_compare(dev, 2);
+}
+
+uint32 timer_pwm_input_duty(timer_dev *dev);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
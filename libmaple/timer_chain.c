@@ -0,0 +1,484 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Copyright (c) 2011 LeafLabs, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file timer_chain.c
+ * @brief Chained timers: 32- and 48-bit counters in hardware.
+ */
+
+#include "libmaple.h"
+#include "nvic.h"
+#include "timer_chain.h"
+
+/*
+ * Internal trigger connections (RM0008, "TIMx internal trigger
+ * connection" tables): which ITR input of each slave timer carries
+ * each master's TRGO.
+ */
+
+static const struct chain_trigger {
+    timer_dev **slave;
+    timer_dev **master;
+    uint8 ts;
+} chain_triggers[] = {
+    {&TIMER1, &TIMER2, TIMER_SMCR_TS_ITR1},
+    {&TIMER1, &TIMER3, TIMER_SMCR_TS_ITR2},
+    {&TIMER1, &TIMER4, TIMER_SMCR_TS_ITR3},
+    {&TIMER2, &TIMER1, TIMER_SMCR_TS_ITR0},
+    {&TIMER2, &TIMER3, TIMER_SMCR_TS_ITR2},
+    {&TIMER2, &TIMER4, TIMER_SMCR_TS_ITR3},
+    {&TIMER3, &TIMER1, TIMER_SMCR_TS_ITR0},
+    {&TIMER3, &TIMER2, TIMER_SMCR_TS_ITR1},
+    {&TIMER3, &TIMER4, TIMER_SMCR_TS_ITR3},
+    {&TIMER4, &TIMER1, TIMER_SMCR_TS_ITR0},
+    {&TIMER4, &TIMER2, TIMER_SMCR_TS_ITR1},
+    {&TIMER4, &TIMER3, TIMER_SMCR_TS_ITR2},
+#ifdef STM32_HIGH_DENSITY
+    {&TIMER1, &TIMER5, TIMER_SMCR_TS_ITR0},
+    {&TIMER2, &TIMER8, TIMER_SMCR_TS_ITR1},
+    {&TIMER3, &TIMER5, TIMER_SMCR_TS_ITR2},
+    {&TIMER4, &TIMER8, TIMER_SMCR_TS_ITR3},
+    {&TIMER5, &TIMER2, TIMER_SMCR_TS_ITR0},
+    {&TIMER5, &TIMER3, TIMER_SMCR_TS_ITR1},
+    {&TIMER5, &TIMER4, TIMER_SMCR_TS_ITR2},
+    {&TIMER5, &TIMER8, TIMER_SMCR_TS_ITR3},
+    {&TIMER8, &TIMER1, TIMER_SMCR_TS_ITR0},
+    {&TIMER8, &TIMER2, TIMER_SMCR_TS_ITR1},
+    {&TIMER8, &TIMER4, TIMER_SMCR_TS_ITR2},
+    {&TIMER8, &TIMER5, TIMER_SMCR_TS_ITR3},
+#endif
+};
+
+/* SMCR trigger selection for slave to count master's overflows, or
+ * -1 if there's no connection. */
+static int chain_trigger(timer_dev *slave, timer_dev *master) {
+    uint32 i;
+    for (i = 0; i < sizeof(chain_triggers) / sizeof(chain_triggers[0]);
+         i++) {
+        if (*chain_triggers[i].slave == slave &&
+            *chain_triggers[i].master == master) {
+            return chain_triggers[i].ts;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Interrupt handling.  Every timer in a chain with compare or capture
+ * in use gets this module's handler on the channels involved; timer
+ * handlers take no arguments, so each timer has a trampoline that
+ * finds its chain here.
+ */
+
+#ifdef STM32_HIGH_DENSITY
+#define NR_CHAIN_TIMERS 6
+#else
+#define NR_CHAIN_TIMERS 4
+#endif
+
+static timer_chain *chains[NR_CHAIN_TIMERS];
+
+static int chain_timer_index(timer_dev *dev) {
+    if (dev == TIMER1) return 0;
+    if (dev == TIMER2) return 1;
+    if (dev == TIMER3) return 2;
+    if (dev == TIMER4) return 3;
+#ifdef STM32_HIGH_DENSITY
+    if (dev == TIMER5) return 4;
+    if (dev == TIMER8) return 5;
+#endif
+    return -1;
+}
+
+static void chain_fire(timer_chain *chain) {
+    timer_dev *low = chain->timers[0];
+    uint8 ch = chain->compare_channel;
+
+    timer_disable_irq(low, ch);
+    low->regs.gen->SR = ~BIT(ch);
+    chain->compare_callback(chain);
+}
+
+/* Called once the high half of the count has reached the compare
+ * time's; the rest is up to the low timer. */
+static void chain_arm_low(timer_chain *chain) {
+    timer_dev *low = chain->timers[0];
+    uint8 ch = chain->compare_channel;
+
+    low->regs.gen->SR = ~BIT(ch);
+    timer_enable_irq(low, ch);
+    /* If the low half went past while we were getting here, the
+     * compare interrupt will never come. */
+    if (timer_chain_read(chain) - chain->compare_when < 0x8000) {
+        chain_fire(chain);
+    }
+}
+
+static void chain_capture(timer_chain *chain) {
+    timer_gen_reg_map *regs = chain->timers[0]->regs.gen;
+    uint8 ch = chain->capture_channel;
+    uint16 low = (uint16)*(&regs->CCR1 + (ch - 1));
+    uint32 now = timer_chain_read(chain);
+    uint32 when = (now & 0xFFFF0000) | low;
+
+    if (regs->SR & (TIMER_SR_CC1OF << (ch - 1))) {
+        regs->SR = ~(TIMER_SR_CC1OF << (ch - 1));
+    }
+    /* The low timer may have wrapped since the capture. */
+    if (low > (uint16)now) {
+        when -= 0x10000;
+    }
+    chain->captured = when;
+    chain->captures++;
+    if (chain->capture_callback) {
+        chain->capture_callback(chain, when);
+    }
+}
+
+/* Compare interrupt, from either timer.  The dispatcher has already
+ * cleared the flag. */
+static void chain_compare_irq(int index) {
+    timer_chain *chain = chains[index];
+    timer_dev *low = chain->timers[0];
+
+    if (chain_timer_index(low) == index) {
+        if (timer_chain_read(chain) - chain->compare_when < 0x10000) {
+            chain_fire(chain);
+        }
+        return;
+    }
+
+    timer_disable_irq(chain->timers[1], chain->compare_channel);
+    chain_arm_low(chain);
+}
+
+static void chain_capture_irq(int index) {
+    chain_capture(chains[index]);
+}
+
+#define CHAIN_TRAMPOLINES(n)                                            \
+    static void chain_compare_##n(void) { chain_compare_irq(n); }       \
+    static void chain_capture_##n(void) { chain_capture_irq(n); }
+
+CHAIN_TRAMPOLINES(0)
+CHAIN_TRAMPOLINES(1)
+CHAIN_TRAMPOLINES(2)
+CHAIN_TRAMPOLINES(3)
+#ifdef STM32_HIGH_DENSITY
+CHAIN_TRAMPOLINES(4)
+CHAIN_TRAMPOLINES(5)
+#endif
+
+static const struct {
+    voidFuncPtr compare;
+    voidFuncPtr capture;
+} chain_handlers[NR_CHAIN_TIMERS] = {
+    {chain_compare_0, chain_capture_0},
+    {chain_compare_1, chain_capture_1},
+    {chain_compare_2, chain_capture_2},
+    {chain_compare_3, chain_capture_3},
+#ifdef STM32_HIGH_DENSITY
+    {chain_compare_4, chain_capture_4},
+    {chain_compare_5, chain_capture_5},
+#endif
+};
+
+/*
+ * Routines
+ */
+
+/**
+ * @brief Chain timers into one wide counter.
+ *
+ * Each timer counts from 0 to 0xFFFF.  The chain is left paused, with
+ * a count of 0; see timer_chain_start().  The timers' channels remain
+ * usable, except those given to timer_chain_compare() and
+ * timer_chain_capture_start().
+ *
+ * Timers 1 through 4 (and 5 and 8 on high-density devices) can be
+ * chained, in any order the internal trigger connections allow; any
+ * two of TIMER1 through TIMER4 work.
+ *
+ * @param chain Chain to set up.
+ * @param low Least significant timer, which counts ticks.
+ * @param high Timer counting low's overflows.
+ * @param top Timer counting high's overflows, for a 48-bit counter,
+ *            or NULL for a 32-bit counter.
+ * @param prescaler Prescaler for low; the chain ticks at the timer
+ *                  clock divided by (prescaler + 1).
+ * @return 0 on success, TIMER_CHAIN_ERROR_NO_TRIGGER if the timers
+ *         can't be chained in that order.
+ * @see timer_chain_read()
+ */
+int timer_chain_init(timer_chain *chain,
+                     timer_dev *low,
+                     timer_dev *high,
+                     timer_dev *top,
+                     uint16 prescaler) {
+    int ts_high = chain_trigger(high, low);
+    int ts_top = top ? chain_trigger(top, high) : 0;
+    uint8 i;
+
+    ASSERT(chain_timer_index(low) >= 0 && chain_timer_index(high) >= 0);
+    ASSERT(!top || chain_timer_index(top) >= 0);
+
+    if (ts_high < 0 || ts_top < 0) {
+        return TIMER_CHAIN_ERROR_NO_TRIGGER;
+    }
+
+    chain->timers[0] = low;
+    chain->timers[1] = high;
+    chain->timers[2] = top;
+    chain->length = top ? 3 : 2;
+    chain->compare_channel = 0;
+    chain->capture_channel = 0;
+    chain->compare_callback = NULL;
+    chain->capture_callback = NULL;
+    chain->captured = 0;
+    chain->captures = 0;
+
+    for (i = 0; i < chain->length; i++) {
+        timer_dev *dev = chain->timers[i];
+
+        timer_pause(dev);
+        dev->regs.gen->SMCR = 0;
+        timer_set_master_mode(dev, TIMER_MMS_UPDATE);
+        timer_set_prescaler(dev, i == 0 ? prescaler : 0);
+        timer_set_reload(dev, 0xFFFF);
+        /* Load the prescaler and zero the count.  The slaves aren't
+         * listening to the update events yet. */
+        timer_generate_update(dev);
+        chains[chain_timer_index(dev)] = chain;
+    }
+    high->regs.gen->SMCR = ts_high | TIMER_SMCR_SMS_EXTERNAL;
+    if (top) {
+        top->regs.gen->SMCR = ts_top | TIMER_SMCR_SMS_EXTERNAL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Start a chain counting.
+ * @param chain Chain set up with timer_chain_init().
+ */
+void timer_chain_start(timer_chain *chain) {
+    uint8 i = chain->length;
+
+    /* Slaves first, so none misses an overflow. */
+    while (i--) {
+        timer_resume(chain->timers[i]);
+    }
+}
+
+/**
+ * @brief Stop a chain counting.
+ *
+ * The count is kept; timer_chain_start() resumes from it.
+ *
+ * @param chain Chain set up with timer_chain_init().
+ */
+void timer_chain_stop(timer_chain *chain) {
+    uint8 i;
+
+    for (i = 0; i < chain->length; i++) {
+        timer_pause(chain->timers[i]);
+    }
+}
+
+/**
+ * @brief Read the low 32 bits of a chain's count.
+ *
+ * The timers are read high, low, high, until the two reads of the
+ * high timer agree, so the result is consistent even if the low timer
+ * overflows during the read.  (An overflow reaches the next timer in
+ * a couple of timer clock cycles, well before the second read.)  Safe
+ * to call from any context.
+ *
+ * @param chain Running chain.
+ * @return Count, in ticks.
+ * @see timer_chain_read64()
+ */
+uint32 timer_chain_read(timer_chain *chain) {
+    timer_gen_reg_map *low = chain->timers[0]->regs.gen;
+    timer_gen_reg_map *high = chain->timers[1]->regs.gen;
+    uint16 h1, h2, l;
+
+    do {
+        h1 = high->CNT;
+        l = low->CNT;
+        h2 = high->CNT;
+    } while (h1 != h2);
+    return ((uint32)h1 << 16) | l;
+}
+
+/**
+ * @brief Read a chain's full count.
+ * @param chain Running chain.
+ * @return Count, in ticks; 32 or 48 bits, depending on chain length.
+ * @see timer_chain_read()
+ */
+uint64 timer_chain_read64(timer_chain *chain) {
+    timer_gen_reg_map *top;
+    uint16 t1, t2;
+    uint32 rest;
+
+    if (chain->length == 2) {
+        return timer_chain_read(chain);
+    }
+    top = chain->timers[2]->regs.gen;
+    do {
+        t1 = top->CNT;
+        rest = timer_chain_read(chain);
+        t2 = top->CNT;
+    } while (t1 != t2);
+    return ((uint64)t1 << 32) | rest;
+}
+
+/**
+ * @brief Call a function when the chain's count reaches a value.
+ *
+ * Like a hardware compare, this matches the next time the low 32 bits
+ * of the count equal when, which may be a wrap away.  The channel is
+ * used on the two least significant timers, in output compare frozen
+ * mode, with this module's interrupt handler attached.  Replaces any
+ * compare already set up.
+ *
+ * @param chain Running chain.
+ * @param channel Channel to use, from 1 to 4.
+ * @param when Count at which to call callback.
+ * @param callback Function to call, from an interrupt handler, or
+ *                 before this returns if when is reached while setting
+ *                 up.  The compare is then disarmed.
+ * @see timer_chain_compare_cancel()
+ */
+void timer_chain_compare(timer_chain *chain,
+                         uint8 channel,
+                         uint32 when,
+                         void (*callback)(timer_chain*)) {
+    timer_dev *low = chain->timers[0];
+    timer_dev *high = chain->timers[1];
+    uint32 primask;
+    uint32 now;
+
+    ASSERT(channel >= 1 && channel <= 4);
+    ASSERT(channel != chain->capture_channel);
+
+    timer_chain_compare_cancel(chain);
+    primask = nvic_globalirq_save();
+
+    chain->compare_channel = channel;
+    chain->compare_when = when;
+    chain->compare_callback = callback;
+    timer_oc_set_mode(low, channel, TIMER_OC_MODE_FROZEN, 0);
+    timer_oc_set_mode(high, channel, TIMER_OC_MODE_FROZEN, 0);
+    timer_set_compare(low, channel, (uint16)when);
+    timer_set_compare(high, channel, (uint16)(when >> 16));
+    /* Attach the handlers, but leave the interrupts off until armed. */
+    timer_attach_interrupt(low, channel,
+                           chain_handlers[chain_timer_index(low)].compare);
+    timer_disable_irq(low, channel);
+    timer_attach_interrupt(high, channel,
+                           chain_handlers[chain_timer_index(high)].compare);
+    timer_disable_irq(high, channel);
+
+    high->regs.gen->SR = ~BIT(channel);
+    now = timer_chain_read(chain);
+    if ((now >> 16) == (when >> 16) && (uint16)now < (uint16)when) {
+        chain_arm_low(chain);
+    } else {
+        /* If high matches meanwhile, its flag is already set. */
+        timer_enable_irq(high, channel);
+    }
+
+    nvic_globalirq_restore(primask);
+}
+
+/**
+ * @brief Disarm a chain's compare, if any.
+ * @param chain Chain set up with timer_chain_init().
+ */
+void timer_chain_compare_cancel(timer_chain *chain) {
+    uint8 channel = chain->compare_channel;
+
+    if (!channel) {
+        return;
+    }
+    timer_detach_interrupt(chain->timers[0], channel);
+    timer_detach_interrupt(chain->timers[1], channel);
+    chain->compare_channel = 0;
+}
+
+/**
+ * @brief Timestamp edges on an input with the chain's count.
+ *
+ * The low timer captures in hardware; its interrupt handler fills in
+ * the high bits, which is exact provided it runs within one low timer
+ * period of the edge.  Each capture is stored in chain->captured,
+ * counted in chain->captures, and passed to callback.
+ *
+ * @param chain Running chain.
+ * @param channel Low timer channel whose input to capture, from 1 to 4.
+ * @param falling Nonzero to capture falling edges instead of rising.
+ * @param filter Input filter, as for timer_ic_set_mode().
+ * @param callback Function to call from the interrupt handler with
+ *                 each captured count, or NULL.
+ * @see timer_chain_capture_stop()
+ */
+void timer_chain_capture_start(timer_chain *chain,
+                               uint8 channel,
+                               uint8 falling,
+                               uint8 filter,
+                               void (*callback)(timer_chain*, uint32)) {
+    timer_dev *low = chain->timers[0];
+
+    ASSERT(channel >= 1 && channel <= 4);
+    ASSERT(channel != chain->compare_channel);
+
+    timer_chain_capture_stop(chain);
+    chain->capture_channel = channel;
+    chain->capture_callback = callback;
+    timer_ic_set_mode(low, channel, TIMER_IC_INPUT_DEFAULT, filter);
+    timer_cc_set_pol(low, channel, !!falling);
+    low->regs.gen->SR = ~BIT(channel);
+    timer_attach_interrupt(low, channel,
+                           chain_handlers[chain_timer_index(low)].capture);
+    timer_cc_enable(low, channel);
+}
+
+/**
+ * @brief Stop capturing.
+ * @param chain Chain set up with timer_chain_init().
+ */
+void timer_chain_capture_stop(timer_chain *chain) {
+    uint8 channel = chain->capture_channel;
+
+    if (!channel) {
+        return;
+    }
+    timer_cc_disable(chain->timers[0], channel);
+    timer_detach_interrupt(chain->timers[0], channel);
+    chain->capture_channel = 0;
+}
@@ -0,0 +1,111 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Copyright (c) 2011 LeafLabs, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file timer_chain.h
+ * @brief Chained timers: 32- and 48-bit counters in hardware.
+ *
+ * Links two or three timers through their internal trigger (ITR)
+ * connections.  The least significant timer counts timer clock ticks
+ * and outputs its update event as TRGO; each of the others counts the
+ * overflows of the one below it (external clock mode 1).  The result
+ * is a wide counter with no overflow interrupts, readable atomically,
+ * with 32-bit compare and capture.
+ */
+
+#ifndef _TIMER_CHAIN_H_
+#define _TIMER_CHAIN_H_
+
+#include "timer.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+ * @brief A chained timer counter.
+ * @see timer_chain_init()
+ */
+typedef struct timer_chain {
+    timer_dev *timers[3];       /**< Timers, least significant first */
+    uint8 length;               /**< Number of timers, 2 or 3 */
+
+    uint8 compare_channel;      /**< For internal use */
+    uint8 capture_channel;      /**< For internal use */
+    uint32 compare_when;        /**< For internal use */
+
+    /** Called from an interrupt handler at a compare match. */
+    void (*compare_callback)(struct timer_chain *chain);
+    /** Called from an interrupt handler with each captured time. */
+    void (*capture_callback)(struct timer_chain *chain, uint32 when);
+    void *arg;                  /**< For the callbacks' use */
+
+    volatile uint32 captured;   /**< Last captured time */
+    volatile uint32 captures;   /**< Number of captures */
+} timer_chain;
+
+/** timer_chain_init() error: a timer can't be clocked by the one
+ *  below it through an internal trigger. */
+#define TIMER_CHAIN_ERROR_NO_TRIGGER    (-8)
+
+int timer_chain_init(timer_chain *chain,
+                     timer_dev *low,
+                     timer_dev *high,
+                     timer_dev *top,
+                     uint16 prescaler);
+void timer_chain_start(timer_chain *chain);
+void timer_chain_stop(timer_chain *chain);
+uint32 timer_chain_read(timer_chain *chain);
+uint64 timer_chain_read64(timer_chain *chain);
+
+void timer_chain_compare(timer_chain *chain,
+                         uint8 channel,
+                         uint32 when,
+                         void (*callback)(timer_chain*));
+void timer_chain_compare_cancel(timer_chain *chain);
+
+void timer_chain_capture_start(timer_chain *chain,
+                               uint8 channel,
+                               uint8 falling,
+                               uint8 filter,
+                               void (*callback)(timer_chain*, uint32));
+void timer_chain_capture_stop(timer_chain *chain);
+
+/**
+ * @brief Get the frequency of a chain's ticks.
+ * @param chain Chain set up with timer_chain_init().
+ * @return Timer clock divided by the least significant timer's
+ *         prescaler, in Hz.
+ */
+static inline uint32 timer_chain_tick_hz(timer_chain *chain) {
+    return CLOCK_SPEED_HZ / (timer_get_prescaler(chain->timers[0]) + 1);
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
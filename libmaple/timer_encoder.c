@@ -0,0 +1,259 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Copyright (c) 2011 LeafLabs, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file timer_encoder.c
+ * @brief Quadrature encoder interface.
+ *
+ * The counter runs from 0 to 0xFFFF in encoder mode, wrapping in
+ * either direction.  Every read of it adds the signed 16-bit
+ * difference from the previous read to the position, which is right
+ * as long as the encoder moves less than half a counter period
+ * between reads, however it got there; counting wraps instead would
+ * go wrong when an encoder jitters across the wrap point, since two
+ * wraps can raise a single update interrupt.
+ *
+ * To bound the distance between reads, each read arms compares on
+ * channels 3 and 4 a quarter period either side of the count, and
+ * their interrupt reads again.  The update interrupt alone can't do
+ * this: in steady motion consecutive updates are a whole period
+ * apart, and both see a count near 0.
+ */
+
+#include "libmaple.h"
+#include "nvic.h"
+#include "timer_encoder.h"
+
+#ifdef STM32_HIGH_DENSITY
+#define NR_ENCODER_TIMERS 8
+#else
+#define NR_ENCODER_TIMERS 4
+#endif
+
+static timer_encoder *encoders[NR_ENCODER_TIMERS];
+
+static int encoder_timer_index(timer_dev *dev) {
+    if (dev == TIMER1) return 0;
+    if (dev == TIMER2) return 1;
+    if (dev == TIMER3) return 2;
+    if (dev == TIMER4) return 3;
+#ifdef STM32_HIGH_DENSITY
+    if (dev == TIMER5) return 4;
+    if (dev == TIMER8) return 7;
+#endif
+    return -1;
+}
+
+#define GUARD_DISTANCE  0x4000
+
+/* Bring the position up to date with the counter, and re-arm the
+ * guard compares around it.  Call with interrupts disabled. */
+static int32 encoder_advance(timer_encoder *enc) {
+    timer_gen_reg_map *regs = enc->dev->regs.gen;
+    uint16 count = regs->CNT;
+
+    enc->position += (int16)(count - enc->count);
+    enc->count = count;
+    regs->CCR3 = (uint16)(count + GUARD_DISTANCE);
+    regs->CCR4 = (uint16)(count - GUARD_DISTANCE);
+    return enc->position;
+}
+
+static void encoder_guard(int index) {
+    uint32 primask = nvic_globalirq_save();
+    encoder_advance(encoders[index]);
+    nvic_globalirq_restore(primask);
+}
+
+#define ENCODER_TRAMPOLINE(n)                                           \
+    static void encoder_guard_##n(void) { encoder_guard(n); }
+
+ENCODER_TRAMPOLINE(0)
+ENCODER_TRAMPOLINE(1)
+ENCODER_TRAMPOLINE(2)
+ENCODER_TRAMPOLINE(3)
+#ifdef STM32_HIGH_DENSITY
+ENCODER_TRAMPOLINE(4)
+ENCODER_TRAMPOLINE(7)
+#endif
+
+static const voidFuncPtr encoder_handlers[NR_ENCODER_TIMERS] = {
+    encoder_guard_0,
+    encoder_guard_1,
+    encoder_guard_2,
+    encoder_guard_3,
+#ifdef STM32_HIGH_DENSITY
+    encoder_guard_4,
+    NULL,                       /* TIMER6 has no inputs */
+    NULL,                       /* Nor does TIMER7 */
+    encoder_guard_7,
+#endif
+};
+
+/*
+ * Routines
+ */
+
+/**
+ * @brief Start counting a quadrature encoder.
+ *
+ * Connect the encoder's A and B signals to the timer's channel 1 and
+ * 2 pins, configured as inputs.  The timer's counter and channels 3
+ * and 4 are taken over; the update interrupt remains usable.  The
+ * position starts at 0.
+ *
+ * The channel 3 and 4 interrupts must be serviced before the encoder
+ * moves another 0x4000 counts, which is a long time at any realistic
+ * speed.
+ *
+ * @param enc Encoder state to start.
+ * @param dev Timer device, general purpose or advanced.
+ * @param mode Which edges to count.
+ * @param flags Either 0 or TIMER_ENCODER_REVERSE.
+ * @param filter Input filter for both signals, from 0 (none) to 15;
+ *               see the IC1F bits of TIMx_CCMR1 in ST's reference
+ *               manual.  Filters out contact bounce and noise, at the
+ *               cost of a maximum count rate.
+ * @return 0 on success, TIMER_ENCODER_ERROR_BUSY if the timer's
+ *         channel 3 or 4 interrupt has a handler.
+ * @see timer_encoder_read()
+ * @see timer_encoder_sample()
+ */
+int timer_encoder_start(timer_encoder *enc,
+                        timer_dev *dev,
+                        timer_encoder_mode mode,
+                        uint8 flags,
+                        uint8 filter) {
+    int index = encoder_timer_index(dev);
+    timer_gen_reg_map *regs = dev->regs.gen;
+
+    ASSERT(dev->type != TIMER_BASIC && index >= 0);
+
+    if (dev->handlers[TIMER_CC3_INTERRUPT] ||
+        dev->handlers[TIMER_CC4_INTERRUPT]) {
+        return TIMER_ENCODER_ERROR_BUSY;
+    }
+
+    enc->dev = dev;
+    enc->position = 0;
+    enc->count = 0;
+    enc->last = 0;
+    enc->velocity = 0;
+    encoders[index] = enc;
+
+    timer_pause(dev);
+    regs->SMCR = TIMER_SMCR_SMS_DISABLED;
+    timer_set_prescaler(dev, 0);
+    timer_set_reload(dev, 0xFFFF);
+    timer_generate_update(dev);
+    timer_ic_set_mode(dev, 1, TIMER_IC_INPUT_DEFAULT, filter);
+    timer_ic_set_mode(dev, 2, TIMER_IC_INPUT_DEFAULT, filter);
+    /* Inverting one input reverses the count. */
+    timer_cc_set_pol(dev, 1, flags & TIMER_ENCODER_REVERSE ? 1 : 0);
+    timer_cc_set_pol(dev, 2, 0);
+    timer_oc_set_mode(dev, 3, TIMER_OC_MODE_FROZEN, 0);
+    timer_oc_set_mode(dev, 4, TIMER_OC_MODE_FROZEN, 0);
+    regs->SMCR = mode;
+    timer_set_count(dev, 0);
+    encoder_advance(enc);
+    regs->SR = ~(TIMER_SR_CC3IF | TIMER_SR_CC4IF);
+    timer_attach_interrupt(dev, TIMER_CC3_INTERRUPT,
+                           encoder_handlers[index]);
+    timer_attach_interrupt(dev, TIMER_CC4_INTERRUPT,
+                           encoder_handlers[index]);
+    timer_resume(dev);
+    return 0;
+}
+
+/**
+ * @brief Stop counting a quadrature encoder.
+ *
+ * The timer is paused and taken out of encoder mode.
+ *
+ * @param enc Encoder started with timer_encoder_start().
+ */
+void timer_encoder_stop(timer_encoder *enc) {
+    timer_dev *dev = enc->dev;
+
+    timer_pause(dev);
+    timer_detach_interrupt(dev, TIMER_CC3_INTERRUPT);
+    timer_detach_interrupt(dev, TIMER_CC4_INTERRUPT);
+    dev->regs.gen->SMCR = TIMER_SMCR_SMS_DISABLED;
+    encoders[encoder_timer_index(dev)] = NULL;
+}
+
+/**
+ * @brief Get an encoder's position.
+ *
+ * Safe to call from any context, including interrupt handlers.
+ *
+ * @param enc Running encoder.
+ * @return Counts since the encoder was started or last written,
+ *         modulo 2^32.
+ */
+int32 timer_encoder_read(timer_encoder *enc) {
+    uint32 primask = nvic_globalirq_save();
+    int32 position = encoder_advance(enc);
+    nvic_globalirq_restore(primask);
+    return position;
+}
+
+/**
+ * @brief Set an encoder's position.
+ * @param enc Running encoder.
+ * @param position New position.
+ */
+void timer_encoder_write(timer_encoder *enc, int32 position) {
+    uint32 primask = nvic_globalirq_save();
+
+    encoder_advance(enc);
+    enc->position = position;
+    enc->last = position;
+
+    nvic_globalirq_restore(primask);
+}
+
+/**
+ * @brief Take a snapshot of an encoder's position to update its
+ *        velocity.
+ *
+ * Call at enc->sample_hz, e.g. from a timer_wheel callback.  The
+ * velocity is the change in position since the last sample, so its
+ * resolution is sample_hz counts per second; sample less often for
+ * finer resolution at low speeds, or average several samples.
+ *
+ * @param enc Running encoder, with sample_hz set.
+ * @return The new velocity, in counts per second; also available as
+ *         enc->velocity.
+ */
+int32 timer_encoder_sample(timer_encoder *enc) {
+    int32 position = timer_encoder_read(enc);
+    int32 velocity = (position - enc->last) * (int32)enc->sample_hz;
+
+    enc->last = position;
+    enc->velocity = velocity;
+    return velocity;
+}
@@ -0,0 +1,112 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Copyright (c) 2011 LeafLabs, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file timer_encoder.h
+ * @brief Quadrature encoder interface.
+ *
+ * Puts a timer in encoder mode, so that it counts the edges of a
+ * quadrature encoder on its channel 1 and 2 inputs up or down in
+ * hardware.  Interrupts from channels 3 and 4 extend the 16-bit count
+ * to a 32-bit position, and periodic snapshots of the position give a
+ * velocity estimate.
+ */
+
+#ifndef _TIMER_ENCODER_H_
+#define _TIMER_ENCODER_H_
+
+#include "timer.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+ * @brief Which encoder edges are counted.
+ *
+ * Channel 1's input is the encoder's A signal, and channel 2's is B.
+ */
+typedef enum timer_encoder_mode {
+    /** Count A's edges only: 2 counts per encoder cycle. */
+    TIMER_ENCODER_TI1 = TIMER_SMCR_SMS_ENCODER1,
+    /** Count B's edges only: 2 counts per encoder cycle. */
+    TIMER_ENCODER_TI2 = TIMER_SMCR_SMS_ENCODER2,
+    /** Count both signals' edges: 4 counts per encoder cycle. */
+    TIMER_ENCODER_TI12 = TIMER_SMCR_SMS_ENCODER3
+} timer_encoder_mode;
+
+/**
+ * @brief Quadrature encoder state.
+ *
+ * To estimate velocity, the caller sets sample_hz and calls
+ * timer_encoder_sample() at that rate, e.g. from a timer_wheel
+ * callback.
+ */
+typedef struct timer_encoder {
+    uint32 sample_hz;           /**< Rate at which the caller calls
+                                     timer_encoder_sample(), in Hz */
+    volatile int32 velocity;    /**< Velocity in counts per second, as
+                                     of the last sample */
+
+    timer_dev *dev;             /**< For internal use */
+    volatile int32 position;    /**< For internal use */
+    volatile uint16 count;      /**< For internal use */
+    int32 last;                 /**< For internal use */
+} timer_encoder;
+
+/* timer_encoder_start() flags */
+
+/** Count in the opposite direction, as if A and B were swapped. */
+#define TIMER_ENCODER_REVERSE   BIT(0)
+
+/** timer_encoder_start() error: the timer's channel 3 or 4
+ *  interrupt has a handler. */
+#define TIMER_ENCODER_ERROR_BUSY        (-8)
+
+int timer_encoder_start(timer_encoder *enc,
+                        timer_dev *dev,
+                        timer_encoder_mode mode,
+                        uint8 flags,
+                        uint8 filter);
+void timer_encoder_stop(timer_encoder *enc);
+int32 timer_encoder_read(timer_encoder *enc);
+void timer_encoder_write(timer_encoder *enc, int32 position);
+int32 timer_encoder_sample(timer_encoder *enc);
+
+/**
+ * @brief Get the direction the encoder last moved in.
+ * @param enc Running encoder.
+ * @return 1 if the count last went down, 0 if it last went up.
+ */
+static inline uint8 timer_encoder_dir(timer_encoder *enc) {
+    return *bb_perip(&(enc->dev->regs).gen->CR1, TIMER_CR1_DIR_BIT);
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
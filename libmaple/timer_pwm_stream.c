@@ -0,0 +1,174 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Copyright (c) 2011 LeafLabs, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file timer_pwm_stream.c
+ * @brief PWM waveforms streamed into timer registers by DMA.
+ */
+
+#include "libmaple.h"
+#include "timer_pwm_stream.h"
+
+static void timer_pwm_stream_dma(void *arg, dma_irq_cause cause) {
+    timer_pwm_stream *stream = (timer_pwm_stream*)arg;
+    uint16 half = stream->length / 2;
+    uint16 *block = (uint16*)stream->values;
+
+    if (cause == DMA_TRANSFER_ERROR) {
+        stream->error = 1;
+        return;
+    }
+
+    stream->blocks++;
+    switch (stream->mode) {
+    case TIMER_PWM_STREAM_ONESHOT:
+        /* The last group is in the preload registers; the timer must
+         * keep running to load it. */
+        stream->done = 1;
+        if (stream->callback) {
+            stream->callback(stream, NULL, 0);
+        }
+        break;
+    case TIMER_PWM_STREAM_LOOP:
+        break;
+    case TIMER_PWM_STREAM_REFILL:
+        if (cause == DMA_TRANSFER_COMPLETE) {
+            block += half * stream->nregs;
+        }
+        if (stream->callback) {
+            stream->callback(stream, block, half);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Start streaming values into timer registers.
+ *
+ * The timer's period, prescaler and channel modes (e.g. PWM, via
+ * timer_set_mode() or pinMode()) should be set up first.  Preload is
+ * enabled for the reload value (the CCRs already have it in PWM
+ * mode), so each group written takes effect as a whole at the
+ * following update event, and each one lasts one period.
+ *
+ * The stream begins with an update event, which restarts the count
+ * and requests the first group.  The period before that group takes
+ * effect keeps the old register values; zero the CCRs beforehand for
+ * a quiet first period.
+ *
+ * In TIMER_PWM_STREAM_ONESHOT mode, the last group stays in effect
+ * after the stream ends, so end with the values to be left in, e.g.
+ * 0 for an idle PWM output.
+ *
+ * @param stream Stream to play; values, length, mode and callback
+ *               must be filled in.
+ * @param dev Timer device, general purpose or advanced.
+ * @param base First register to write, e.g. TIMER_DMA_BASE_CCR1 for
+ *             channel 1's duty cycle, or TIMER_DMA_BASE_ARR for the
+ *             period.
+ * @param nregs Number of consecutive registers written per update
+ *              event, from 1 to 18.  For example, base
+ *              TIMER_DMA_BASE_CCR1 and nregs 4 sets all four duty
+ *              cycles together.  The stream's length times nregs
+ *              must be at most 65535, the most one DMA transfer
+ *              can move.
+ * @return 0 on success, or a negative DMA error.
+ * @see timer_pwm_stream_stop()
+ */
+int timer_pwm_stream_start(timer_pwm_stream *stream,
+                           timer_dev *dev,
+                           timer_dma_base_addr base,
+                           uint8 nregs) {
+    timer_gen_reg_map *regs = dev->regs.gen;
+    dma_xfer xfer;
+    int rc;
+
+    ASSERT(dev->type != TIMER_BASIC);
+    ASSERT(nregs >= 1 && nregs <= 18);
+    ASSERT(stream->length > 0);
+    ASSERT((uint32)stream->length * nregs <= 0xFFFF);
+    ASSERT(stream->mode != TIMER_PWM_STREAM_REFILL ||
+           stream->length % 2 == 0);
+
+    rc = dma_request_channel(timer_dma_line(dev, 0), DMA_PRIORITY_HIGH,
+                             "timer PWM stream",
+                             &stream->dma_d, &stream->dma_ch);
+    if (rc < 0) {
+        return rc;
+    }
+    stream->dev = dev;
+    stream->nregs = nregs;
+    stream->blocks = 0;
+    stream->done = 0;
+    stream->error = 0;
+
+    timer_pause(dev);
+    *bb_perip(&regs->CR1, TIMER_CR1_ARPE_BIT) = 1;
+    timer_dma_set_base_addr(dev, base);
+    timer_dma_set_burst_len(dev, nregs);
+
+    xfer.peripheral_address = &regs->DMAR;
+    xfer.peripheral_size = DMA_SIZE_16BITS;
+    xfer.memory_address = (void*)stream->values;
+    xfer.memory_size = DMA_SIZE_16BITS;
+    xfer.num_transfers = stream->length * nregs;
+    xfer.mode = DMA_MINC_MODE | DMA_FROM_MEM;
+    switch (stream->mode) {
+    case TIMER_PWM_STREAM_ONESHOT:
+        break;
+    case TIMER_PWM_STREAM_LOOP:
+        xfer.mode |= DMA_CIRC_MODE;
+        break;
+    case TIMER_PWM_STREAM_REFILL:
+        xfer.mode |= DMA_CIRC_MODE | DMA_HALF_TRNS;
+        break;
+    }
+    xfer.priority = DMA_PRIORITY_HIGH;
+    xfer.callback = timer_pwm_stream_dma;
+    xfer.arg = stream;
+    rc = dma_queue_xfer(stream->dma_d, stream->dma_ch, &xfer);
+    if (rc < 0) {
+        dma_release_channel(stream->dma_d, stream->dma_ch);
+        return rc;
+    }
+
+    *bb_perip(&regs->DIER, TIMER_DIER_UDE_BIT) = 1;
+    timer_generate_update(dev);
+    timer_resume(dev);
+    return 0;
+}
+
+/**
+ * @brief Stop streaming and release the DMA channel.
+ *
+ * The timer keeps running, with the last values written.
+ *
+ * @param stream Stream started with timer_pwm_stream_start().
+ */
+void timer_pwm_stream_stop(timer_pwm_stream *stream) {
+    *bb_perip(&stream->dev->regs.gen->DIER, TIMER_DIER_UDE_BIT) = 0;
+    dma_release_channel(stream->dma_d, stream->dma_ch);
+}
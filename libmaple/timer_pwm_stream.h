@@ -0,0 +1,105 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Copyright (c) 2011 LeafLabs, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file timer_pwm_stream.h
+ * @brief PWM waveforms streamed into timer registers by DMA.
+ *
+ * On each update event, the timer requests DMA, which writes the next
+ * group of values from a buffer into one or more consecutive timer
+ * registers through the DMA burst interface (DCR/DMAR).  Streaming
+ * into a CCRx register plays a sequence of duty cycles, one per PWM
+ * period (e.g. WS2812 LED data); streaming into ARR, or ARR and the
+ * CCRs after it, plays a sequence of periods (e.g. stepper motor
+ * ramps).  No CPU time is spent per period.
+ */
+
+#ifndef _TIMER_PWM_STREAM_H_
+#define _TIMER_PWM_STREAM_H_
+
+#include "timer.h"
+#include "dma.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/** How to play a stream's values. */
+typedef enum timer_pwm_stream_mode {
+    TIMER_PWM_STREAM_ONESHOT,   /**< Once, then stop */
+    TIMER_PWM_STREAM_LOOP,      /**< Over and over */
+    /** Over and over, calling the callback to refill each half of the
+     *  buffer once it has been played. */
+    TIMER_PWM_STREAM_REFILL
+} timer_pwm_stream_mode;
+
+/**
+ * @brief A stream of values for timer registers.
+ *
+ * The caller fills in values, length, mode and callback, then calls
+ * timer_pwm_stream_start().
+ */
+typedef struct timer_pwm_stream {
+    /** Values to write, one group of nregs per update event.  Must be
+     *  writable in TIMER_PWM_STREAM_REFILL mode. */
+    const uint16 *values;
+    uint16 length;              /**< Number of groups; even in
+                                     TIMER_PWM_STREAM_REFILL mode.
+                                     length * nregs is at most
+                                     65535. */
+    timer_pwm_stream_mode mode; /**< How to play the values */
+    /**
+     * Called from the DMA interrupt, or NULL.  In
+     * TIMER_PWM_STREAM_REFILL mode, block is the half just played and
+     * count its length in groups.  In TIMER_PWM_STREAM_ONESHOT mode,
+     * it's called once at the end, with block NULL.
+     */
+    void (*callback)(struct timer_pwm_stream *stream,
+                     uint16 *block,
+                     uint16 count);
+    void *arg;                  /**< For the callback's use */
+
+    timer_dev *dev;             /**< For internal use */
+    uint8 nregs;                /**< Registers written per update */
+    dma_dev *dma_d;             /**< For internal use */
+    dma_channel dma_ch;         /**< For internal use */
+    volatile uint32 blocks;     /**< Half buffers (refill mode) or
+                                     whole plays (otherwise) done */
+    volatile uint8 done;        /**< Set when a one-shot ends */
+    volatile uint8 error;       /**< Nonzero if DMA failed */
+} timer_pwm_stream;
+
+int timer_pwm_stream_start(timer_pwm_stream *stream,
+                           timer_dev *dev,
+                           timer_dma_base_addr base,
+                           uint8 nregs);
+void timer_pwm_stream_stop(timer_pwm_stream *stream);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,460 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Copyright (c) 2011 LeafLabs, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file timer_wheel.c
+ * @brief Software timers multiplexed onto one timer channel.
+ *
+ * Time is kept in 32-bit ticks: the timer counts the low 16 bits, and
+ * its update interrupt counts overflows into the high 16.  Each slot
+ * of the wheel holds the software timers whose deadlines fall in its
+ * 2^TIMER_WHEEL_SLOT_SHIFT tick window, in this turn of the wheel or
+ * a later one.  The cursor is the start of the slot being worked on;
+ * the interrupt handler fires what is due there, moves the cursor
+ * forward over empty slots (found from a bitmap), and programs the
+ * compare register for the next deadline in the current slot or the
+ * start of the next occupied one.
+ */
+
+#include "libmaple.h"
+#include "nvic.h"
+#include "timer_wheel.h"
+
+#define SLOT_TICKS      (1U << TIMER_WHEEL_SLOT_SHIFT)
+#define SLOT_MASK       (TIMER_WHEEL_SLOTS - 1)
+#define SLOT_OF(t)      (((t) >> TIMER_WHEEL_SLOT_SHIFT) & SLOT_MASK)
+
+#ifdef STM32_HIGH_DENSITY
+#define NR_WHEEL_TIMERS 8
+#else
+#define NR_WHEEL_TIMERS 4
+#endif
+
+static timer_wheel *wheels[NR_WHEEL_TIMERS];
+
+static int wheel_timer_index(timer_dev *dev) {
+    if (dev == TIMER1) return 0;
+    if (dev == TIMER2) return 1;
+    if (dev == TIMER3) return 2;
+    if (dev == TIMER4) return 3;
+#ifdef STM32_HIGH_DENSITY
+    if (dev == TIMER5) return 4;
+    if (dev == TIMER8) return 7;
+#endif
+    return -1;
+}
+
+/*
+ * Slots
+ */
+
+static void wheel_link(timer_wheel *wheel, timer_wheel_entry *entry) {
+    uint32 when = entry->deadline;
+    uint8 slot;
+
+    /* Anything already due goes in the current slot. */
+    if ((int32)(when - wheel->cursor) < 0) {
+        when = wheel->cursor;
+    }
+    slot = SLOT_OF(when);
+
+    entry->slot = slot;
+    entry->next = wheel->slots[slot];
+    if (entry->next) {
+        entry->next->pprev = &entry->next;
+    }
+    wheel->slots[slot] = entry;
+    entry->pprev = &wheel->slots[slot];
+    wheel->occupied[slot / 32] |= BIT(slot % 32);
+    wheel->pending++;
+}
+
+static void wheel_unlink(timer_wheel *wheel, timer_wheel_entry *entry) {
+    *entry->pprev = entry->next;
+    if (entry->next) {
+        entry->next->pprev = entry->pprev;
+    }
+    if (!wheel->slots[entry->slot]) {
+        wheel->occupied[entry->slot / 32] &= ~BIT(entry->slot % 32);
+    }
+    entry->pprev = NULL;
+    wheel->pending--;
+}
+
+/* Distance from slot to the next occupied slot, counting slot itself
+ * as distance 0; TIMER_WHEEL_SLOTS if all are empty. */
+static uint32 wheel_next_occupied(timer_wheel *wheel, uint32 slot) {
+    uint32 distance = 0;
+
+    while (distance < TIMER_WHEEL_SLOTS) {
+        uint32 i = (slot + distance) & SLOT_MASK;
+        uint32 bits = wheel->occupied[i / 32] >> (i % 32);
+
+        if (bits) {
+            distance += __builtin_ctz(bits);
+            return distance < TIMER_WHEEL_SLOTS ? distance : TIMER_WHEEL_SLOTS;
+        }
+        /* On to the next bitmap word, or back to slot 0 if the
+         * wheel ends first. */
+        distance += (32 - i % 32 < TIMER_WHEEL_SLOTS - i ?
+                     32 - i % 32 : TIMER_WHEEL_SLOTS - i);
+    }
+    return TIMER_WHEEL_SLOTS;
+}
+
+/*
+ * Interrupt handling
+ */
+
+static void wheel_fire(timer_wheel *wheel,
+                       timer_wheel_entry *entry,
+                       uint32 primask) {
+    uint32 start = timer_wheel_now(wheel);
+    uint32 late = start - entry->deadline;
+    uint32 duration;
+
+    wheel_unlink(wheel, entry);
+    if (late > wheel->max_latency) {
+        wheel->max_latency = late;
+    }
+    if (entry->period) {
+        uint32 missed = late / entry->period;
+
+        entry->deadline += (missed + 1) * entry->period;
+        if (missed) {
+            entry->overruns += missed;
+            wheel->overruns += missed;
+        }
+        wheel_link(wheel, entry);
+    }
+    entry->fired++;
+
+    nvic_globalirq_restore(primask);
+    entry->callback(entry);
+    nvic_globalirq_disable();
+
+    duration = timer_wheel_now(wheel) - start;
+    if (duration > wheel->max_duration) {
+        wheel->max_duration = duration;
+    }
+}
+
+/* Fire everything due in the cursor's slot in this turn. */
+static void wheel_fire_slot(timer_wheel *wheel, uint32 primask) {
+    uint8 slot = SLOT_OF(wheel->cursor);
+    timer_wheel_entry *entry = wheel->slots[slot];
+
+    while (entry) {
+        if ((int32)(entry->deadline - wheel->cursor) < (int32)SLOT_TICKS &&
+            (int32)(entry->deadline - timer_wheel_now(wheel)) <= 0) {
+            wheel_fire(wheel, entry, primask);
+            /* The callback may have changed the list; start over. */
+            entry = wheel->slots[slot];
+        } else {
+            entry = entry->next;
+        }
+    }
+}
+
+/* When to wake up next.  Only valid with something pending. */
+static uint32 wheel_next_wake(timer_wheel *wheel) {
+    uint8 slot = SLOT_OF(wheel->cursor);
+    timer_wheel_entry *entry;
+    uint32 distance;
+    uint32 wake = wheel->cursor + SLOT_TICKS;
+    uint8 found = 0;
+
+    for (entry = wheel->slots[slot]; entry; entry = entry->next) {
+        if ((int32)(entry->deadline - wake) < 0) {
+            wake = entry->deadline;
+            found = 1;
+        }
+    }
+    if (found) {
+        return wake;
+    }
+    distance = wheel_next_occupied(wheel, slot + 1);
+    return wheel->cursor + ((distance + 1) << TIMER_WHEEL_SLOT_SHIFT);
+}
+
+static void wheel_run(timer_wheel *wheel) {
+    uint32 primask = nvic_globalirq_save();
+
+    for (;;) {
+        uint32 now;
+
+        if (!wheel->pending) {
+            wheel->cursor = timer_wheel_now(wheel) & ~(SLOT_TICKS - 1);
+            break;
+        }
+
+        wheel_fire_slot(wheel, primask);
+        now = timer_wheel_now(wheel);
+        if (now - wheel->cursor >= SLOT_TICKS) {
+            /* This slot's window is over.  Move on to the next
+             * occupied slot, or the present one, whichever is
+             * sooner. */
+            uint32 skip, span;
+
+            wheel->cursor += SLOT_TICKS;
+            skip = wheel_next_occupied(wheel, SLOT_OF(wheel->cursor));
+            span = (now - wheel->cursor) >> TIMER_WHEEL_SLOT_SHIFT;
+            wheel->cursor += (skip < span ? skip : span) <<
+                TIMER_WHEEL_SLOT_SHIFT;
+            continue;
+        }
+
+        /* Wakeups more than a counter period away match early, and
+         * just come back here to wait some more. */
+        wheel->wake = wheel_next_wake(wheel);
+        timer_set_compare(wheel->dev, wheel->channel, (uint16)wheel->wake);
+        if ((int32)(wheel->wake - timer_wheel_now(wheel)) >= wheel->lead) {
+            break;
+        }
+        /* Too close for the compare interrupt to catch reliably. */
+        while ((int32)(wheel->wake - timer_wheel_now(wheel)) > 0)
+            ;
+    }
+
+    nvic_globalirq_restore(primask);
+}
+
+static void wheel_update(int index) {
+    wheels[index]->overflows++;
+}
+
+#define WHEEL_TRAMPOLINES(n)                                            \
+    static void wheel_update_##n(void) { wheel_update(n); }             \
+    static void wheel_cc_##n(void) { wheel_run(wheels[n]); }
+
+WHEEL_TRAMPOLINES(0)
+WHEEL_TRAMPOLINES(1)
+WHEEL_TRAMPOLINES(2)
+WHEEL_TRAMPOLINES(3)
+#ifdef STM32_HIGH_DENSITY
+WHEEL_TRAMPOLINES(4)
+WHEEL_TRAMPOLINES(7)
+#endif
+
+static const struct {
+    voidFuncPtr update;
+    voidFuncPtr cc;
+} wheel_handlers[NR_WHEEL_TIMERS] = {
+    {wheel_update_0, wheel_cc_0},
+    {wheel_update_1, wheel_cc_1},
+    {wheel_update_2, wheel_cc_2},
+    {wheel_update_3, wheel_cc_3},
+#ifdef STM32_HIGH_DENSITY
+    {wheel_update_4, wheel_cc_4},
+    {NULL, NULL},               /* TIMER6 has no compare channels */
+    {NULL, NULL},               /* Nor does TIMER7 */
+    {wheel_update_7, wheel_cc_7},
+#endif
+};
+
+/*
+ * Routines
+ */
+
+/**
+ * @brief Start a timer wheel.
+ *
+ * Takes over the timer's counter, which counts from 0 to 0xFFFF at
+ * tick_hz, and its update and channel interrupts.  Its other channels
+ * remain usable, e.g. for PWM with a 65536 tick period.
+ *
+ * @param wheel Wheel to start.
+ * @param dev Timer device, general purpose or advanced.
+ * @param channel Compare channel to drive the wheel, from 1 to 4.
+ * @param tick_hz Tick frequency, in Hz; e.g. 1000000 for deadlines in
+ *                microseconds.  Rounded to a divisor of the timer's
+ *                clock; see wheel->tick_hz for the result.
+ * @return 0 on success, TIMER_WHEEL_ERROR_BUSY if the timer's update
+ *         interrupt or the channel's interrupt has a handler.
+ * @see timer_wheel_add()
+ */
+int timer_wheel_start(timer_wheel *wheel,
+                      timer_dev *dev,
+                      uint8 channel,
+                      uint32 tick_hz) {
+    int index = wheel_timer_index(dev);
+    uint32 psc;
+    uint32 i;
+
+    ASSERT(dev->type != TIMER_BASIC && index >= 0);
+    ASSERT(channel >= 1 && channel <= 4);
+    ASSERT(tick_hz > 0 && tick_hz <= CLOCK_SPEED_HZ);
+
+    if (dev->handlers[TIMER_UPDATE_INTERRUPT] || dev->handlers[channel]) {
+        return TIMER_WHEEL_ERROR_BUSY;
+    }
+    psc = CLOCK_SPEED_HZ / tick_hz - 1;
+    ASSERT(psc <= 0xFFFF);
+
+    wheel->dev = dev;
+    wheel->channel = channel;
+    wheel->tick_hz = CLOCK_SPEED_HZ / (psc + 1);
+    /* Enough ticks for ~128 cycles: a compare set to a time the
+     * counter reaches before the write lands never matches. */
+    wheel->lead = 1 + 128 / (psc + 1);
+    wheel->max_latency = 0;
+    wheel->max_duration = 0;
+    wheel->overruns = 0;
+    wheel->overflows = 0;
+    wheel->cursor = 0;
+    wheel->wake = 0;
+    wheel->pending = 0;
+    for (i = 0; i < sizeof(wheel->occupied) / sizeof(wheel->occupied[0]);
+         i++) {
+        wheel->occupied[i] = 0;
+    }
+    for (i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+        wheel->slots[i] = NULL;
+    }
+    wheels[index] = wheel;
+
+    timer_pause(dev);
+    timer_set_prescaler(dev, psc);
+    timer_set_reload(dev, 0xFFFF);
+    timer_set_count(dev, 0);
+    timer_generate_update(dev);
+    dev->regs.gen->SR = ~TIMER_SR_UIF;
+    timer_oc_set_mode(dev, channel, TIMER_OC_MODE_FROZEN, 0);
+    timer_attach_interrupt(dev, TIMER_UPDATE_INTERRUPT,
+                           wheel_handlers[index].update);
+    timer_attach_interrupt(dev, channel, wheel_handlers[index].cc);
+    timer_resume(dev);
+    return 0;
+}
+
+/**
+ * @brief Stop a timer wheel.
+ *
+ * Pending software timers are cancelled.  The timer is paused.
+ *
+ * @param wheel Wheel started with timer_wheel_start().
+ */
+void timer_wheel_stop(timer_wheel *wheel) {
+    timer_dev *dev = wheel->dev;
+    uint32 i;
+
+    timer_pause(dev);
+    timer_detach_interrupt(dev, wheel->channel);
+    timer_detach_interrupt(dev, TIMER_UPDATE_INTERRUPT);
+    for (i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+        while (wheel->slots[i]) {
+            wheel_unlink(wheel, wheel->slots[i]);
+        }
+    }
+    wheels[wheel_timer_index(dev)] = NULL;
+}
+
+/**
+ * @brief Get the current time.
+ *
+ * Safe to call from any context, including interrupt handlers that
+ * run while the timer's update interrupt is pending.
+ *
+ * @param wheel Running wheel.
+ * @return Ticks since the wheel was started, modulo 2^32.
+ */
+uint32 timer_wheel_now(timer_wheel *wheel) {
+    timer_gen_reg_map *regs = wheel->dev->regs.gen;
+    uint32 overflows;
+    uint16 count;
+
+    do {
+        overflows = wheel->overflows;
+        count = regs->CNT;
+    } while (overflows != wheel->overflows);
+    /* A wrap whose update interrupt hasn't run yet. */
+    if ((regs->SR & TIMER_SR_UIF) && count < 0x8000) {
+        overflows++;
+    }
+    return (overflows << 16) | count;
+}
+
+/**
+ * @brief Schedule a software timer.
+ *
+ * If entry is already pending, it is rescheduled.  Deadlines must be
+ * less than 2^31 ticks away.
+ *
+ * If a periodic callback runs a period or more late, the deadlines it
+ * missed are skipped rather than run back to back, and counted in
+ * entry->overruns and wheel->overruns.
+ *
+ * @param wheel Running wheel.
+ * @param entry Software timer, set up with timer_wheel_entry_init().
+ * @param delay Ticks from now to the first deadline.
+ * @param period Ticks between later deadlines, or 0 for a one-shot.
+ * @see timer_wheel_cancel()
+ */
+void timer_wheel_add(timer_wheel *wheel,
+                     timer_wheel_entry *entry,
+                     uint32 delay,
+                     uint32 period) {
+    uint32 primask = nvic_globalirq_save();
+    uint32 now = timer_wheel_now(wheel);
+
+    if (entry->pprev) {
+        wheel_unlink(wheel, entry);
+    }
+    if (!wheel->pending) {
+        /* The cursor stops while the wheel is idle. */
+        wheel->cursor = now & ~(SLOT_TICKS - 1);
+    }
+    entry->deadline = now + delay;
+    entry->period = period;
+    wheel_link(wheel, entry);
+
+    /* If this is the new first deadline, have the interrupt handler
+     * reprogram the compare register.  (From a callback, it's about to
+     * anyway.) */
+    if (wheel->pending == 1 || (int32)(entry->deadline - wheel->wake) < 0) {
+        wheel->dev->regs.gen->EGR = BIT(wheel->channel);
+    }
+
+    nvic_globalirq_restore(primask);
+}
+
+/**
+ * @brief Cancel a software timer.
+ *
+ * Does nothing if entry isn't pending.  A callback may cancel itself.
+ *
+ * @param wheel Wheel entry was added to.
+ * @param entry Software timer.
+ */
+void timer_wheel_cancel(timer_wheel *wheel, timer_wheel_entry *entry) {
+    uint32 primask = nvic_globalirq_save();
+
+    if (entry->pprev) {
+        wheel_unlink(wheel, entry);
+    }
+
+    nvic_globalirq_restore(primask);
+}
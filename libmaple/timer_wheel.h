@@ -0,0 +1,174 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Copyright (c) 2011 LeafLabs, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file timer_wheel.h
+ * @brief Software timers multiplexed onto one timer channel.
+ *
+ * A hashed timer wheel runs any number of one-shot and periodic
+ * callbacks from a single capture/compare channel.  The compare
+ * register is reprogrammed to the next deadline after each interrupt,
+ * so there is no periodic tick.  Adding and cancelling a software
+ * timer take constant time.
+ */
+
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include "timer.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/** Number of wheel slots; a power of two, at most 256. */
+#ifndef TIMER_WHEEL_SLOTS
+#define TIMER_WHEEL_SLOTS       64
+#endif
+
+/**
+ * Log2 of the ticks covered by each wheel slot.  The wheel turns once
+ * every TIMER_WHEEL_SLOTS << TIMER_WHEEL_SLOT_SHIFT ticks; deadlines
+ * further away than that cost an extra interrupt per turn.
+ */
+#ifndef TIMER_WHEEL_SLOT_SHIFT
+#define TIMER_WHEEL_SLOT_SHIFT  8
+#endif
+
+struct timer_wheel_entry;
+
+/**
+ * @brief Software timer callback.
+ *
+ * Called from the timer's interrupt handler.  It may add and cancel
+ * software timers, including its own.
+ */
+typedef void (*timer_wheel_callback)(struct timer_wheel_entry *entry);
+
+/**
+ * @brief A software timer.
+ *
+ * Set up with timer_wheel_entry_init() before its first
+ * timer_wheel_add(); the wheel relies on the internal fields starting
+ * out cleared.  The entry must stay allocated until it has fired
+ * (one-shot) or been cancelled.
+ */
+typedef struct timer_wheel_entry {
+    timer_wheel_callback callback; /**< Called at each deadline */
+    void *arg;                  /**< For the callback's use */
+
+    uint32 deadline;            /**< Next deadline, in wheel ticks */
+    uint32 period;              /**< Ticks between deadlines; 0 for
+                                     a one-shot */
+    volatile uint32 fired;      /**< Number of times the callback ran */
+    volatile uint32 overruns;   /**< Deadlines skipped because the
+                                     callback ran a period or more
+                                     late */
+
+    struct timer_wheel_entry *next;   /**< For internal use */
+    struct timer_wheel_entry **pprev; /**< For internal use; NULL when
+                                           not pending */
+    uint8 slot;                 /**< For internal use */
+} timer_wheel_entry;
+
+/**
+ * @brief A timer wheel.
+ *
+ * Statistics are in ticks, and may be reset by the caller at any
+ * time.
+ */
+typedef struct timer_wheel {
+    timer_dev *dev;             /**< Timer device */
+    uint8 channel;              /**< Compare channel, from 1 to 4 */
+    uint8 lead;                 /**< For internal use */
+    uint32 tick_hz;             /**< Tick frequency, in Hz */
+
+    volatile uint32 max_latency;  /**< Longest delay from a deadline
+                                       to its callback starting */
+    volatile uint32 max_duration; /**< Longest time spent in a single
+                                       callback */
+    volatile uint32 overruns;     /**< Total deadlines skipped, over
+                                       all software timers */
+
+    volatile uint32 overflows;  /**< For internal use */
+    uint32 cursor;              /**< For internal use */
+    uint32 wake;                /**< For internal use */
+    uint32 pending;             /**< For internal use */
+    uint32 occupied[(TIMER_WHEEL_SLOTS + 31) / 32]; /**< For internal
+                                                         use */
+    timer_wheel_entry *slots[TIMER_WHEEL_SLOTS]; /**< For internal use */
+} timer_wheel;
+
+/** timer_wheel_start() error: the timer's interrupts are in use. */
+#define TIMER_WHEEL_ERROR_BUSY  (-8)
+
+int timer_wheel_start(timer_wheel *wheel,
+                      timer_dev *dev,
+                      uint8 channel,
+                      uint32 tick_hz);
+void timer_wheel_stop(timer_wheel *wheel);
+uint32 timer_wheel_now(timer_wheel *wheel);
+void timer_wheel_add(timer_wheel *wheel,
+                     timer_wheel_entry *entry,
+                     uint32 delay,
+                     uint32 period);
+void timer_wheel_cancel(timer_wheel *wheel, timer_wheel_entry *entry);
+
+/**
+ * @brief Set up a software timer.
+ *
+ * Call once, before the entry is first added; not while it is
+ * pending.
+ *
+ * @param entry Software timer.
+ * @param callback Function to call at each deadline.
+ * @param arg For the callback's use.
+ */
+static inline void timer_wheel_entry_init(timer_wheel_entry *entry,
+                                          timer_wheel_callback callback,
+                                          void *arg) {
+    entry->callback = callback;
+    entry->arg = arg;
+    entry->fired = 0;
+    entry->overruns = 0;
+    entry->next = NULL;
+    entry->pprev = NULL;
+}
+
+/**
+ * @brief Check whether a software timer is waiting to fire.
+ * @param entry Software timer.
+ * @return Nonzero if entry is on a wheel, 0 otherwise.
+ */
+static inline uint8 timer_wheel_pending(timer_wheel_entry *entry) {
+    return entry->pprev != NULL;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
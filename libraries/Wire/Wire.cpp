@@ -116,8 +116,283 @@ void i2c_shift_out(Port port, uint8 val) {
     }
 }
 
+/*
+ * Returns the I2C peripheral whose SDA and SCL are on the given pins,
+ * or NULL if there isn't one.  Sets *flags to the i2c_master_enable()
+ * flags needed to route the peripheral to them.
+ */
+static i2c_dev* pins_to_i2c(uint8 sda, uint8 scl, uint32 *flags) {
+    if (sda >= BOARD_NR_GPIO_PINS || scl >= BOARD_NR_GPIO_PINS) {
+        return NULL;
+    }
+    const stm32_pin_info *sda_info = &PIN_MAP[sda];
+    const stm32_pin_info *scl_info = &PIN_MAP[scl];
+    if (sda_info->gpio_device != GPIOB || scl_info->gpio_device != GPIOB) {
+        return NULL;
+    }
+
+    *flags = 0;
+    if (sda_info->gpio_bit == 7 && scl_info->gpio_bit == 6) {
+        return I2C1;
+    }
+    if (sda_info->gpio_bit == 9 && scl_info->gpio_bit == 8) {
+        *flags = I2C_REMAP;
+        return I2C1;
+    }
+    if (sda_info->gpio_bit == 11 && scl_info->gpio_bit == 10) {
+        return I2C2;
+    }
+    return NULL;
+}
+
+/*
+ * SoftI2C
+ */
+
+/* Cycles taken by one iteration of delay_loops(), and an estimate of
+ * the cycles spent on GPIO accesses and bookkeeping in each SCL
+ * phase, which the delays make up the rest of. */
+#define LOOP_CYCLES     (CYCLES_PER_MICROSECOND / STM32_DELAY_US_MULT)
+#define PHASE_OVERHEAD  20
+
+/* Each SCL-high poll takes about 4 cycles. */
+#define STRETCH_SPINS   (SOFT_I2C_STRETCH_TIMEOUT * CYCLES_PER_MICROSECOND / 4)
+
+static inline void delay_loops(uint32 loops) {
+    if (loops) {
+        asm volatile("1: subs %0, #1   \n\t"
+                     "   bhi 1b        \n\t"
+                     : "+r" (loops));
+    }
+}
+
+static inline uint32 cycles_to_loops(uint32 cycles) {
+    if (cycles <= PHASE_OVERHEAD) {
+        return 0;
+    }
+    return (cycles - PHASE_OVERHEAD) / LOOP_CYCLES;
+}
+
+SoftI2C::SoftI2C() {
+    sda_regs = NULL;
+    scl_regs = NULL;
+    sda_mask = 0;
+    scl_mask = 0;
+    setFrequency(WIRE_100KHZ);
+}
+
+/*
+ * Configures sda and scl as open-drain outputs, releases the bus, and
+ * sets the clock frequency.  Returns false if either pin is invalid.
+ */
+boolean SoftI2C::begin(uint8 sda, uint8 scl, uint32 frequency) {
+    if (sda >= BOARD_NR_GPIO_PINS || scl >= BOARD_NR_GPIO_PINS) {
+        return false;
+    }
+    sda_regs = PIN_MAP[sda].gpio_device->regs;
+    sda_mask = BIT(PIN_MAP[sda].gpio_bit);
+    scl_regs = PIN_MAP[scl].gpio_device->regs;
+    scl_mask = BIT(PIN_MAP[scl].gpio_bit);
+
+    scl_regs->BSRR = scl_mask;
+    sda_regs->BSRR = sda_mask;
+    pinMode(scl, OUTPUT_OPEN_DRAIN);
+    pinMode(sda, OUTPUT_OPEN_DRAIN);
+
+    setFrequency(frequency);
+    return true;
+}
+
+/*
+ * Sets the SCL frequency in Hz.  The low phase gets 9/16 of the
+ * period, which keeps both phases within spec at 100 kHz, 400 kHz
+ * and 1 MHz.  A frequency of 0 is taken as 1 Hz.
+ */
+void SoftI2C::setFrequency(uint32 frequency) {
+    uint32 period, low;
+
+    if (frequency == 0) {
+        frequency = 1;
+    }
+    period = CYCLES_PER_MICROSECOND * 1000000 / frequency;
+    low = period * 9 / 16;
+
+    low_loops = cycles_to_loops(low);
+    high_loops = cycles_to_loops(period - low);
+}
+
+/* Let SCL go high and wait for any slave stretching it. */
+inline bool SoftI2C::releaseSCL(void) {
+    uint32 spins = STRETCH_SPINS;
+
+    scl_regs->BSRR = scl_mask;
+    while (!(scl_regs->IDR & scl_mask)) {
+        if (!--spins) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Clock out one bit; SCL is low on entry and exit. */
+inline bool SoftI2C::writeBit(uint32 bit) {
+    if (bit) {
+        sda_regs->BSRR = sda_mask;
+    } else {
+        sda_regs->BRR = sda_mask;
+    }
+    delay_loops(low_loops);
+    if (!releaseSCL()) {
+        return false;
+    }
+    delay_loops(high_loops);
+    scl_regs->BRR = scl_mask;
+    return true;
+}
+
+/* Clock in one bit; SCL is low on entry and exit. */
+inline int SoftI2C::readBit(void) {
+    int bit;
+
+    sda_regs->BSRR = sda_mask;
+    delay_loops(low_loops);
+    if (!releaseSCL()) {
+        return -1;
+    }
+    delay_loops(high_loops);
+    bit = !!(sda_regs->IDR & sda_mask);
+    scl_regs->BRR = scl_mask;
+    return bit;
+}
+
+/*
+ * Generates a start condition, or a repeated start if the bus is
+ * already ours.  Leaves SCL low.
+ */
+boolean SoftI2C::start(void) {
+    sda_regs->BSRR = sda_mask;
+    delay_loops(low_loops);
+    if (!releaseSCL()) {
+        return false;
+    }
+    delay_loops(high_loops);
+    sda_regs->BRR = sda_mask;
+    delay_loops(high_loops);
+    scl_regs->BRR = scl_mask;
+    return true;
+}
+
+/* Generates a stop condition, leaving the bus free. */
+boolean SoftI2C::stop(void) {
+    sda_regs->BRR = sda_mask;
+    delay_loops(low_loops);
+    if (!releaseSCL()) {
+        return false;
+    }
+    delay_loops(high_loops);
+    sda_regs->BSRR = sda_mask;
+    delay_loops(low_loops);
+    return true;
+}
+
+int SoftI2C::writeByte(uint8 byte) {
+    for (int i = 7; i >= 0; i--) {
+        if (!writeBit(byte & (1 << i))) {
+            return -1;
+        }
+    }
+    return readBit();
+}
+
+int SoftI2C::readByte(boolean ack) {
+    int byte = 0;
+
+    for (int i = 0; i < 8; i++) {
+        int bit = readBit();
+        if (bit < 0) {
+            return -1;
+        }
+        byte = (byte << 1) | bit;
+    }
+    if (!writeBit(!ack)) {
+        return -1;
+    }
+    return byte;
+}
+
+/*
+ * Writes len bytes from buf to the slave at address, then generates
+ * a stop condition unless sendStop is false, so that a read can
+ * follow with a repeated start.
+ */
+uint8 SoftI2C::write(uint8 address, const uint8 *buf, uint32 len,
+                     boolean sendStop) {
+    int ack;
+
+    if (!start()) {
+        return EOTHER;
+    }
+    ack = writeByte((address << 1) | I2C_WRITE);
+    if (ack) {
+        stop();
+        return ack < 0 ? EOTHER : ENACKADDR;
+    }
+    for (uint32 i = 0; i < len; i++) {
+        ack = writeByte(buf[i]);
+        if (ack) {
+            stop();
+            return ack < 0 ? EOTHER : ENACKTRNS;
+        }
+    }
+    if (sendStop && !stop()) {
+        return EOTHER;
+    }
+    return SUCCESS;
+}
+
+/* Reads len bytes from the slave at address into buf. */
+uint8 SoftI2C::read(uint8 address, uint8 *buf, uint32 len) {
+    int ack;
+
+    if (!start()) {
+        return EOTHER;
+    }
+    ack = writeByte((address << 1) | I2C_READ);
+    if (ack) {
+        stop();
+        return ack < 0 ? EOTHER : ENACKADDR;
+    }
+    for (uint32 i = 0; i < len; i++) {
+        int byte = readByte(i + 1 < len);
+        if (byte < 0) {
+            stop();
+            return EOTHER;
+        }
+        buf[i] = byte;
+    }
+    return stop() ? SUCCESS : EOTHER;
+}
+
+/*
+ * Writes tx_len bytes (e.g. a register address), then reads rx_len
+ * bytes after a repeated start.
+ */
+uint8 SoftI2C::writeRead(uint8 address, const uint8 *tx, uint32 tx_len,
+                         uint8 *rx, uint32 rx_len) {
+    uint8 ret = write(address, tx, tx_len, false);
+    if (ret != SUCCESS) {
+        return ret;
+    }
+    return read(address, rx, rx_len);
+}
+
+/*
+ * TwoWire
+ */
+
 TwoWire::TwoWire() {
     i2c_delay = 0;
+    i2c_d = NULL;
     rx_buf_idx = 0;
     rx_buf_len = 0;
     tx_addr = 0;
@@ -135,15 +410,39 @@ void TwoWire::begin() {
 }
 
 /*
- * Joins I2C bus as master on given SDA and SCL pins.
+ * Joins I2C bus as master on given SDA and SCL pins, at 100 kHz.
  */
 void TwoWire::begin(uint8 sda, uint8 scl) {
-    port.sda = sda;
-    port.scl = scl;
-    pinMode(scl, OUTPUT_OPEN_DRAIN);
-    pinMode(sda, OUTPUT_OPEN_DRAIN);
-    digitalWrite(scl, HIGH);
-    digitalWrite(sda, HIGH);
+    begin(sda, scl, WIRE_100KHZ);
+}
+
+/*
+ * Joins I2C bus as master on given SDA and SCL pins.  If they are a
+ * hardware I2C peripheral's pins, the peripheral runs the bus at
+ * WIRE_100KHZ or WIRE_400KHZ (any frequency of at least 400 kHz
+ * selects fast mode).  Otherwise, the bus is bit-banged by a SoftI2C
+ * at the given frequency (up to WIRE_1MHZ).
+ */
+void TwoWire::begin(uint8 sda, uint8 scl, uint32 frequency) {
+    uint32 flags;
+    i2c_dev *dev = pins_to_i2c(sda, scl, &flags);
+
+    if (i2c_d && i2c_d != dev) {
+        i2c_disable(i2c_d);
+    }
+    i2c_d = dev;
+    if (i2c_d) {
+        if (i2c_d->state != I2C_STATE_DISABLED) {
+            i2c_disable(i2c_d);
+        }
+        if (frequency >= WIRE_400KHZ) {
+            flags |= I2C_FAST_MODE;
+        }
+        i2c_master_enable(i2c_d, flags | I2C_BUS_RESET);
+        return;
+    }
+
+    soft.begin(sda, scl, frequency);
 }
 
 void TwoWire::beginTransmission(uint8 slave_address) {
@@ -161,22 +460,19 @@ void TwoWire::beginTransmission(int slave_address) {
 uint8 TwoWire::endTransmission(void) {
     if (tx_buf_overflow) return EDATA;
 
-    i2c_start(port);
-
-    i2c_shift_out(port, (tx_addr << 1) | I2C_WRITE);
-    if (!i2c_get_ack(port)) return ENACKADDR;
-
-    // shift out the address we're transmitting to
-    for (uint8 i = 0; i < tx_buf_idx; i++) {
-        uint8 ret = writeOneByte(tx_buf[i]);
-        if (ret) return ret;    // SUCCESS is 0
+    if (i2c_d) {
+        i2c_msg msg;
+        msg.addr = tx_addr;
+        msg.flags = 0;
+        msg.length = tx_buf_idx;
+        msg.data = tx_buf;
+        tx_buf_idx = 0;
+        return hardwareTransfer(&msg);
     }
 
-    i2c_stop(port);
-
+    uint8 ret = soft.write(tx_addr, tx_buf, tx_buf_idx);
     tx_buf_idx = 0;
-    tx_buf_overflow = false;
-    return SUCCESS;
+    return ret;
 }
 
 uint8 TwoWire::requestFrom(uint8 address, int num_bytes) {
@@ -184,9 +480,18 @@ uint8 TwoWire::requestFrom(uint8 address, int num_bytes) {
 
     rx_buf_idx = 0;
     rx_buf_len = 0;
-    while (rx_buf_len < num_bytes) {
-        if(!readOneByte(address, rx_buf + rx_buf_len)) rx_buf_len++;
-        else break;
+    if (i2c_d) {
+        if (num_bytes <= 0) return 0;
+        i2c_msg msg;
+        msg.addr = address;
+        msg.flags = I2C_MSG_READ;
+        msg.length = num_bytes;
+        msg.data = rx_buf;
+        if (hardwareTransfer(&msg) == SUCCESS) rx_buf_len = num_bytes;
+        return rx_buf_len;
+    }
+    if (num_bytes > 0 && soft.read(address, rx_buf, num_bytes) == SUCCESS) {
+        rx_buf_len = num_bytes;
     }
     return rx_buf_len;
 }
@@ -233,27 +538,18 @@ uint8 TwoWire::receive() {
     return rx_buf[rx_buf_idx++];
 }
 
-// private methods
-
-uint8 TwoWire::writeOneByte(uint8 byte) {
-    i2c_shift_out(port, byte);
-    if (!i2c_get_ack(port)) return ENACKTRNS;
-
-    return SUCCESS;
-}
-
-uint8 TwoWire::readOneByte(uint8 address, uint8 *byte) {
-    i2c_start(port);
-
-    i2c_shift_out(port, (address << 1) | I2C_READ);
-    if (!i2c_get_ack(port)) return ENACKADDR;
-
-    *byte = i2c_shift_in(port);
-
-    i2c_send_nack(port);
-    i2c_stop(port);
-
-    return SUCCESS;      // no real way of knowing, but be optimistic!
+/*
+ * Runs one message on the hardware I2C peripheral, translating the
+ * result into an endTransmission() return code.
+ */
+uint8 TwoWire::hardwareTransfer(i2c_msg *msg) {
+    msg->xferred = 0;
+    int32 rc = i2c_master_xfer(i2c_d, msg, 1, WIRE_TIMEOUT);
+    if (rc == 0) return SUCCESS;
+    if (rc == I2C_ERROR_PROTOCOL && (i2c_d->error_flags & I2C_SR1_AF)) {
+        return msg->xferred ? ENACKTRNS : ENACKADDR;
+    }
+    return EOTHER;
 }
 
 // Declare the instance that the users of the library can use
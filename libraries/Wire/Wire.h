@@ -30,6 +30,7 @@
  */
 
 #include "wirish.h"
+#include "i2c.h"
 
 #ifndef _WIRE_H_
 #define _WIRE_H_
@@ -52,11 +53,63 @@ typedef struct {
 #define SDA 20
 #define SCL 21
 
+/* bus speeds for begin(sda, scl, frequency) */
+#define WIRE_100KHZ 100000
+#define WIRE_400KHZ 400000
+
+/* bus idle timeout for the hardware I2C peripherals, in milliseconds */
+#define WIRE_TIMEOUT 10
+
 #define I2C_WRITE 0
 #define I2C_READ  1
 
 #define I2C_DELAY do{for(int i=0;i<50;i++) {asm volatile("nop");}}while(0)
 
+/* bus speed for SoftI2C only; the hardware peripherals can't do it */
+#define WIRE_1MHZ   1000000
+
+/* how long SoftI2C waits for a slave stretching SCL, in microseconds */
+#define SOFT_I2C_STRETCH_TIMEOUT 1000
+
+/*
+ * Bit-banged I2C master on any pair of pins.  The pins are resolved
+ * to GPIO registers and bit masks once, in begin(), and the bus is
+ * clocked with calibrated busy loops, so it can run at fast mode
+ * (400 kHz) and fast mode plus (1 MHz) speeds.  Slaves may stretch
+ * SCL for up to SOFT_I2C_STRETCH_TIMEOUT microseconds.
+ *
+ * The transfer methods return the same codes as
+ * TwoWire::endTransmission(); EOTHER means a slave held SCL low for
+ * too long.
+ */
+class SoftI2C {
+ private:
+    gpio_reg_map *sda_regs;
+    gpio_reg_map *scl_regs;
+    uint32 sda_mask;
+    uint32 scl_mask;
+    uint32 low_loops;               /* delay loop counts for SCL low */
+    uint32 high_loops;              /* and high phases */
+    inline bool releaseSCL(void);
+    inline bool writeBit(uint32 bit);
+    inline int readBit(void);
+ public:
+    SoftI2C();
+    boolean begin(uint8 sda, uint8 scl, uint32 frequency);
+    void setFrequency(uint32 frequency);
+
+    boolean start(void);
+    boolean stop(void);
+    int writeByte(uint8 byte);      /* 0 if ACKed, 1 if NACKed, <0 error */
+    int readByte(boolean ack);      /* the byte, or <0 on error */
+
+    uint8 write(uint8 address, const uint8 *buf, uint32 len,
+                boolean sendStop = true);
+    uint8 read(uint8 address, uint8 *buf, uint32 len);
+    uint8 writeRead(uint8 address, const uint8 *tx, uint32 tx_len,
+                    uint8 *rx, uint32 rx_len);
+};
+
 class TwoWire {
  private:
     uint8 rx_buf[WIRE_BUFSIZ];      /* receive buffer */
@@ -67,13 +120,14 @@ class TwoWire {
     uint8 tx_buf[WIRE_BUFSIZ];      /* transmit buffer */
     uint8 tx_buf_idx;  /* next idx available in tx_buf, -1 overflow */
     boolean tx_buf_overflow;
-    Port port;
-    uint8 writeOneByte(uint8);
-    uint8 readOneByte(uint8, uint8*);
+    i2c_dev *i2c_d;                 /* hardware I2C device, or NULL */
+    SoftI2C soft;                   /* used on other pins */
+    uint8 hardwareTransfer(i2c_msg*);
  public:
     TwoWire();
     void begin();
     void begin(uint8, uint8);
+    void begin(uint8, uint8, uint32);
     void beginTransmission(uint8);
     void beginTransmission(int);
     uint8 endTransmission(void);
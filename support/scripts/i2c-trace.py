@@ -0,0 +1,226 @@
+#!/usr/bin/env python
+
+"""Decode a libmaple I2C trace buffer (i2c_trace_buf).
+
+Build libmaple with I2C_TRACE_SIZE defined (or I2C_DEBUG), and call
+i2c_trace_enable().  Then get a copy of the buffer, either from a
+debugger:
+
+    (gdb) dump binary value trace.bin i2c_trace_buf
+
+or over a serial port, from a sketch which writes the raw bytes of
+i2c_trace_buf when it receives a 'd' (see examples/test-i2c-async.cpp):
+
+    i2c-trace.py --serial /dev/ttyACM0
+
+and this prints the events in order, with timestamps, followed by
+per-slave transaction latency statistics and the longest gaps between
+events on each bus."""
+
+from __future__ import print_function
+
+import optparse
+import struct
+import sys
+
+MAGIC = 0x54433249
+HEADER = struct.Struct('<IHHII')
+ENTRY = struct.Struct('<IBBHII')
+
+# Keep in sync with enum i2c_trace_event in libmaple/i2c.h.
+EVENTS = {
+    1: 'IRQ_ENTRY',
+    2: 'TXE_ONLY',
+    3: 'TXE_BTF',
+    4: 'STOP_SENT',
+    5: 'TX_RESTART',
+    6: 'RX_ADDR_START',
+    7: 'RX_ADDR_STOP',
+    8: 'RXNE_ONLY',
+    10: 'RXNE_START_SENT',
+    11: 'RXNE_STOP_SENT',
+    12: 'RXNE_DONE',
+    13: 'ERROR_ENTRY',
+    14: 'DMA_START',
+    15: 'DMA_TX_DONE',
+    16: 'DMA_RX_DONE',
+    17: 'XFER_START',
+    18: 'XFER_DONE',
+    19: 'TIMEOUT',
+}
+IRQ_ENTRY, ERROR_ENTRY, DMA_START = 1, 13, 14
+XFER_START, XFER_DONE, TIMEOUT = 17, 18, 19
+
+SR1_FLAGS = [(15, 'SMBALERT'), (14, 'TIMEOUT'), (12, 'PECERR'), (11, 'OVR'),
+             (10, 'AF'), (9, 'ARLO'), (8, 'BERR'), (7, 'TXE'), (6, 'RXNE'),
+             (4, 'STOPF'), (3, 'ADD10'), (2, 'BTF'), (1, 'ADDR'), (0, 'SB')]
+SR2_FLAGS = [(7, 'DUALF'), (6, 'SMBHOST'), (5, 'SMBDEFAULT'), (4, 'GENCALL'),
+             (2, 'TRA'), (1, 'BUSY'), (0, 'MSL')]
+RESULTS = {0: 'ok', -1: 'I2C_ERROR_PROTOCOL', -2: 'I2C_ERROR_TIMEOUT'}
+
+def flags(value, names):
+    return ' '.join(name for bit, name in names if value & (1 << bit)) or '-'
+
+def signed(value):
+    return value - (1 << 32) if value & (1 << 31) else value
+
+def parse(data):
+    """Returns (cpu_hz, entries in buffer, events recorded, entries).
+    Entries are oldest first, as tuples of (cycles, bus, event, addr,
+    arg0, arg1), with cycle counts unwrapped into a monotonic count."""
+    if len(data) < HEADER.size:
+        raise ValueError('dump is too short')
+    magic, size, entry_size, cpu_hz, count = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise ValueError('bad magic 0x%08x; not an i2c_trace_buf dump' % magic)
+    if entry_size != ENTRY.size:
+        raise ValueError('unexpected entry size %d' % entry_size)
+    if len(data) < HEADER.size + size * entry_size:
+        raise ValueError('dump is truncated')
+
+    first = max(0, count - size)
+    entries = []
+    last = None
+    offset = 0
+    for i in range(first, count):
+        e = ENTRY.unpack_from(data, HEADER.size + (i % size) * entry_size)
+        cycles = e[0]
+        if last is not None and cycles < last:
+            offset += 1 << 32
+        last = cycles
+        entries.append((cycles + offset,) + e[1:])
+    return cpu_hz, count - first, count, entries
+
+def describe(event, arg0, arg1):
+    if event in (IRQ_ENTRY, ERROR_ENTRY):
+        return 'SR1: %s  SR2: %s' % (flags(arg0, SR1_FLAGS),
+                                     flags(arg1, SR2_FLAGS))
+    if event == XFER_START:
+        return '%d message(s)' % arg0
+    if event == XFER_DONE:
+        result = signed(arg0)
+        return RESULTS.get(result, str(result))
+    if event == TIMEOUT:
+        return '%d ms idle' % arg0
+    if event == DMA_START:
+        return '%d bytes, %s' % (arg0, 'read' if arg1 else 'write')
+    return ''
+
+def print_timeline(cpu_hz, entries):
+    t0 = entries[0][0]
+    last = {}
+    print('%12s %10s  %-4s %-6s %-16s' % ('time (us)', 'delta', 'bus',
+                                          'addr', 'event'))
+    for cycles, bus, event, addr, arg0, arg1 in entries:
+        us = (cycles - t0) * 1e6 / cpu_hz
+        delta = (cycles - last.get(bus, cycles)) * 1e6 / cpu_hz
+        last[bus] = cycles
+        print('%12.2f %10.2f  I2C%d 0x%02x   %-16s %s' %
+              (us, delta, bus, addr, EVENTS.get(event, str(event)),
+               describe(event, arg0, arg1)))
+
+def print_stats(cpu_hz, entries):
+    started = {}
+    latencies = {}
+    errors = {}
+    gaps = {}
+    last = {}
+    for cycles, bus, event, addr, arg0, arg1 in entries:
+        if bus in last:
+            gap = cycles - last[bus][0]
+            gaps.setdefault(bus, []).append((gap, last[bus], cycles))
+        last[bus] = (cycles, EVENTS.get(event, str(event)), addr)
+
+        if event == XFER_START:
+            started[bus] = (cycles, addr)
+        elif event == XFER_DONE and bus in started:
+            start, start_addr = started.pop(bus)
+            key = (bus, start_addr)
+            latencies.setdefault(key, []).append(cycles - start)
+            if signed(arg0) != 0:
+                errors[key] = errors.get(key, 0) + 1
+
+    print()
+    print('Transaction latency (us), from XFER_START to XFER_DONE:')
+    if not latencies:
+        print('  no complete transactions in the buffer')
+    print('  %-4s %-6s %6s %6s %10s %10s %10s' %
+          ('bus', 'addr', 'count', 'errors', 'min', 'mean', 'max'))
+    for (bus, addr) in sorted(latencies):
+        l = [c * 1e6 / cpu_hz for c in latencies[(bus, addr)]]
+        print('  I2C%d 0x%02x   %6d %6d %10.2f %10.2f %10.2f' %
+              (bus, addr, len(l), errors.get((bus, addr), 0),
+               min(l), sum(l) / len(l), max(l)))
+
+    print()
+    print('Longest gaps between events (us):')
+    for bus in sorted(gaps):
+        for gap, (start, event, addr), end in sorted(gaps[bus],
+                                                     reverse=True)[:5]:
+            print('  I2C%d %10.2f after %s (0x%02x)' %
+                  (bus, gap * 1e6 / cpu_hz, event, addr))
+
+def read_serial(port, baud, timeout):
+    import serial
+    ser = serial.Serial(port, baud, timeout=timeout)
+    ser.flushInput()
+    ser.write(b'd')
+    # Skip anything else the sketch printed, up to the magic number.
+    magic = struct.pack('<I', MAGIC)
+    header = b''
+    while not header.endswith(magic):
+        c = ser.read(1)
+        if not c:
+            raise ValueError('no trace dump received on %s' % port)
+        header = (header + c)[-len(magic):]
+    header += ser.read(HEADER.size - len(magic))
+    if len(header) < HEADER.size:
+        raise ValueError('short trace dump on %s' % port)
+    size, entry_size = HEADER.unpack(header)[1:3]
+    body = ser.read(size * entry_size)
+    ser.close()
+    return header + body
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] [dump-file]',
+                                   description=__doc__.split('\n\n')[0])
+    parser.add_option('-s', '--serial', metavar='PORT',
+                      help="send 'd' to PORT and read the dump from it")
+    parser.add_option('-b', '--baud', type='int', default=115200,
+                      help='serial baud rate (ignored by SerialUSB)')
+    parser.add_option('-t', '--timeout', type='float', default=2.0,
+                      help='serial read timeout, in seconds')
+    parser.add_option('--hz', type='int',
+                      help='override the cycle counter frequency')
+    parser.add_option('-q', '--stats-only', action='store_true',
+                      help="don't print the timeline")
+    opts, args = parser.parse_args()
+
+    if not opts.serial and len(args) != 1:
+        parser.error('need a dump file or --serial')
+
+    try:
+        if opts.serial:
+            data = read_serial(opts.serial, opts.baud, opts.timeout)
+        else:
+            f = open(args[0], 'rb')
+            data = f.read()
+            f.close()
+        cpu_hz, n, count, entries = parse(data)
+    except ValueError as e:
+        print('i2c-trace: %s' % e, file=sys.stderr)
+        return 1
+    if opts.hz:
+        cpu_hz = opts.hz
+
+    print('%d events recorded, %d in buffer (%d dropped), %d Hz clock' %
+          (count, n, count - n, cpu_hz))
+    if not entries:
+        return 0
+    if not opts.stats_only:
+        print_timeline(cpu_hz, entries)
+    print_stats(cpu_hz, entries)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
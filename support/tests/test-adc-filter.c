@@ -0,0 +1,131 @@
+/*
+ * Host-side unit test for libmaple/adc_filter.c.
+ *
+ * The filters don't touch any hardware, so they are checked here
+ * against reference vectors with the host's C compiler; run
+ * "make host-test".  examples/test-adc-filter.cpp measures their
+ * speed on the board.
+ *
+ * This file is released into the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "adc_filter.h"
+
+static int failures;
+
+/* Stands in for libmaple's ASSERT() failure routine. */
+void _fail(const char *file, int line, const char *exp) {
+    printf("ASSERT failed at %s:%d: %s\n", file, line, exp);
+    exit(1);
+}
+
+static void check(const char *name, const uint16 *got, uint16 ngot,
+                  const uint16 *want, uint16 nwant) {
+    int ok = ngot == nwant;
+    uint16 i;
+
+    for (i = 0; ok && i < nwant; i++) {
+        ok = got[i] == want[i];
+    }
+    printf("%s: %s\n", name, ok ? "ok" : "FAILED");
+    if (!ok) {
+        printf("\tgot ");
+        for (i = 0; i < ngot; i++) {
+            printf(" %u", got[i]);
+        }
+        printf("\n\twant");
+        for (i = 0; i < nwant; i++) {
+            printf(" %u", want[i]);
+        }
+        printf("\n");
+        failures++;
+    }
+}
+
+/* Boxcar of 4 over a ramp: rounded means of each group of 4 */
+static void test_boxcar(void) {
+    static const uint16 want[] = {2, 6, 10, 14};
+    uint16 in[16], out[16], i, n;
+    adc_cic cic;
+
+    for (i = 0; i < 16; i++) {
+        in[i] = i;
+    }
+    adc_cic_init(&cic, 1, 1, 4, 12);
+    n = adc_cic_process(&cic, in, 16, out);
+    check("boxcar", out, n, want, 4);
+}
+
+/* Second order, ratio 4: the step response is 10/16 of full, then
+ * full. */
+static void test_cic2(void) {
+    static const uint16 want[] = {63, 100, 100};
+    uint16 in[12], out[12], i, n;
+    adc_cic cic;
+
+    for (i = 0; i < 12; i++) {
+        in[i] = 100;
+    }
+    adc_cic_init(&cic, 1, 2, 4, 12);
+    n = adc_cic_process(&cic, in, 12, out);
+    check("CIC order 2", out, n, want, 3);
+}
+
+/* Two interleaved channels, fed a sample at a time */
+static void test_interleaved(void) {
+    static const uint16 want[] = {1000, 2000, 1000, 2000};
+    uint16 in[8], out[8], i, n;
+    adc_cic cic;
+
+    for (i = 0; i < 8; i++) {
+        in[i] = i & 1 ? 2000 : 1000;
+    }
+    adc_cic_init(&cic, 2, 1, 2, 12);
+    n = 0;
+    for (i = 0; i < 8; i++) {
+        n += adc_cic_process(&cic, &in[i], 1, &out[n]);
+    }
+    check("interleaved", out, n, want, 4);
+}
+
+/* Full scale oversampled to 14 bits */
+static void test_oversample(void) {
+    static const uint16 want[] = {16380};
+    uint16 in[16], out[16], i, n;
+    adc_cic cic;
+
+    for (i = 0; i < 16; i++) {
+        in[i] = 4095;
+    }
+    adc_oversample_init(&cic, 1, 14);
+    n = adc_cic_process(&cic, in, 16, out);
+    check("oversample", out, n, want, 1);
+}
+
+/* Window of 4, ramping up from zeroed history, in place */
+static void test_moving_avg(void) {
+    static const uint16 want[] = {0, 1, 3, 6, 10, 14};
+    uint16 in[6], history[4], i;
+    adc_moving_avg avg;
+
+    for (i = 0; i < 6; i++) {
+        in[i] = 4 * i;
+    }
+    adc_moving_avg_init(&avg, history, 1, 4);
+    adc_moving_avg_process(&avg, in, 6, in);
+    check("moving average", in, 6, want, 6);
+}
+
+int main(void) {
+    test_boxcar();
+    test_cic2();
+    test_interleaved();
+    test_oversample();
+    test_moving_avg();
+
+    printf("%d failures\n", failures);
+    return failures != 0;
+}
@@ -24,6 +24,7 @@
 #include "Print.h"
 
 #include <limits.h>
+#include <string.h>
 
 #ifndef LLONG_MAX
 /*
@@ -40,6 +41,7 @@
 #define LLONG_MAX 9223372036854775807LL
 #endif
 
+#include "util.h"
 #include "wirish_math.h"
 
 /*
@@ -47,9 +49,7 @@
  */
 
 void Print::write(const char *str) {
-    while (*str) {
-        write(*str++);
-    }
+    write(str, strlen(str));
 }
 
 void Print::write(const void *buffer, uint32 size) {
@@ -60,7 +60,7 @@ void Print::write(const void *buffer, uint32 size) {
 }
 
 void Print::print(uint8 b, int base) {
-    print((uint64)b, base);
+    print((unsigned long)b, base);
 }
 
 void Print::print(char c) {
@@ -72,19 +72,31 @@ void Print::print(const char str[]) {
 }
 
 void Print::print(int n, int base) {
-    print((long long)n, base);
+    print((long)n, base);
 }
 
 void Print::print(unsigned int n, int base) {
-    print((unsigned long long)n, base);
+    print((unsigned long)n, base);
 }
 
 void Print::print(long n, int base) {
-    print((long long)n, base);
+    if (base == BYTE) {
+        write((uint8)n);
+        return;
+    }
+    if (n < 0) {
+        printNumber((uint32)0 - (uint32)n, base, true);
+    } else {
+        printNumber((uint32)n, base, false);
+    }
 }
 
 void Print::print(unsigned long n, int base) {
-    print((unsigned long long)n, base);
+    if (base == BYTE) {
+        write((uint8)n);
+    } else {
+        printNumber((uint32)n, base, false);
+    }
 }
 
 void Print::print(long long n, int base) {
@@ -93,17 +105,17 @@ void Print::print(long long n, int base) {
         return;
     }
     if (n < 0) {
-        print('-');
-        n = -n;
+        printNumber((uint64)0 - (uint64)n, base, true);
+    } else {
+        printNumber((uint64)n, base, false);
     }
-    printNumber(n, base);
 }
 
 void Print::print(unsigned long long n, int base) {
     if (base == BYTE) {
         write((uint8)n);
     } else {
-        printNumber(n, base);
+        printNumber((uint64)n, base, false);
     }
 }
 
@@ -112,8 +124,7 @@ void Print::print(double n, int digits) {
 }
 
 void Print::println(void) {
-    print('\r');
-    print('\n');
+    write("\r\n", 2);
 }
 
 void Print::println(char c) {
@@ -142,12 +153,12 @@ void Print::println(unsigned int n, int base) {
 }
 
 void Print::println(long n, int base) {
-    print((long long)n, base);
+    print(n, base);
     println();
 }
 
 void Print::println(unsigned long n, int base) {
-    print((unsigned long long)n, base);
+    print(n, base);
     println();
 }
 
@@ -166,29 +177,106 @@ void Print::println(double n, int digits) {
     println();
 }
 
+void Print::printlnFixed(int32 value, uint8 fracBits, uint8 digits) {
+    printFixed(value, fracBits, digits);
+    println();
+}
+
 /*
  * Private methods
  */
 
-void Print::printNumber(unsigned long long n, uint8 base) {
-    unsigned char buf[CHAR_BIT * sizeof(long long)];
-    unsigned long i = 0;
+/*
+ * Numbers are rendered right-to-left into a stack buffer, then handed
+ * to write(const void*, uint32) all at once.  Subclasses which
+ * override the bulk write thus see one call per number, rather than
+ * one per digit.
+ */
 
-    if (n == 0) {
-        print('0');
-        return;
+/* Enough room for a 64-bit value in base 2, plus a sign. */
+#define NUMBER_BUF_SIZE (CHAR_BIT * sizeof(long long) + 1)
+
+static inline char digit_char(uint32 d) {
+    return d < 10 ? '0' + d : 'A' + d - 10;
+}
+
+/* Renders n into the characters before end, returning a pointer to
+ * the first one.  Base 10 divides by a constant, which GCC turns into
+ * a multiply; power-of-two bases get by with shifts and masks. */
+static char* format_u32(char *end, uint32 n, uint8 base) {
+    char *p = end;
+
+    if (base == DEC) {
+        do {
+            uint32 q = n / 10;
+            *--p = '0' + (n - q * 10);
+            n = q;
+        } while (n);
+    } else if (IS_POWER_OF_TWO(base)) {
+        uint32 shift = __builtin_ctz(base);
+        uint32 mask = base - 1;
+        do {
+            *--p = digit_char(n & mask);
+            n >>= shift;
+        } while (n);
+    } else {
+        do {
+            uint32 q = n / base;
+            *--p = digit_char(n - q * base);
+            n = q;
+        } while (n);
     }
 
-    while (n > 0) {
-        buf[i++] = n % base;
-        n /= base;
+    return p;
+}
+
+/* 64-bit division is a libgcc call on Cortex-M3, so only do as much
+ * of it as it takes to bring n down to 32 bits.  In base 10, that's
+ * at most two divisions, each of which peels off nine digits. */
+static char* format_u64(char *end, uint64 n, uint8 base) {
+    char *p = end;
+
+    if (base == DEC) {
+        while (n >> 32) {
+            uint64 q = n / 1000000000;
+            char *chunk = p - 9;
+            p = format_u32(p, (uint32)(n - q * 1000000000), DEC);
+            while (p > chunk) {
+                *--p = '0';
+            }
+            n = q;
+        }
+    } else {
+        while (n >> 32) {
+            uint64 q = n / base;
+            *--p = digit_char((uint32)(n - q * base));
+            n = q;
+        }
+    }
+
+    return format_u32(p, (uint32)n, base);
+}
+
+void Print::printNumber(uint32 n, uint8 base, bool negative) {
+    char buf[NUMBER_BUF_SIZE];
+    char *end = buf + sizeof(buf);
+    char *p = format_u32(end, n, base);
+
+    if (negative) {
+        *--p = '-';
     }
+    write(p, end - p);
+}
+
+void Print::printNumber(uint64 n, uint8 base, bool negative) {
+    char buf[NUMBER_BUF_SIZE];
+    char *end = buf + sizeof(buf);
+    char *p = format_u64(end, n, base);
 
-    for (; i > 0; i--) {
-        print((char)(buf[i - 1] < 10 ?
-                     '0' + buf[i - 1] :
-                     'A' + buf[i - 1] - 10));
+    if (negative) {
+        *--p = '-';
     }
+    write(p, end - p);
 }
 
 /* According to snprintf(),
@@ -198,9 +286,65 @@ void Print::printNumber(unsigned long long n, uint8 base) {
  * This slightly smaller value was picked semi-arbitrarily. */
 #define LARGE_DOUBLE_TRESHOLD (9.1e18)
 
+/* Most fractional digits format_fraction() will produce; 10^19 is
+ * the largest power of ten that fits in 64 bits.  Precision past that
+ * is printed as trailing zeros. */
+#define MAX_FRACTION_DIGITS 19
+
+static const uint64 powers_of_ten[MAX_FRACTION_DIGITS + 1] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL,
+};
+
+/* Renders int_part, a decimal point, and fraction zero-padded to
+ * digits places into the characters before end.  fraction must be
+ * below 10^digits. */
+static char* format_fraction(char *end, uint64 int_part, uint64 fraction,
+                             uint8 digits) {
+    char *p = end;
+    if (digits > 0) {
+        char *stop = end - digits;
+        p = format_u64(p, fraction, DEC);
+        while (p > stop) {
+            *--p = '0';
+        }
+        *--p = '.';
+    }
+    return format_u64(p, int_part, DEC);
+}
+
+/* Renders the magnitude of x, rounded to the given number of
+ * fractional digits (at most MAX_FRACTION_DIGITS), into the
+ * characters before end.  The soft-float work is limited to splitting
+ * x into integer and fractional parts and scaling the fraction once;
+ * every digit is then produced with integer arithmetic.  abs(x) must
+ * be below LARGE_DOUBLE_TRESHOLD. */
+static char* format_double(char *end, double x, uint8 digits) {
+    uint64 int_part, scale, fraction;
+
+    if (x < 0.0) {
+        x = -x;
+    }
+
+    int_part = (uint64)x;
+    scale = powers_of_ten[digits];
+    fraction = (uint64)((x - (double)int_part) * (double)scale + 0.5);
+    if (fraction >= scale) {
+        fraction -= scale;
+        int_part++;
+    }
+    return format_fraction(end, int_part, fraction, digits);
+}
+
+static const char zeros[] = "0000000000000000";
+
 /* THIS FUNCTION SHOULDN'T BE USED IF YOU NEED ACCURATE RESULTS.
  *
- * This implementation is meant to be simple and not occupy too much
+ * This implementation is meant to be fast and not occupy too much
  * code size.  However, printing floating point values accurately is a
  * subtle task, best left to a well-tested library function.
  *
@@ -209,6 +353,11 @@ void Print::printNumber(unsigned long long n, uint8 base) {
  * http://kurtstephens.com/files/p372-steele.pdf
  */
 void Print::printFloat(double number, uint8 digits) {
+    char buf[NUMBER_BUF_SIZE];
+    char *end = buf + sizeof(buf);
+    char *p;
+    uint8 extra = 0;
+
     // Hackish fail-fast behavior for large-magnitude doubles
     if (abs(number) >= LARGE_DOUBLE_TRESHOLD) {
         if (number < 0.0) {
@@ -218,35 +367,372 @@ void Print::printFloat(double number, uint8 digits) {
         return;
     }
 
-    // Handle negative numbers
+    if (digits > MAX_FRACTION_DIGITS) {
+        extra = digits - MAX_FRACTION_DIGITS;
+        digits = MAX_FRACTION_DIGITS;
+    }
+    p = format_double(end, number, digits);
     if (number < 0.0) {
-        print('-');
-        number = -number;
+        *--p = '-';
     }
+    write(p, end - p);
+    while (extra > 0) {
+        uint8 chunk = min(extra, (uint8)(sizeof(zeros) - 1));
+        write(zeros, chunk);
+        extra -= chunk;
+    }
+}
 
-    // Simplistic rounding strategy so that e.g. print(1.999, 2)
-    // prints as "2.00"
-    double rounding = 0.5;
-    for (uint8 i = 0; i < digits; i++) {
-        rounding /= 10.0;
+/* Prints a signed fixed-point value with fracBits fractional bits
+ * (e.g. 16 for Q16.16, 15 for Q15, 31 for Q31), rounded to the given
+ * number of decimal places, using integer arithmetic only. */
+void Print::printFixed(int32 value, uint8 fracBits, uint8 digits) {
+    char buf[NUMBER_BUF_SIZE];
+    char *end = buf + sizeof(buf);
+    char *p;
+    uint32 magnitude = value < 0 ? (uint32)0 - (uint32)value : value;
+    uint32 int_part, frac_mask;
+    uint64 scale, fraction;
+
+    if (fracBits > 31) {
+        fracBits = 31;
+    }
+    if (digits > 9) {
+        digits = 9;
     }
-    number += rounding;
 
-    // Extract the integer part of the number and print it
-    long long int_part = (long long)number;
-    double remainder = number - int_part;
-    print(int_part);
+    int_part = fracBits ? magnitude >> fracBits : magnitude;
+    frac_mask = fracBits ? ((uint32)1 << fracBits) - 1 : 0;
+    scale = powers_of_ten[digits];
 
-    // Print the decimal point, but only if there are digits beyond
-    if (digits > 0) {
-        print(".");
+    /* (mask * 10^9) < 2^61, so this cannot overflow. */
+    fraction = (uint64)(magnitude & frac_mask) * scale;
+    if (fracBits) {
+        fraction = (fraction + ((uint64)1 << (fracBits - 1))) >> fracBits;
+    }
+    if (fraction >= scale) {
+        fraction -= scale;
+        int_part++;
+    }
+
+    p = format_fraction(end, int_part, fraction, digits);
+    if (value < 0) {
+        *--p = '-';
+    }
+    write(p, end - p);
+}
+
+/*
+ * printf()
+ *
+ * A small, allocation-free subset of printf(3).  The format attribute
+ * on the declarations in Print.h makes GCC check each call's
+ * arguments against its format string at compile time.
+ *
+ * Supported: the '-', '0', '+', and ' ' flags, '#' with o, x, and X,
+ * field width and precision (either may be '*'), the hh, h, l, ll, j,
+ * z, and t length modifiers, and the d, i, u, o, x, X, c, s, p, f,
+ * F, and % conversions.  e, E, g, and G are printed as f.  Floating
+ * point precision defaults to 6 and is capped at 19 digits; halfway
+ * cases round away from zero.
+ *
+ * Literal runs of the format string and each converted field are
+ * handed to write(const void*, uint32) whole.
+ */
+
+static const char spaces[] = "                ";
+
+static void print_padding(Print *p, const char *pad, int32 n) {
+    while (n > 0) {
+        uint32 chunk = n < (int32)sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+        p->write(pad, chunk);
+        n -= chunk;
     }
+}
+
+void Print::printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
 
-    // Extract digits from the remainder one at a time
-    while (digits-- > 0) {
-        remainder *= 10.0;
-        int to_print = (int)remainder;
-        print(to_print);
-        remainder -= to_print;
+void Print::vprintf(const char *fmt, va_list args) {
+    char buf[NUMBER_BUF_SIZE];
+    char *end = buf + sizeof(buf);
+
+    while (*fmt) {
+        const char *run = fmt;
+        while (*fmt && *fmt != '%') {
+            fmt++;
+        }
+        if (fmt != run) {
+            write(run, fmt - run);
+        }
+        if (!*fmt) {
+            break;
+        }
+        fmt++;
+
+        /* Flags */
+        bool left = false, zero_pad = false, alt = false;
+        char sign = 0;
+        for (;; fmt++) {
+            if (*fmt == '-') {
+                left = true;
+            } else if (*fmt == '0') {
+                zero_pad = true;
+            } else if (*fmt == '+') {
+                sign = '+';
+            } else if (*fmt == ' ') {
+                if (!sign) {
+                    sign = ' ';
+                }
+            } else if (*fmt == '#') {
+                alt = true;
+            } else {
+                break;
+            }
+        }
+
+        /* Field width */
+        int32 width = 0;
+        if (*fmt == '*') {
+            width = va_arg(args, int);
+            if (width < 0) {
+                left = true;
+                width = -width;
+            }
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9') {
+                width = width * 10 + (*fmt++ - '0');
+            }
+        }
+
+        /* Precision */
+        int32 precision = -1;
+        if (*fmt == '.') {
+            fmt++;
+            precision = 0;
+            if (*fmt == '*') {
+                precision = va_arg(args, int);
+                if (precision < 0) {
+                    precision = -1;
+                }
+                fmt++;
+            } else {
+                while (*fmt >= '0' && *fmt <= '9') {
+                    precision = precision * 10 + (*fmt++ - '0');
+                }
+            }
+        }
+
+        /* Length modifiers.  Only "ll" and "j" need 64 bits; h and hh
+         * just truncate the promoted int. */
+        bool wide = false;
+        uint8 narrow = 0;
+        for (;; fmt++) {
+            if (*fmt == 'l') {
+                wide = (fmt[1] == 'l');
+                fmt += wide;
+            } else if (*fmt == 'j') {
+                wide = true;
+            } else if (*fmt == 'h') {
+                narrow++;
+            } else if (*fmt != 'z' && *fmt != 't') {
+                break;
+            }
+        }
+
+        const char *prefix = "";
+        uint32 prefix_len = 0;
+        char *p = end;
+        uint64 u = 0;
+        uint8 base = 0;
+
+        switch (*fmt) {
+        case 'd':
+        case 'i': {
+            int64 v;
+            if (wide) {
+                v = va_arg(args, long long);
+            } else {
+                v = va_arg(args, int);
+                if (narrow == 1) {
+                    v = (int16)v;
+                } else if (narrow > 1) {
+                    v = (int8)v;
+                }
+            }
+            if (v < 0) {
+                u = (uint64)0 - (uint64)v;
+                sign = '-';
+            } else {
+                u = v;
+            }
+            if (sign) {
+                prefix = &sign;
+                prefix_len = 1;
+            }
+            base = DEC;
+            break;
+        }
+        case 'u':
+            base = DEC;
+            break;
+        case 'o':
+            base = OCT;
+            if (alt) {
+                prefix = "0";
+                prefix_len = 1;
+            }
+            break;
+        case 'x':
+            base = HEX;
+            if (alt) {
+                prefix = "0x";
+                prefix_len = 2;
+            }
+            break;
+        case 'X':
+            base = HEX;
+            if (alt) {
+                prefix = "0X";
+                prefix_len = 2;
+            }
+            break;
+        case 'p':
+            u = (uint32)va_arg(args, void*);
+            p = format_u32(end, (uint32)u, HEX);
+            prefix = "0x";
+            prefix_len = 2;
+            break;
+        case 'c':
+            *--p = (char)va_arg(args, int);
+            zero_pad = false;
+            break;
+        case 's': {
+            const char *s = va_arg(args, const char*);
+            uint32 len = 0;
+            if (!s) {
+                s = "(null)";
+            }
+            while (s[len] && (precision < 0 || len < (uint32)precision)) {
+                len++;
+            }
+            if (!left && width > (int32)len) {
+                print_padding(this, spaces, width - len);
+            }
+            write(s, len);
+            if (left && width > (int32)len) {
+                print_padding(this, spaces, width - len);
+            }
+            fmt++;
+            continue;
+        }
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G': {
+            double x = va_arg(args, double);
+            if (x < 0.0) {
+                sign = '-';
+            }
+            if (sign) {
+                prefix = &sign;
+                prefix_len = 1;
+            }
+            if (x != x) {
+                p = end - 3;
+                memcpy(p, "nan", 3);
+                zero_pad = false;
+            } else if (abs(x) >= LARGE_DOUBLE_TRESHOLD) {
+                p = end - 14;
+                memcpy(p, "<large double>", 14);
+                zero_pad = false;
+            } else {
+                if (precision < 0) {
+                    precision = 6;
+                }
+                p = format_double(end, x,
+                                  min(precision, MAX_FRACTION_DIGITS));
+            }
+            break;
+        }
+        case '%':
+            *--p = '%';
+            break;
+        default:
+            /* Unknown conversion; GCC will already have complained. */
+            if (!*fmt) {
+                return;
+            }
+            *--p = *fmt;
+            break;
+        }
+
+        if (base) {
+            if (*fmt == 'd' || *fmt == 'i') {
+                /* Already fetched above */
+            } else if (wide) {
+                u = va_arg(args, unsigned long long);
+            } else {
+                u = va_arg(args, unsigned int);
+                if (narrow == 1) {
+                    u = (uint16)u;
+                } else if (narrow > 1) {
+                    u = (uint8)u;
+                }
+            }
+
+            if (precision == 0 && u == 0) {
+                p = end;
+            } else if (wide) {
+                p = format_u64(end, u, base);
+            } else {
+                p = format_u32(end, (uint32)u, base);
+            }
+            if (precision >= 0) {
+                char *stop = end - min(precision, (int32)sizeof(buf));
+                while (p > stop) {
+                    *--p = '0';
+                }
+                zero_pad = false;
+            }
+
+            /* As in C, '#' leaves a zero alone, and o's prefix is only
+             * needed if the digits don't already start with 0. */
+            if ((*fmt == 'x' || *fmt == 'X') && u == 0) {
+                prefix_len = 0;
+            } else if (*fmt == 'o' && p < end && *p == '0') {
+                prefix_len = 0;
+            }
+        }
+        if (*fmt == 'x' || *fmt == 'p') {
+            for (char *q = p; q < end; q++) {
+                if (*q >= 'A') {
+                    *q += 'a' - 'A';
+                }
+            }
+        }
+        fmt++;
+
+        int32 pad = width - (int32)(prefix_len + (end - p));
+        if (!left && !zero_pad) {
+            print_padding(this, spaces, pad);
+        }
+        if (prefix_len) {
+            write(prefix, prefix_len);
+        }
+        if (!left && zero_pad) {
+            print_padding(this, zeros, pad);
+        }
+        write(p, end - p);
+        if (left) {
+            print_padding(this, spaces, pad);
+        }
     }
 }
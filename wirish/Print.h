@@ -23,6 +23,8 @@
 #ifndef _PRINT_H_
 #define _PRINT_H_
 
+#include <stdarg.h>
+
 #include "libmaple_types.h"
 
 enum {
@@ -59,8 +61,15 @@ public:
     void println(long long, int=DEC);
     void println(unsigned long long, int=DEC);
     void println(double, int=2);
+    void printFixed(int32 value, uint8 fracBits, uint8 digits=2);
+    void printlnFixed(int32 value, uint8 fracBits, uint8 digits=2);
+    void printf(const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+    void vprintf(const char *fmt, va_list args)
+        __attribute__((format(printf, 2, 0)));
 private:
-    void printNumber(unsigned long long, uint8);
+    void printNumber(uint32, uint8, bool);
+    void printNumber(uint64, uint8, bool);
     void printFloat(double, uint8);
 };
 
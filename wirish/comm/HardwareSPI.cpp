@@ -51,7 +51,17 @@ static void enable_device(spi_dev *dev,
                           bool as_master,
                           SPIFrequency frequency,
                           spi_cfg_flag endianness,
-                          spi_mode mode);
+                          spi_mode mode,
+                          bool hw_nss=false);
+
+static bool dev_to_dma_reqs(spi_dev *dev,
+                            dma_request_line *rx_req,
+                            dma_request_line *tx_req);
+static void discard_rx(spi_dev *dev);
+static void cs_write(uint8 pin, uint8 value);
+
+/* Ports in beginSlaveRing() mode, for the NSS interrupt handlers. */
+static HardwareSPI *ring_ports[3];
 
 static const spi_pins board_spi_pins[] __FLASH__ = {
     {BOARD_SPI1_NSS_PIN,
@@ -76,6 +86,15 @@ static const spi_pins board_spi_pins[] __FLASH__ = {
  */
 
 HardwareSPI::HardwareSPI(uint32 spi_num) {
+    this->have_dma = false;
+    this->queue_head = NULL;
+    this->queue_tail = NULL;
+    this->xfer_offset = 0;
+    this->dummy_tx = 0xFFFF;
+    this->ring_buf = NULL;
+    this->response_buf = NULL;
+    this->response_len = 0;
+
     switch (spi_num) {
     case 1:
         this->spi_d = SPI1;
@@ -125,11 +144,127 @@ void HardwareSPI::beginSlave(void) {
     this->beginSlave(MSBFIRST, 0);
 }
 
+bool HardwareSPI::beginSlaveRing(uint8 *buf, uint16 size,
+                                 uint32 bitOrder, uint32 mode) {
+    static const voidFuncPtr nss_irqs[] = {
+        HardwareSPI::nssIRQ1,
+        HardwareSPI::nssIRQ2,
+        HardwareSPI::nssIRQ3,
+    };
+    static const voidFuncPtr lap_irqs[] = {
+        HardwareSPI::ringLapIRQ1,
+        HardwareSPI::ringLapIRQ2,
+        HardwareSPI::ringLapIRQ3,
+    };
+    spi_dev *dev = this->spi_d;
+    uint32 port = dev_to_spi_pins(dev) - board_spi_pins;
+
+    if (mode >= 4 || size < 2) {
+        ASSERT(0);
+        return false;
+    }
+    if (!this->claimDMA()) {
+        return false;
+    }
+
+    this->ring_buf = buf;
+    this->ring_size = size;
+    this->ring_total = 0;
+    this->ring_laps = 0;
+    this->frame_head = 0;
+    this->frame_tail = 0;
+    this->frames_dropped = 0;
+    this->frames_lapped = 0;
+
+    spi_cfg_flag end = bitOrder == MSBFIRST ? SPI_FRAME_MSB : SPI_FRAME_LSB;
+    enable_device(dev, false, (SPIFrequency)0, end, (spi_mode)mode, true);
+
+    dma_setup_transfer(this->dma_d, this->rx_dma_ch,
+                       &dev->regs->DR, DMA_SIZE_8BITS,
+                       buf,            DMA_SIZE_8BITS,
+                       DMA_MINC_MODE | DMA_CIRC_MODE | DMA_TRNS_CMPLT);
+    dma_set_num_transfers(this->dma_d, this->rx_dma_ch, size);
+    /* Counting laps tells frames the ring's size or longer apart from
+     * short ones. */
+    ring_ports[port] = this;
+    dma_attach_interrupt(this->dma_d, this->rx_dma_ch, lap_irqs[port]);
+    dma_enable(this->dma_d, this->rx_dma_ch);
+    dma_setup_transfer(this->dma_d, this->tx_dma_ch,
+                       &dev->regs->DR, DMA_SIZE_8BITS,
+                       NULL,           DMA_SIZE_8BITS,
+                       DMA_MINC_MODE | DMA_FROM_MEM);
+    spi_rx_dma_enable(dev);
+
+    uint32 primask = nvic_globalirq_save();
+    this->armSlaveResponse();
+    nvic_globalirq_restore(primask);
+
+    attachInterrupt(this->nssPin(), nss_irqs[port], RISING);
+    return true;
+}
+
+void HardwareSPI::setSlaveResponse(const uint8 *buf, uint16 len) {
+    uint32 primask = nvic_globalirq_save();
+    this->response_buf = buf;
+    this->response_len = buf ? len : 0;
+    /* If no frame is in progress, get it ready now; otherwise, the
+     * NSS interrupt will when the frame ends. */
+    if (this->ring_buf) {
+        this->armSlaveResponse();
+    }
+    nvic_globalirq_restore(primask);
+}
+
+uint32 HardwareSPI::framesAvailable(void) {
+    return this->frame_head - this->frame_tail;
+}
+
+uint32 HardwareSPI::readFrame(uint8 *buf, uint32 max_len) {
+    while (this->frame_head != this->frame_tail) {
+        uint32 tail = this->frame_tail;
+        SlaveFrame *f = &this->frames[tail % SPI_SLAVE_FRAME_QUEUE_SIZE];
+        uint32 start = f->start;
+        uint32 len = f->length;
+        uint32 n = len < max_len ? len : max_len;
+        uint32 pos = start % this->ring_size;
+
+        for (uint32 i = 0; i < n; i++) {
+            buf[i] = this->ring_buf[pos];
+            if (++pos == this->ring_size) {
+                pos = 0;
+            }
+        }
+        this->frame_tail = tail + 1;
+
+        /* If DMA has lapped the frame's start, what we copied may be
+         * newer data. */
+        if (this->ringWritten() - start <= this->ring_size) {
+            return len;
+        }
+        this->frames_lapped++;
+    }
+    return 0;
+}
+
+uint32 HardwareSPI::droppedFrames(void) {
+    return this->frames_dropped + this->frames_lapped;
+}
+
 void HardwareSPI::end(void) {
     if (!spi_is_enabled(this->spi_d)) {
         return;
     }
 
+    while (!this->isIdle())
+        ;
+    if (this->ring_buf) {
+        detachInterrupt(this->nssPin());
+        spi_rx_dma_disable(this->spi_d);
+        spi_tx_dma_disable(this->spi_d);
+        this->ring_buf = NULL;
+    }
+    this->releaseDMA();
+
     // Follows RM0008's sequence for disabling a SPI in master/slave
     // full duplex mode.
     while (spi_is_rx_nonempty(this->spi_d)) {
@@ -178,6 +313,355 @@ uint8 HardwareSPI::transfer(uint8 byte) {
     return this->read();
 }
 
+void HardwareSPI::transfer(const uint8 *tx_buf, uint8 *rx_buf, uint32 len) {
+    this->transferBlocking(tx_buf, rx_buf, len, 0);
+}
+
+void HardwareSPI::write16(const uint16 *buf, uint32 len) {
+    this->transferBlocking(buf, NULL, len, SPI_TRANSACTION_16BIT);
+}
+
+void HardwareSPI::transfer16(const uint16 *tx_buf, uint16 *rx_buf,
+                             uint32 len) {
+    this->transferBlocking(tx_buf, rx_buf, len, SPI_TRANSACTION_16BIT);
+}
+
+void HardwareSPI::fill16(uint16 value, uint32 count) {
+    this->transferBlocking(&value, NULL, count,
+                           SPI_TRANSACTION_16BIT | SPI_TRANSACTION_TX_FILL);
+}
+
+void HardwareSPI::transferBlocking(const void *tx_buf, void *rx_buf,
+                                   uint32 len, uint32 flags) {
+    spi_dev *dev = this->spi_d;
+    bool wide = flags & SPI_TRANSACTION_16BIT;
+    uint32 tx_step = (flags & SPI_TRANSACTION_TX_FILL) ? 0 : 1;
+
+    if (this->claimDMA()) {
+        SPITransaction t;
+        t.csPin = SPI_NO_CS;
+        t.txBuffer = tx_buf;
+        t.rxBuffer = rx_buf;
+        t.length = len;
+        t.callback = NULL;
+        this->queue(&t, flags);
+        while (!t.done)
+            ;
+        return;
+    }
+
+    discard_rx(dev);
+    spi_set_dff(dev, wide ? SPI_DFF_16_BIT : SPI_DFF_8_BIT);
+    for (uint32 i = 0; i < len; i++) {
+        uint16 out = 0xFFFF;
+        if (tx_buf) {
+            out = (wide ?
+                   ((const uint16*)tx_buf)[i * tx_step] :
+                   ((const uint8*)tx_buf)[i * tx_step]);
+        }
+        while (!spi_is_tx_empty(dev))
+            ;
+        spi_tx_reg(dev, out);
+        while (!spi_is_rx_nonempty(dev))
+            ;
+        uint16 in = spi_rx_reg(dev);
+        if (rx_buf) {
+            if (wide) {
+                ((uint16*)rx_buf)[i] = in;
+            } else {
+                ((uint8*)rx_buf)[i] = (uint8)in;
+            }
+        }
+    }
+    if (wide) {
+        discard_rx(dev);
+        spi_set_dff(dev, SPI_DFF_8_BIT);
+    }
+}
+
+/*
+ * DMA transactions
+ */
+
+bool HardwareSPI::queue(SPITransaction *t, uint32 flags) {
+    if (!this->claimDMA()) {
+        return false;
+    }
+
+    t->next = NULL;
+    t->flags = flags;
+    t->done = 0;
+    t->error = 0;
+    if (t->length == 0) {
+        t->done = 1;
+        if (t->callback) {
+            t->callback(t);
+        }
+        return true;
+    }
+
+    uint32 primask = nvic_globalirq_save();
+    if (this->queue_head) {
+        this->queue_tail->next = t;
+        this->queue_tail = t;
+    } else {
+        this->queue_head = this->queue_tail = t;
+        discard_rx(this->spi_d);
+        this->startChunk(t);
+    }
+    nvic_globalirq_restore(primask);
+    return true;
+}
+
+bool HardwareSPI::isIdle(void) {
+    return this->queue_head == NULL;
+}
+
+bool HardwareSPI::claimDMA(void) {
+    dma_request_line rx_req, tx_req;
+    dma_dev *tx_dev;
+
+    if (this->have_dma) {
+        return true;
+    }
+    if (!dev_to_dma_reqs(this->spi_d, &rx_req, &tx_req)) {
+        return false;
+    }
+    if (dma_request_channel(rx_req, DMA_PRIORITY_HIGH, "HardwareSPI RX",
+                            &this->dma_d, &this->rx_dma_ch) < 0) {
+        return false;
+    }
+    if (dma_request_channel(tx_req, DMA_PRIORITY_MEDIUM, "HardwareSPI TX",
+                            &tx_dev, &this->tx_dma_ch) < 0) {
+        dma_release_channel(this->dma_d, this->rx_dma_ch);
+        return false;
+    }
+    this->have_dma = true;
+    return true;
+}
+
+void HardwareSPI::releaseDMA(void) {
+    if (!this->have_dma) {
+        return;
+    }
+    dma_release_channel(this->dma_d, this->rx_dma_ch);
+    dma_release_channel(this->dma_d, this->tx_dma_ch);
+    this->have_dma = false;
+}
+
+/* Start the next (at most 65535-frame) piece of a transaction.  RX is
+ * set up before TX, so no received frame can be missed. */
+void HardwareSPI::startChunk(SPITransaction *t) {
+    spi_dev *dev = this->spi_d;
+    uint32 left = t->length - this->xfer_offset;
+    bool wide = t->flags & SPI_TRANSACTION_16BIT;
+    dma_xfer_size size = wide ? DMA_SIZE_16BITS : DMA_SIZE_8BITS;
+    uint32 offset = this->xfer_offset << size;
+    dma_xfer rx, tx;
+
+    if (this->xfer_offset == 0) {
+        /* The bus is idle between transactions. */
+        spi_set_dff(dev, wide ? SPI_DFF_16_BIT : SPI_DFF_8_BIT);
+        cs_write(t->csPin, LOW);
+    }
+    this->chunk_length = left > 0xFFFF ? 0xFFFF : left;
+
+    rx.peripheral_address = &dev->regs->DR;
+    rx.peripheral_size = size;
+    rx.memory_size = size;
+    rx.num_transfers = this->chunk_length;
+    rx.priority = DMA_PRIORITY_HIGH;
+    rx.callback = HardwareSPI::dmaRxCallback;
+    rx.arg = this;
+    if (t->rxBuffer) {
+        rx.memory_address = (uint8*)t->rxBuffer + offset;
+        rx.mode = DMA_MINC_MODE;
+    } else {
+        rx.memory_address = &this->dummy_rx;
+        rx.mode = 0;
+    }
+
+    tx = rx;
+    tx.priority = DMA_PRIORITY_MEDIUM;
+    tx.callback = NULL;
+    if (t->txBuffer && (t->flags & SPI_TRANSACTION_TX_FILL)) {
+        tx.memory_address = (void*)t->txBuffer;
+        tx.mode = DMA_FROM_MEM;
+    } else if (t->txBuffer) {
+        tx.memory_address = (uint8*)t->txBuffer + offset;
+        tx.mode = DMA_FROM_MEM | DMA_MINC_MODE;
+    } else {
+        tx.memory_address = &this->dummy_tx;
+        tx.mode = DMA_FROM_MEM;
+    }
+
+    dma_queue_xfer(this->dma_d, this->rx_dma_ch, &rx);
+    dma_queue_xfer(this->dma_d, this->tx_dma_ch, &tx);
+    dev->regs->CR2 |= SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+}
+
+/*
+ * Slave receive ring
+ */
+
+/* Total number of bytes DMA has written into the ring, including the
+ * frame in progress. */
+uint32 HardwareSPI::ringWritten(void) {
+    dma_channel_reg_map *rx = dma_channel_regs(this->dma_d, this->rx_dma_ch);
+    uint32 primask = nvic_globalirq_save();
+    uint32 laps = this->ring_laps;
+    uint32 pos = this->ring_size - rx->CNDTR;
+
+    /* A wrap whose interrupt hasn't run yet.  Reading CNDTR first
+     * means a wrap just after it leaves pos near the end. */
+    if ((dma_get_isr_bits(this->dma_d, this->rx_dma_ch) & BIT(1)) &&
+        pos < this->ring_size / 2) {
+        laps++;
+    }
+    nvic_globalirq_restore(primask);
+    return laps * this->ring_size + pos;
+}
+
+/* RX DMA transfer complete: the ring has wrapped. */
+void HardwareSPI::ringLap(void) {
+    uint32 primask = nvic_globalirq_save();
+    dma_clear_isr_bits(this->dma_d, this->rx_dma_ch);
+    this->ring_laps++;
+    nvic_globalirq_restore(primask);
+}
+
+/* Call with interrupts disabled.  Loads TX DMA with the response, if
+ * no frame is in progress.  A byte that was loaded for the previous
+ * frame but never clocked out would lead the next response, and the
+ * only way to get it out of the data register is to reset the
+ * peripheral, so that is done when (and only when) the last frame
+ * left one behind.  NSS is checked just before, so a reset can only
+ * catch a frame the master starts during those few cycles. */
+void HardwareSPI::armSlaveResponse(void) {
+    spi_dev *dev = this->spi_d;
+    dma_channel_reg_map *tx = dma_channel_regs(this->dma_d, this->tx_dma_ch);
+    const stm32_pin_info *nss = &PIN_MAP[this->nssPin()];
+
+    if (!gpio_read_bit(nss->gpio_device, nss->gpio_bit)) {
+        /* The master has started another frame; this is done again
+         * when it ends. */
+        return;
+    }
+
+    tx->CCR &= ~DMA_CCR_EN;
+    if (tx->CNDTR || !(dev->regs->SR & SPI_SR_TXE)) {
+        uint32 cr1 = dev->regs->CR1;
+        uint32 cr2 = dev->regs->CR2;
+
+        rcc_reset_dev(dev->clk_id);
+        dev->regs->CR2 = cr2 & ~SPI_CR2_TXDMAEN;
+        dev->regs->CR1 = cr1;
+    }
+    if (this->response_len) {
+        tx->CMAR = (uint32)this->response_buf;
+        tx->CNDTR = this->response_len;
+        tx->CCR |= DMA_CCR_EN;
+        dev->regs->CR2 |= SPI_CR2_TXDMAEN;
+    } else {
+        /* Replace the last response's final byte, which would
+         * otherwise be repeated. */
+        dev->regs->CR2 &= ~SPI_CR2_TXDMAEN;
+        dev->regs->DR = 0;
+    }
+}
+
+/* NSS rising edge: the frame the master just finished is whatever DMA
+ * wrote since the last one ended. */
+void HardwareSPI::slaveFrameEnd(void) {
+    uint32 total = this->ring_total;
+    uint32 written = this->ringWritten();
+    uint32 len = written - total;
+
+    this->armSlaveResponse();
+    if (len == 0) {
+        return;
+    }
+    if (len > this->ring_size) {
+        /* Its start has been overwritten. */
+        this->frames_dropped++;
+    } else if (this->frame_head - this->frame_tail <
+               SPI_SLAVE_FRAME_QUEUE_SIZE) {
+        SlaveFrame *f =
+            &this->frames[this->frame_head % SPI_SLAVE_FRAME_QUEUE_SIZE];
+        f->start = total;
+        f->length = len;
+        this->frame_head++;
+    } else {
+        this->frames_dropped++;
+    }
+    this->ring_total = written;
+}
+
+void HardwareSPI::nssIRQ1(void) {
+    ring_ports[0]->slaveFrameEnd();
+}
+
+void HardwareSPI::nssIRQ2(void) {
+    ring_ports[1]->slaveFrameEnd();
+}
+
+void HardwareSPI::nssIRQ3(void) {
+    ring_ports[2]->slaveFrameEnd();
+}
+
+void HardwareSPI::ringLapIRQ1(void) {
+    ring_ports[0]->ringLap();
+}
+
+void HardwareSPI::ringLapIRQ2(void) {
+    ring_ports[1]->ringLap();
+}
+
+void HardwareSPI::ringLapIRQ3(void) {
+    ring_ports[2]->ringLap();
+}
+
+void HardwareSPI::dmaRxCallback(void *arg, dma_irq_cause cause) {
+    ((HardwareSPI*)arg)->rxDone(cause);
+}
+
+/* Runs in the RX DMA interrupt.  The last byte has been received, so
+ * the bus is idle and chip select can be released right away. */
+void HardwareSPI::rxDone(dma_irq_cause cause) {
+    SPITransaction *t = this->queue_head;
+
+    if (cause == DMA_TRANSFER_ERROR) {
+        dma_queue_cancel(this->dma_d, this->tx_dma_ch);
+        t->error = 1;
+        this->xfer_offset = t->length;
+    } else {
+        this->xfer_offset += this->chunk_length;
+    }
+    if (this->xfer_offset < t->length) {
+        this->startChunk(t);
+        return;
+    }
+
+    this->spi_d->regs->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+    cs_write(t->csPin, HIGH);
+    this->xfer_offset = 0;
+
+    uint32 primask = nvic_globalirq_save();
+    this->queue_head = t->next;
+    if (this->queue_head) {
+        this->startChunk(this->queue_head);
+    } else {
+        this->queue_tail = NULL;
+        spi_set_dff(this->spi_d, SPI_DFF_8_BIT);
+    }
+    nvic_globalirq_restore(primask);
+
+    t->done = 1;
+    if (t->callback) {
+        t->callback(t);
+    }
+}
+
 /*
  * Pin accessors
  */
@@ -228,6 +712,50 @@ uint8 HardwareSPI::recv(void) {
 static void configure_gpios(spi_dev *dev, bool as_master);
 static spi_baud_rate determine_baud_rate(spi_dev *dev, SPIFrequency freq);
 
+static bool dev_to_dma_reqs(spi_dev *dev,
+                            dma_request_line *rx_req,
+                            dma_request_line *tx_req) {
+    switch (dev->clk_id) {
+    case RCC_SPI1:
+        *rx_req = DMA_REQ_SPI1_RX;
+        *tx_req = DMA_REQ_SPI1_TX;
+        return true;
+    case RCC_SPI2:
+        *rx_req = DMA_REQ_SPI2_RX;
+        *tx_req = DMA_REQ_SPI2_TX;
+        return true;
+#ifdef STM32_HIGH_DENSITY
+    case RCC_SPI3:
+        *rx_req = DMA_REQ_SPI3_RX;
+        *tx_req = DMA_REQ_SPI3_TX;
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/* Wait for any polled writes to finish, then throw away whatever they
+ * received (and the overrun they probably caused), so a full-duplex
+ * transfer starts with an empty RX register. */
+static void discard_rx(spi_dev *dev) {
+    if (dev->regs->CR1 & SPI_CR1_MSTR) {
+        while (!spi_is_tx_empty(dev) || spi_is_busy(dev))
+            ;
+    }
+    while (spi_is_rx_nonempty(dev)) {
+        (void)spi_rx_reg(dev);
+    }
+    (void)dev->regs->SR;
+}
+
+static void cs_write(uint8 pin, uint8 value) {
+    if (pin != SPI_NO_CS) {
+        gpio_write_bit(PIN_MAP[pin].gpio_device, PIN_MAP[pin].gpio_bit,
+                       value);
+    }
+}
+
 static const spi_pins* dev_to_spi_pins(spi_dev *dev) {
     switch (dev->clk_id) {
     case RCC_SPI1: return board_spi_pins;
@@ -239,16 +767,19 @@ static const spi_pins* dev_to_spi_pins(spi_dev *dev) {
     }
 }
 
-/* Enables the device in master or slave full duplex mode.  If you
- * change this code, you must ensure that appropriate changes are made
+/* Enables the device in master or slave full duplex mode, with
+ * software slave management unless hw_nss is set.  If you change
+ * this code, you must ensure that appropriate changes are made
  * to HardwareSPI::end(). */
 static void enable_device(spi_dev *dev,
                           bool as_master,
                           SPIFrequency freq,
                           spi_cfg_flag endianness,
-                          spi_mode mode) {
+                          spi_mode mode,
+                          bool hw_nss) {
     spi_baud_rate baud = determine_baud_rate(dev, freq);
-    uint32 cfg_flags = (endianness | SPI_DFF_8_BIT | SPI_SW_SLAVE |
+    uint32 cfg_flags = (endianness | SPI_DFF_8_BIT |
+                        (hw_nss ? 0 : SPI_SW_SLAVE) |
                         (as_master ? SPI_SOFT_SS : 0));
 
     spi_init(dev);
@@ -35,6 +35,7 @@
 
 #include "libmaple_types.h"
 #include "spi.h"
+#include "dma.h"
 
 #include "boards.h"
 
@@ -62,6 +63,73 @@ typedef enum SPIFrequency {
 #warning "Unexpected clock speed; SPI frequency calculation will be incorrect"
 #endif
 
+/** SPITransaction::csPin value for transactions without a chip select. */
+#define SPI_NO_CS 0xFF
+
+/** Flags for HardwareSPI::queue(). */
+enum SPITransactionFlag {
+    /**
+     * Use 16-bit data frames.  The buffers hold uint16 values, and
+     * the length counts 16-bit frames.  DMA moves one halfword per
+     * frame.
+     */
+    SPI_TRANSACTION_16BIT   = 0x1,
+
+    /** Send the first frame of txBuffer length times (e.g. for fills). */
+    SPI_TRANSACTION_TX_FILL = 0x2,
+};
+
+/**
+ * @brief A chip-select-tagged transfer for HardwareSPI::queue().
+ *
+ * The caller owns the storage, which must remain valid until the
+ * transaction is done.
+ */
+struct SPITransaction {
+    /**
+     * Pin held low for the duration of the transaction, or SPI_NO_CS.
+     * It must already be configured as an OUTPUT and driven HIGH.
+     */
+    uint8 csPin;
+
+    /** Frames to send, or NULL to send all-ones frames. */
+    const void *txBuffer;
+
+    /** Where to store received frames, or NULL to discard them. */
+    void *rxBuffer;
+
+    /** Number of frames (bytes, unless SPI_TRANSACTION_16BIT) to transfer. */
+    uint32 length;
+
+    /**
+     * Called from the DMA interrupt once the transaction is done and
+     * its chip select has been released.  May be NULL.
+     */
+    void (*callback)(SPITransaction *transaction);
+
+    /** For use by callback. */
+    void *arg;
+
+    /** Nonzero once the transaction is done. */
+    volatile uint8 done;
+
+    /** Nonzero if a DMA error cut the transaction short. */
+    volatile uint8 error;
+
+    /* Private; used by HardwareSPI. */
+    SPITransaction *next;
+    uint8 flags;
+};
+
+#ifndef SPI_SLAVE_FRAME_QUEUE_SIZE
+/** Number of received frames beginSlaveRing() can hold unread; a
+ *  power of two. */
+#define SPI_SLAVE_FRAME_QUEUE_SIZE 16
+#endif
+#if SPI_SLAVE_FRAME_QUEUE_SIZE & (SPI_SLAVE_FRAME_QUEUE_SIZE - 1)
+#error "SPI_SLAVE_FRAME_QUEUE_SIZE must be a power of two"
+#endif
+
 /**
  * @brief Wirish SPI interface.
  *
@@ -111,6 +179,86 @@ public:
      */
     void beginSlave(void);
 
+    /**
+     * @brief Turn on a SPI port as a slave receiving into a DMA ring.
+     *
+     * Unlike beginSlave(), this uses hardware slave management: data
+     * is only clocked in while the master holds NSS low.  Every
+     * received byte goes into buffer, which DMA fills circularly, so
+     * no data is lost however fast the master clocks.  Each rising
+     * edge of NSS (caught with an external interrupt) ends a frame,
+     * which is then available to readFrame().
+     *
+     * The ring must be large enough to hold all the frames that may
+     * arrive before the application reads them.  Frames which are
+     * overwritten before (or while) being read, frames longer than
+     * the ring, and frames arriving when SPI_SLAVE_FRAME_QUEUE_SIZE
+     * frames are unread, are dropped and counted by droppedFrames().
+     *
+     * This mode uses the port's DMA channels, so queue() and
+     * transfer() mustn't be used until end() is called.
+     *
+     * @param buffer Receive ring.
+     * @param size Size of buffer, in bytes; at least 2.
+     * @param bitOrder Either LSBFIRST (little-endian) or MSBFIRST
+     *                 (big-endian)
+     * @param mode SPI mode to use
+     * @return true on success, false if the DMA channels are owned by
+     *         someone else.
+     * @see setSlaveResponse()
+     */
+    bool beginSlaveRing(uint8 *buffer, uint16 size,
+                        uint32 bitOrder, uint32 mode);
+
+    /**
+     * @brief Set the bytes to send the master during each frame.
+     *
+     * When using beginSlaveRing(), TX DMA is loaded with the response
+     * whenever a frame ends, so it's ready to go before the master
+     * selects the slave again.  Once the response is used up, its
+     * last byte is sent again for the rest of the frame.  With no
+     * response, zero bytes are sent.
+     *
+     * If a frame ends before the whole response has been sent, a
+     * leftover byte must be flushed by resetting the SPI, which is
+     * only done if NSS is still high when the frame's interrupt runs.
+     * Otherwise the frame the master has already started goes
+     * without a fresh response, and the response is loaded when it
+     * ends.
+     *
+     * @param buffer Response to send.  It must remain valid until it
+     *               is replaced.  NULL disables the response.
+     * @param length Number of bytes in buffer.
+     */
+    void setSlaveResponse(const uint8 *buffer, uint16 length);
+
+    /**
+     * @brief Return the number of complete frames waiting to be read.
+     * @see beginSlaveRing()
+     */
+    uint32 framesAvailable(void);
+
+    /**
+     * @brief Read the oldest received frame.
+     *
+     * This is safe to call while reception continues; a frame that
+     * was overwritten while being copied is dropped, and the next one
+     * is returned instead.
+     *
+     * @param buffer Where to copy the frame.
+     * @param maxLength Size of buffer.  Longer frames are truncated.
+     * @return Number of bytes in the frame (possibly greater than
+     *         maxLength), or 0 if no frame is available.
+     * @see beginSlaveRing()
+     */
+    uint32 readFrame(uint8 *buffer, uint32 maxLength);
+
+    /**
+     * @brief Return the number of received frames dropped so far.
+     * @see beginSlaveRing()
+     */
+    uint32 droppedFrames(void);
+
     /**
      * @brief Disables the SPI port, but leaves its GPIO pin modes unchanged.
      */
@@ -160,6 +308,83 @@ public:
      */
     uint8 transfer(uint8 data);
 
+    /**
+     * @brief Full-duplex transfer of multiple bytes.
+     *
+     * Sends length bytes from txBuffer while storing the bytes
+     * received at the same time into rxBuffer, returning when done.
+     * Uses DMA when the port's DMA channels are available (see
+     * queue()); otherwise, falls back to polling.
+     *
+     * @param txBuffer Bytes to send, or NULL to send 0xFF bytes.
+     * @param rxBuffer Where to store received bytes, or NULL to
+     *                 discard them.  May be the same as txBuffer.
+     * @param length Number of bytes to transfer.
+     */
+    void transfer(const uint8 *txBuffer, uint8 *rxBuffer, uint32 length);
+
+    /*
+     * 16-bit frame I/O.  These switch the port to 16-bit data frames
+     * for the duration of the call.
+     */
+
+    /**
+     * @brief Transmit multiple 16-bit frames.
+     * @param buffer Frames to transmit.
+     * @param length Number of frames in buffer to transmit.
+     */
+    void write16(const uint16 *buffer, uint32 length);
+
+    /**
+     * @brief Full-duplex transfer of multiple 16-bit frames.
+     * @param txBuffer Frames to send, or NULL to send 0xFFFF frames.
+     * @param rxBuffer Where to store received frames, or NULL to
+     *                 discard them.
+     * @param length Number of frames to transfer.
+     * @see transfer(const uint8*, uint8*, uint32)
+     */
+    void transfer16(const uint16 *txBuffer, uint16 *rxBuffer, uint32 length);
+
+    /**
+     * @brief Transmit the same 16-bit frame repeatedly.
+     *
+     * With DMA, this is a single halfword transfer with the memory
+     * address held fixed, so it's a cheap way to fill a display
+     * region with a solid RGB565 color.
+     *
+     * @param value Frame to transmit.
+     * @param count Number of times to transmit it.
+     */
+    void fill16(uint16 value, uint32 count);
+
+    /**
+     * @brief Queue a transaction to run in the background using DMA.
+     *
+     * Transactions run in the order they were queued.  Each one
+     * asserts its chip select, transfers its buffers at full bus
+     * speed, releases its chip select, and then runs its callback.
+     * The next transaction is started from the DMA interrupt, without
+     * any involvement from the caller.
+     *
+     * The first call claims the port's RX and TX DMA channels with
+     * dma_request_channel().
+     *
+     * Don't use the polling read() and write() methods while
+     * transactions are pending.
+     *
+     * @param transaction Transaction to queue.
+     * @param flags Bitwise OR of SPITransactionFlag values.
+     * @return true on success, false if the DMA channels are owned by
+     *         someone else.
+     * @see SPITransaction
+     */
+    bool queue(SPITransaction *transaction, uint32 flags=0);
+
+    /**
+     * @brief Return true if no queued transactions are pending.
+     */
+    bool isIdle(void);
+
     /*
      * Pin accessors
      */
@@ -217,6 +442,54 @@ public:
     uint8 recv(void);
 private:
     spi_dev *spi_d;
+
+    /* DMA state; see queue(). */
+    dma_dev *dma_d;
+    dma_channel rx_dma_ch;
+    dma_channel tx_dma_ch;
+    bool have_dma;
+    SPITransaction *volatile queue_head;
+    SPITransaction *queue_tail;
+    uint32 xfer_offset;
+    uint16 chunk_length;
+    uint16 dummy_tx;
+    uint16 dummy_rx;
+
+    void transferBlocking(const void *tx_buf, void *rx_buf, uint32 len,
+                          uint32 flags);
+    /* Slave receive ring state; see beginSlaveRing(). */
+    struct SlaveFrame {
+        uint32 start;           /* total bytes received before it */
+        uint32 length;
+    };
+    uint8 *ring_buf;
+    uint16 ring_size;
+    volatile uint32 ring_total; /* bytes received in complete frames */
+    volatile uint32 ring_laps;  /* times RX DMA has wrapped */
+    SlaveFrame frames[SPI_SLAVE_FRAME_QUEUE_SIZE];
+    volatile uint32 frame_head; /* written by the NSS interrupt */
+    volatile uint32 frame_tail; /* written by readFrame() */
+    volatile uint32 frames_dropped; /* written by the NSS interrupt */
+    volatile uint32 frames_lapped; /* written by readFrame() */
+    const uint8 *response_buf;
+    uint16 response_len;
+
+    uint32 ringWritten(void);
+    void armSlaveResponse(void);
+    void slaveFrameEnd(void);
+    void ringLap(void);
+    static void nssIRQ1(void);
+    static void nssIRQ2(void);
+    static void nssIRQ3(void);
+    static void ringLapIRQ1(void);
+    static void ringLapIRQ2(void);
+    static void ringLapIRQ3(void);
+
+    bool claimDMA(void);
+    void releaseDMA(void);
+    void startChunk(SPITransaction *transaction);
+    void rxDone(dma_irq_cause cause);
+    static void dmaRxCallback(void *arg, dma_irq_cause cause);
 };
 
 #endif
@@ -114,6 +114,14 @@ void HardwareSerial::write(unsigned char ch) {
     usart_putc(usart_device, ch);
 }
 
+void HardwareSerial::write(const void *buf, uint32 len) {
+    const uint8 *txbuf = (const uint8*)buf;
+    uint32 txed = 0;
+    while (txed < len) {
+        txed += usart_tx(usart_device, txbuf + txed, len - txed);
+    }
+}
+
 void HardwareSerial::flush(void) {
     usart_reset_rx(usart_device);
 }
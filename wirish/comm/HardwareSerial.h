@@ -63,6 +63,7 @@ public:
     uint8 read(void);
     void flush(void);
     virtual void write(unsigned char);
+    virtual void write(const void *buf, uint32 len);
     using Print::write;
 
     /* Pin accessors */